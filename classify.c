@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "classify.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLASSIFY_X86
+#include <immintrin.h>
+#endif
+
+/*
+ *  Bit positions of the pagemap bits we count
+ */
+#define BIT_DIRTY	(55)
+#define BIT_EXCLUSIVE	(56)
+#define BIT_HUGE	(58)
+#define BIT_FILE	(61)
+#define BIT_SWAPPED	(62)
+#define BIT_PRESENT	(63)
+
+/*
+ *  classify_add()
+ *	add counts of each bit and of pages in each state to counts,
+ *	the state counts are derived from the bit counts where
+ *	h = huge & !dirty, m = file & !huge & !dirty,
+ *	s = swapped & !file & !dirty and
+ *	p = present & !swapped & !file & !huge & !dirty
+ */
+static inline void classify_add(
+	page_counts_t *counts,
+	const size_t n,
+	const uint64_t p,
+	const uint64_t s,
+	const uint64_t f,
+	const uint64_t d,
+	const uint64_t e,
+	const uint64_t h,
+	const uint64_t pp,
+	const uint64_t ss,
+	const uint64_t mm,
+	const uint64_t hh)
+{
+	counts->pages += n;
+	counts->present += p;
+	counts->swapped += s;
+	counts->file += f;
+	counts->dirty += d;
+	counts->exclusive += e;
+	counts->huge += h;
+	counts->state[PAGE_STATE_DIRTY] += d;
+	counts->state[PAGE_STATE_HUGE] += hh;
+	counts->state[PAGE_STATE_FILE] += mm;
+	counts->state[PAGE_STATE_SWAPPED] += ss;
+	counts->state[PAGE_STATE_PRESENT] += pp;
+	counts->state[PAGE_STATE_NONE] += n - (d + hh + mm + ss + pp);
+}
+
+/*
+ *  classify_scalar()
+ *	portable classifier, one word at a time
+ */
+static void classify_scalar(
+	const pagemap_t *words,
+	const size_t n,
+	uint8_t *states,
+	page_counts_t *counts)
+{
+	uint64_t p = 0, s = 0, f = 0, d = 0, e = 0, h = 0;
+	uint64_t pp = 0, ss = 0, mm = 0, hh = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		const pagemap_t w = words[i];
+		const uint64_t wp = (w >> BIT_PRESENT) & 1;
+		const uint64_t ws = (w >> BIT_SWAPPED) & 1;
+		const uint64_t wf = (w >> BIT_FILE) & 1;
+		const uint64_t wd = (w >> BIT_DIRTY) & 1;
+		const uint64_t wh = (w >> BIT_HUGE) & 1;
+		const uint64_t whh = wh & ~wd;
+		const uint64_t wm = wf & ~wh & ~wd;
+		const uint64_t wss = ws & ~wf & ~wd;
+		const uint64_t wpp = wp & ~ws & ~wf & ~wh & ~wd;
+
+		p += wp;
+		s += ws;
+		f += wf;
+		d += wd;
+		e += (w >> BIT_EXCLUSIVE) & 1;
+		h += wh;
+		hh += whh;
+		mm += wm;
+		ss += wss;
+		pp += wpp;
+		if (states)
+			states[i] = (uint8_t)((wd * 5) + (whh << 2) +
+				(wm * 3) + (wss << 1) + wpp);
+	}
+	classify_add(counts, n, p, s, f, d, e, h, pp, ss, mm, hh);
+}
+
+#if defined(CLASSIFY_X86)
+/*
+ *  hsum128()
+ *	sum the two 64 bit lanes of a vector
+ */
+__attribute__((target("sse2")))
+static inline uint64_t hsum128(const __m128i v)
+{
+	uint64_t lanes[2];
+
+	_mm_storeu_si128((__m128i *)lanes, v);
+	return lanes[0] + lanes[1];
+}
+
+/*
+ *  classify_sse2()
+ *	SSE2 classifier, two words at a time
+ */
+__attribute__((target("sse2")))
+static void classify_sse2(
+	const pagemap_t *words,
+	const size_t n,
+	uint8_t *states,
+	page_counts_t *counts)
+{
+	const __m128i one = _mm_set1_epi64x(1);
+	__m128i p = _mm_setzero_si128(), s = p, f = p, d = p, e = p, h = p;
+	__m128i pp = p, ss = p, mm = p, hh = p;
+	const size_t n2 = n & ~(size_t)1;
+	size_t i;
+
+	for (i = 0; i < n2; i += 2) {
+		const __m128i w = _mm_loadu_si128((const __m128i *)&words[i]);
+		const __m128i wp = _mm_srli_epi64(w, BIT_PRESENT);
+		const __m128i ws = _mm_and_si128(_mm_srli_epi64(w, BIT_SWAPPED), one);
+		const __m128i wf = _mm_and_si128(_mm_srli_epi64(w, BIT_FILE), one);
+		const __m128i wd = _mm_and_si128(_mm_srli_epi64(w, BIT_DIRTY), one);
+		const __m128i we = _mm_and_si128(_mm_srli_epi64(w, BIT_EXCLUSIVE), one);
+		const __m128i wh = _mm_and_si128(_mm_srli_epi64(w, BIT_HUGE), one);
+		const __m128i whh = _mm_andnot_si128(wd, wh);
+		const __m128i wm = _mm_andnot_si128(_mm_or_si128(wh, wd), wf);
+		const __m128i wss = _mm_andnot_si128(_mm_or_si128(wf, wd), ws);
+		const __m128i wpp = _mm_andnot_si128(_mm_or_si128(
+			_mm_or_si128(ws, wh), _mm_or_si128(wf, wd)), wp);
+
+		p = _mm_add_epi64(p, wp);
+		s = _mm_add_epi64(s, ws);
+		f = _mm_add_epi64(f, wf);
+		d = _mm_add_epi64(d, wd);
+		e = _mm_add_epi64(e, we);
+		h = _mm_add_epi64(h, wh);
+		hh = _mm_add_epi64(hh, whh);
+		mm = _mm_add_epi64(mm, wm);
+		ss = _mm_add_epi64(ss, wss);
+		pp = _mm_add_epi64(pp, wpp);
+
+		if (states) {
+			/* state = 5d + 4h + 3m + 2s + p, one of which is set */
+			const __m128i code = _mm_add_epi64(_mm_add_epi64(
+				_mm_slli_epi64(_mm_add_epi64(wd, whh), 2),
+				_mm_add_epi64(wd, wm)),
+				_mm_add_epi64(_mm_slli_epi64(_mm_add_epi64(wm, wss), 1), wpp));
+
+			states[i] = (uint8_t)_mm_cvtsi128_si32(code);
+			states[i + 1] = (uint8_t)_mm_extract_epi16(code, 4);
+		}
+	}
+	classify_add(counts, n2, hsum128(p), hsum128(s), hsum128(f),
+		hsum128(d), hsum128(e), hsum128(h), hsum128(pp), hsum128(ss),
+		hsum128(mm), hsum128(hh));
+
+	if (n2 < n)
+		classify_scalar(words + n2, n - n2, states ? states + n2 : NULL, counts);
+}
+
+/*
+ *  hsum256()
+ *	sum the four 64 bit lanes of a vector
+ */
+__attribute__((target("avx2")))
+static inline uint64_t hsum256(const __m256i v)
+{
+	uint64_t lanes[4];
+
+	_mm256_storeu_si256((__m256i *)lanes, v);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/*
+ *  classify_avx2()
+ *	AVX2 classifier, four words at a time
+ */
+__attribute__((target("avx2")))
+static void classify_avx2(
+	const pagemap_t *words,
+	const size_t n,
+	uint8_t *states,
+	page_counts_t *counts)
+{
+	const __m256i one = _mm256_set1_epi64x(1);
+	__m256i p = _mm256_setzero_si256(), s = p, f = p, d = p, e = p, h = p;
+	__m256i pp = p, ss = p, mm = p, hh = p;
+	const size_t n4 = n & ~(size_t)3;
+	size_t i;
+
+	for (i = 0; i < n4; i += 4) {
+		const __m256i w = _mm256_loadu_si256((const __m256i *)&words[i]);
+		const __m256i wp = _mm256_srli_epi64(w, BIT_PRESENT);
+		const __m256i ws = _mm256_and_si256(_mm256_srli_epi64(w, BIT_SWAPPED), one);
+		const __m256i wf = _mm256_and_si256(_mm256_srli_epi64(w, BIT_FILE), one);
+		const __m256i wd = _mm256_and_si256(_mm256_srli_epi64(w, BIT_DIRTY), one);
+		const __m256i we = _mm256_and_si256(_mm256_srli_epi64(w, BIT_EXCLUSIVE), one);
+		const __m256i wh = _mm256_and_si256(_mm256_srli_epi64(w, BIT_HUGE), one);
+		const __m256i whh = _mm256_andnot_si256(wd, wh);
+		const __m256i wm = _mm256_andnot_si256(_mm256_or_si256(wh, wd), wf);
+		const __m256i wss = _mm256_andnot_si256(_mm256_or_si256(wf, wd), ws);
+		const __m256i wpp = _mm256_andnot_si256(_mm256_or_si256(
+			_mm256_or_si256(ws, wh), _mm256_or_si256(wf, wd)), wp);
+
+		p = _mm256_add_epi64(p, wp);
+		s = _mm256_add_epi64(s, ws);
+		f = _mm256_add_epi64(f, wf);
+		d = _mm256_add_epi64(d, wd);
+		e = _mm256_add_epi64(e, we);
+		h = _mm256_add_epi64(h, wh);
+		hh = _mm256_add_epi64(hh, whh);
+		mm = _mm256_add_epi64(mm, wm);
+		ss = _mm256_add_epi64(ss, wss);
+		pp = _mm256_add_epi64(pp, wpp);
+
+		if (states) {
+			/* state = 5d + 4h + 3m + 2s + p, one of which is set */
+			const __m256i code = _mm256_add_epi64(_mm256_add_epi64(
+				_mm256_slli_epi64(_mm256_add_epi64(wd, whh), 2),
+				_mm256_add_epi64(wd, wm)),
+				_mm256_add_epi64(_mm256_slli_epi64(
+					_mm256_add_epi64(wm, wss), 1), wpp));
+			uint64_t lanes[4];
+
+			_mm256_storeu_si256((__m256i *)lanes, code);
+			states[i] = (uint8_t)lanes[0];
+			states[i + 1] = (uint8_t)lanes[1];
+			states[i + 2] = (uint8_t)lanes[2];
+			states[i + 3] = (uint8_t)lanes[3];
+		}
+	}
+	classify_add(counts, n4, hsum256(p), hsum256(s), hsum256(f),
+		hsum256(d), hsum256(e), hsum256(h), hsum256(pp), hsum256(ss),
+		hsum256(mm), hsum256(hh));
+
+	if (n4 < n)
+		classify_scalar(words + n4, n - n4, states ? states + n4 : NULL, counts);
+}
+#endif
+
+classify_func_t classify_pagemap = classify_scalar;
+static const char *isa = "scalar";
+
+/*
+ *  classify_select()
+ *	the classifier for the named instruction set,
+ *	NULL if this CPU or build does not support it
+ */
+classify_func_t classify_select(const char *name)
+{
+#if defined(CLASSIFY_X86)
+	__builtin_cpu_init();
+	if (!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2") ? classify_avx2 : NULL;
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2") ? classify_sse2 : NULL;
+#endif
+	if (!strcmp(name, "scalar"))
+		return classify_scalar;
+	return NULL;
+}
+
+/*
+ *  classify_init()
+ *	pick the fastest classifier this CPU supports
+ */
+void classify_init(void)
+{
+	static const char *isas[] = { "avx2", "sse2", "scalar" };
+	size_t i;
+
+	for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+		const classify_func_t func = classify_select(isas[i]);
+
+		if (func) {
+			classify_pagemap = func;
+			isa = isas[i];
+			return;
+		}
+	}
+}
+
+/*
+ *  classify_isa()
+ *	name of the instruction set used by the classifier
+ */
+const char *classify_isa(void)
+{
+	return isa;
+}
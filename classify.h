@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef __CLASSIFY_H__
+#define __CLASSIFY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  PTE bits from uint64_t in /proc/PID/pagemap
+ *  for each mapped page
+ */
+#define	PAGE_PFN_MASK		((1ULL << 55) - 1)
+#define	PAGE_PTE_SOFT_DIRTY	(1ULL << 55)
+#define	PAGE_EXCLUSIVE_MAPPED	(1ULL << 56)
+#define	PAGE_PTE_UFFD_WP	(1ULL << 57)
+#define PAGE_FILE_SHARED_ANON	(1ULL << 61)
+#define PAGE_SWAPPED		(1ULL << 62)
+#define PAGE_PRESENT		(1ULL << 63)
+
+/*
+ *  Bit 58 is always zero in pagemap words, pagemon
+ *  sets it on the words of PMD mapped huge pages
+ *  found by PAGEMAP_SCAN
+ */
+#define PAGE_HUGE_MAPPED	(1ULL << 58)
+
+typedef uint64_t pagemap_t;		/* PTE page map bits */
+
+/*
+ *  Page states shown in the page view, in order
+ *  of priority when a page has more than one
+ */
+enum {
+	PAGE_STATE_NONE = 0,		/* Not in RAM or swap */
+	PAGE_STATE_PRESENT,		/* Present in RAM */
+	PAGE_STATE_SWAPPED,		/* Present in swap */
+	PAGE_STATE_FILE,		/* File or shared anon */
+	PAGE_STATE_HUGE,		/* PMD mapped huge page */
+	PAGE_STATE_DIRTY,		/* Soft-dirty */
+	PAGE_STATE_MAX
+};
+
+/*
+ *  Counts of pagemap bits and page states over
+ *  a block of pages
+ */
+typedef struct {
+	uint64_t pages;			/* Pages counted */
+	uint64_t present;		/* PAGE_PRESENT set */
+	uint64_t swapped;		/* PAGE_SWAPPED set */
+	uint64_t file;			/* PAGE_FILE_SHARED_ANON set */
+	uint64_t dirty;			/* PAGE_PTE_SOFT_DIRTY set */
+	uint64_t exclusive;		/* PAGE_EXCLUSIVE_MAPPED set */
+	uint64_t huge;			/* PAGE_HUGE_MAPPED set */
+	uint64_t state[PAGE_STATE_MAX];	/* Pages in each page state */
+} page_counts_t;
+
+/*
+ *  Pagemap classifier, adds the counts of n pagemap
+ *  words to counts and, if states is not NULL, stores
+ *  the PAGE_STATE_* of each page in states
+ */
+typedef void (*classify_func_t)(const pagemap_t *words, const size_t n,
+	uint8_t *states, page_counts_t *counts);
+
+extern void classify_init(void);
+extern const char *classify_isa(void);
+extern classify_func_t classify_select(const char *name);
+extern classify_func_t classify_pagemap;
+
+#endif
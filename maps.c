@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "maps.h"
+
+#include <string.h>
+
+/*
+ *  parse_hex()
+ *	parse a hex value up to eol, advancing ptr
+ *	to the first character after the value
+ */
+static inline uint64_t parse_hex(const char **ptr, const char *eol)
+{
+	const char *p = *ptr;
+	uint64_t val = 0;
+
+	for (; p < eol; p++) {
+		const uint8_t ch = (uint8_t)*p;
+
+		if ((uint8_t)(ch - '0') < 10)
+			val = (val << 4) | (ch - '0');
+		else if ((uint8_t)((ch | 0x20) - 'a') < 6)
+			val = (val << 4) | ((ch | 0x20) - 'a' + 10);
+		else
+			break;
+	}
+	*ptr = p;
+	return val;
+}
+
+/*
+ *  parse_char()
+ *	is the next character before eol ch? if so skip it
+ */
+static inline bool parse_char(const char **ptr, const char *eol, const char ch)
+{
+	if ((*ptr >= eol) || (**ptr != ch))
+		return false;
+	(*ptr)++;
+	return true;
+}
+
+/*
+ *  maps_parse()
+ *	parse one line of /proc/$PID/maps, of the form
+ *	begin-end attr offset dev inode [pathname]
+ *	returns false if the line is malformed or cut short.
+ *	Nothing past end is read, so the buffer need not be
+ *	NUL terminated. The start of the next line is
+ *	returned in next.
+ */
+bool maps_parse(
+	const char *ptr,
+	const char *end,
+	maps_line_t *line,
+	const char **next)
+{
+	const char *eol, *dev;
+	size_t len;
+
+	eol = memchr(ptr, '\n', (size_t)(end - ptr));
+	if (!eol)
+		eol = end;
+	*next = (eol < end) ? eol + 1 : end;
+
+	line->begin = parse_hex(&ptr, eol);
+	if (!parse_char(&ptr, eol, '-'))
+		return false;
+	line->end = parse_hex(&ptr, eol);
+	if (!parse_char(&ptr, eol, ' ') || (eol - ptr < 5))
+		return false;
+	memcpy(line->attr, ptr, 4);
+	line->attr[4] = '\0';
+	ptr += 4;
+	if (!parse_char(&ptr, eol, ' '))
+		return false;
+	line->offset = parse_hex(&ptr, eol);
+	if (!parse_char(&ptr, eol, ' '))
+		return false;
+
+	/* Device is major:minor in hex */
+	dev = ptr;
+	while ((ptr < eol) && (*ptr != ' '))
+		ptr++;
+	len = (size_t)(ptr - dev);
+	if (len > sizeof(line->dev) - 1)
+		len = sizeof(line->dev) - 1;
+	memcpy(line->dev, dev, len);
+	line->dev[len] = '\0';
+	if (!parse_char(&ptr, eol, ' '))
+		return false;
+
+	/* Inode is in decimal */
+	line->inode = 0;
+	if ((ptr >= eol) || ((uint8_t)(*ptr - '0') >= 10))
+		return false;
+	while ((ptr < eol) && ((uint8_t)(*ptr - '0') < 10))
+		line->inode = (line->inode * 10) + (uint64_t)(*ptr++ - '0');
+
+	/* Pathname is the rest of the line after the padding */
+	while ((ptr < eol) && (*ptr == ' '))
+		ptr++;
+	line->name = ptr;
+	line->name_len = (size_t)(eol - ptr);
+
+	return true;
+}
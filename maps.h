@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef __MAPS_H__
+#define __MAPS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ *  A line of /proc/$PID/maps, the pathname points
+ *  into the line and is not NUL terminated
+ */
+typedef struct {
+	uint64_t begin;			/* Start of mapping */
+	uint64_t end;			/* End of mapping */
+	uint64_t offset;		/* Offset into mapped file */
+	uint64_t inode;			/* Inode of mapped file */
+	char attr[5];			/* Map attributes */
+	char dev[6];			/* Map device, if any */
+	const char *name;		/* Pathname, if any */
+	size_t name_len;		/* Length of pathname */
+} maps_line_t;
+
+extern bool maps_parse(const char *ptr, const char *end,
+	maps_line_t *line, const char **next);
+
+#endif
@@ -22,12 +22,14 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <libgen.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -38,17 +40,27 @@
 #include <libgen.h>
 #include <ctype.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include "perf.h"
+#include "classify.h"
+#include "uring.h"
+#include "maps.h"
 
 #define APP_NAME		"pagemon"
-#define MAX_MAPS		(65536)
+#define MAPS_MIN		(64)	/* Initial size of map arrays */
+#define STRTAB_HASH_MIN		(256)	/* Initial size of name hash */
 
 #define ADDR_OFFSET		(17)	/* Display x offset from address */
 #define HEX_WIDTH		(3)	/* Width of each 2 hex digit value */
 
 #define VIEW_PAGE		(0)	/* View pages in memory map */
 #define VIEW_MEM		(1)	/* View memory in hex */
+#define VIEW_MAPS		(2)	/* View table of maps */
 
 #define MIN_TICKS		(1)
 #define MAX_TICKS		(1000)
@@ -62,7 +74,63 @@
 #define DEFAULT_UDELAY		(15000)	/* Delay between each refresh */
 #define DEFAULT_TICKS		(60)	/* Ticks between dirty page checks */
 #define PROCPATH_MAX		(32)	/* Size of proc pathnames */
+#define BUF_SIZE_MIN		(65536)	/* Initial size of file buffers */
+#define SAMPLE_GAP_MAX		(64)	/* Max pagemap words read between extents */
+#define SAMPLE_EXTENTS_MIN	(64)	/* Initial size of sample extents */
+#define SAMPLE_READ_MAX		(65536)	/* Max pagemap words in one read */
+#define SAMPLE_BATCH_WORDS	(1 << 18) /* Max pagemap words in a batch */
+#define SCAN_WORDS_MIN		(4096)	/* Min pagemap words to scan first */
+#define SCAN_REGIONS_MAX	(32)	/* Max populated regions of a scan */
+#define HUGE_PROBE_PASSES	(16)	/* Map passes between huge page probes */
+#define RESERVED_READ_WORDS	(512)	/* Words in a read of a PROT_NONE map */
+#define RESERVED_READ_MAX	(1 << 20) /* Max words read of a PROT_NONE map */
+#define WSS_WINDOWS_MAX		(4)	/* Max working set size windows */
+#define WSS_INTERVALS		(4096)	/* Dirty intervals kept, divides 2^16 */
+#define WSS_HISTORY		(32)	/* Samples in a window's sparkline */
+#define IDLE_GAP_WORDS		(8)	/* Max idle bitmap words read between PFNs */
+#define IDLE_RUN_WORDS		(4096)	/* Max idle bitmap words in one read */
+#define IDLE_AGE_MAX		(255)	/* Idle rounds + 1 saturate here */
+#define KPAGE_GAP_WORDS		(64)	/* Max unused kpage words read */
+#define KPAGE_RUN_WORDS		(8192)	/* Max kpage words in one read */
+#define PSS_SHIFT		(12)	/* Fixed point bits of PSS pages */
+#define SHARE_PROCS_MAX		(8)	/* Max sharing matrix processes */
+#define SORT_BITS		(11)	/* Bits of each PFN radix sort pass */
+#define DAMON_SAMPLE_US		(5000)	/* DAMON sampling interval */
+#define DAMON_AGGR_US		(100000) /* DAMON aggregation interval */
+#define DAMON_AGGR_US_MAX	(60000000) /* Max DAMON aggregation interval */
+#define DAMON_COLD_USECS	(5000000) /* Unaccessed regions cold after */
+#define SAMPLE_VISIBLE_MAX	(1 << 20) /* Max visible pages sampled a frame */
+#define SAMPLE_SWEEP_MAX	(16384)	/* Pages swept a frame */
+#define TABLE_SWEEP_MAX		(1 << 16) /* Pages swept a maps view frame */
+#define TABLE_SORT_USECS	(1000000) /* Max age of maps table order */
+#define TABLE_FILTER_MAX	(32)	/* Max maps table filter length + 1 */
+#define PYRAMID_BASE_SHIFT	(6)	/* Log2 of pages in a base node */
+#define PYRAMID_BASE		(1 << PYRAMID_BASE_SHIFT)
+#define PYRAMID_LEVELS_MAX	(26)	/* Keeps node counts within 32 bits */
+#define BATCH_UDELAY		(1000000) /* Default delay between records */
+#define BATCH_SWEEP_MAX		(1 << 22) /* Pages swept between records */
+#define SWEEP_WORKERS_DEFAULT	(8)	/* Max default sweep workers */
+#define SWEEP_WORKERS_MAX	(64)	/* Max sweep workers */
+#define SWEEP_CHUNK_DEFAULT	(1 << 16) /* Pages in a sweep chunk */
+#define SWEEP_CHUNK_MAX		(1 << 24) /* Max pages in a sweep chunk */
 #define BLINK_MASK		(0x20)	/* Cursor blink counter mask */
+#define BLINK_USECS		(500000) /* Cursor blink period */
+#define EVENTS_MAX		(8)	/* Max events per epoll_wait */
+#define SNAP_SLOTS		(3)	/* Triple buffered snapshots */
+#define SNAP_INDEX_MASK		(0x3)	/* Snapshot slot index */
+#define SNAP_FRESH		(0x4)	/* Latest snapshot not yet taken */
+#define VM_STATS_MAX		(16)	/* Max Vm lines of /proc/$PID/status */
+#define PERF_TICKS		(10)	/* Samples between perf restarts */
+#define MEM_BYTE_FAILED		(-1)	/* Memory view byte could not be read */
+#define MEM_BYTE_END		(-2)	/* Memory view byte past end of memory */
+#define EST_Z			(1.96)	/* Normal quantile of a 95% interval */
+#define EST_ERROR_DEFAULT	(1.0)	/* Default estimate error, percent */
+#define EST_ERROR_MIN		(0.01)	/* Min estimate error, percent */
+#define EST_ERROR_MAX		(50.0)	/* Max estimate error, percent */
+#define EST_READS_DEFAULT	(2048)	/* Default pagemap reads a round */
+#define EST_READS_MAX		(1 << 20) /* Max pagemap reads a round */
+#define EST_SAMPLES_MIN		(32)	/* Pilot and min pages of a pass */
+#define EST_READ_WORDS		(512)	/* Words read in one go cost a read */
 
 /*
  *  Memory size scaling
@@ -85,19 +153,164 @@
 #define ERR_RESIZE_FAIL		(-7)
 #define ERR_NO_PROCESS		(-8)
 #define ERR_FAULT		(-9)
+#define ERR_NO_THREAD		(-10)
+#define ERR_NO_EVENTS		(-11)
+#define ERR_NO_OUTPUT		(-12)
+
+#define OPT_FLAG_READ_ALL_PAGES	(0x00000001)
+#define OPT_FLAG_PID		(0x00000002)
+#define OPT_FLAG_BATCH		(0x00000004)
+#define OPT_FLAG_BATCH_MAPS	(0x00000008)
+#define OPT_FLAG_URING		(0x00000010)
+#define OPT_FLAG_IDLE		(0x00000020)
+#define OPT_FLAG_DAMON		(0x00000040)
+#define OPT_FLAG_KFLAGS		(0x00000080)
+#define OPT_FLAG_KCOUNT		(0x00000100)
+#define OPT_FLAG_ESTIMATE	(0x00000200)
 
 /*
- *  PTE bits from uint64_t in /proc/PID/pagemap
- *  for each mapped page
+ *  PAGEMAP_SCAN ioctl on /proc/$PID/pagemap (Linux 6.7),
+ *  defined here for when the system headers lack it
  */
-#define	PAGE_PTE_SOFT_DIRTY	(1ULL << 55)
-#define	PAGE_EXCLUSIVE_MAPPED	(1ULL << 56)
-#define PAGE_FILE_SHARED_ANON	(1ULL << 61)
-#define PAGE_SWAPPED		(1ULL << 62)
-#define PAGE_PRESENT		(1ULL << 63)
+#if !defined(PAGEMAP_SCAN)
+#define PAGE_IS_WPALLOWED	(1 << 0)
+#define PAGE_IS_WRITTEN		(1 << 1)
+#define PAGE_IS_FILE		(1 << 2)
+#define PAGE_IS_PRESENT		(1 << 3)
+#define PAGE_IS_SWAPPED		(1 << 4)
+#define PAGE_IS_PFNZERO		(1 << 5)
+#define PAGE_IS_HUGE		(1 << 6)
+#define PAGE_IS_SOFT_DIRTY	(1 << 7)
+
+struct page_region {
+	uint64_t start;
+	uint64_t end;
+	uint64_t categories;
+};
 
-#define OPT_FLAG_READ_ALL_PAGES	(0x00000001)
-#define OPT_FLAG_PID		(0x00000002)
+struct pm_scan_arg {
+	uint64_t size;
+	uint64_t flags;
+	uint64_t start;
+	uint64_t end;
+	uint64_t walk_end;
+	uint64_t vec;
+	uint64_t vec_len;
+	uint64_t max_pages;
+	uint64_t category_inverted;
+	uint64_t category_mask;
+	uint64_t category_anyof_mask;
+	uint64_t return_mask;
+};
+
+#define PM_SCAN_WP_MATCHING	(1 << 0)
+#define PM_SCAN_CHECK_WPASYNC	(1 << 1)
+
+#define PAGEMAP_SCAN		_IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+#define SCAN_UNKNOWN		(0)	/* PAGEMAP_SCAN not tried yet */
+#define SCAN_OK			(1)	/* PAGEMAP_SCAN works */
+#define SCAN_NONE		(2)	/* PAGEMAP_SCAN not supported */
+
+/*
+ *  Ways the pagemap words of a range are scanned before they are read
+ */
+enum {
+	SCAN_SKIP = 0,			/* Read them all in one go */
+	SCAN_ALL,			/* Scanned for populated pages */
+};
+
+/*
+ *  Dirty page tracking modes
+ */
+enum {
+	DIRTY_NONE = 0,			/* Soft-dirty bits left alone */
+	DIRTY_REFS,			/* Clear soft-dirty via clear_refs */
+	DIRTY_WP,			/* Write-protect via PAGEMAP_SCAN */
+};
+
+/*
+ *  Maps table columns
+ */
+enum {
+	TABLE_BEGIN = 0,		/* Start of map */
+	TABLE_SIZE,			/* Pages mapped */
+	TABLE_PRESENT,			/* Present pages */
+	TABLE_SWAPPED,			/* Swapped pages */
+	TABLE_DIRTY,			/* Soft-dirty pages */
+	TABLE_FILE,			/* File or shared anon pages */
+	TABLE_EXCLUSIVE,		/* Exclusively mapped pages */
+	TABLE_HUGE,			/* Huge pages */
+	TABLE_COLD,			/* Idle pages */
+	TABLE_ERROR,			/* Estimate error, 1/100ths of % */
+	TABLE_ATTR,			/* Map attributes */
+	TABLE_NAME,			/* Map name */
+	TABLE_COLS,			/* Number of columns */
+};
+
+/*
+ *  Page count fields estimated by sampling
+ */
+enum {
+	EST_PRESENT = 0,		/* Present pages */
+	EST_SWAPPED,			/* Swapped pages */
+	EST_DIRTY,			/* Soft-dirty pages */
+	EST_FILE,			/* File or shared anon pages */
+	EST_SHARED,			/* Present, not exclusively mapped */
+	EST_FIELDS,			/* Number of fields */
+};
+
+/*
+ *  Write-protect tracking of a map
+ */
+#define WP_UNKNOWN		(0)	/* Not probed yet */
+#define WP_YES			(1)	/* Async uffd-wp registered */
+#define WP_NO			(2)	/* Cannot be tracked */
+
+/*
+ *  DAMON sysfs interface, pagemon only ever
+ *  sets up kdamond 0 with a single context
+ */
+#define DAMON_ADMIN		"/sys/kernel/mm/damon/admin"
+#define DAMON_KDAMOND		DAMON_ADMIN "/kdamonds/0"
+#define DAMON_CONTEXT		DAMON_KDAMOND "/contexts/0"
+#define DAMON_SCHEME		DAMON_CONTEXT "/schemes/0"
+
+#define DAMON_OFF		(0)	/* Not asked for */
+#define DAMON_ON		(1)	/* Monitoring the process */
+#define DAMON_BUSY		(2)	/* Other kdamonds in use */
+#define DAMON_NONE		(3)	/* No DAMON sysfs interface */
+#define DAMON_FAILED		(4)	/* Could not set up, or stopped */
+
+/*
+ *  Page flag bits of /proc/kpageflags, defined here
+ *  for when linux/kernel-page-flags.h is not used
+ */
+#if !defined(KPF_THP)
+#define KPF_REFERENCED		(2)
+#define KPF_DIRTY		(4)
+#define KPF_LRU			(5)
+#define KPF_ACTIVE		(6)
+#define KPF_WRITEBACK		(8)
+#define KPF_MMAP		(11)
+#define KPF_ANON		(12)
+#define KPF_SWAPCACHE		(13)
+#define KPF_HUGE		(17)
+#define KPF_UNEVICTABLE		(18)
+#define KPF_KSM			(21)
+#define KPF_THP			(22)
+#define KPF_ZERO_PAGE		(24)
+#endif
+#define KPF_MLOCKED		(33)	/* Kernel hacking flag, not in uapi */
+
+/*
+ *  Batch mode record formats
+ */
+enum {
+	BATCH_JSON = 0,			/* JSON, a record per line */
+	BATCH_CSV,			/* CSV with a header line */
+};
 
 enum {
 	WHITE_RED = 1,
@@ -110,6 +323,7 @@ enum {
 	BLACK_WHITE,
 	BLACK_BLACK,
 	BLUE_WHITE,
+	WHITE_MAGENTA,
 };
 
 /*
@@ -119,46 +333,755 @@ enum {
  */
 typedef uint64_t addr_t;		/* Addresses */
 typedef int64_t index_t;		/* Index into page tables */
-typedef uint64_t pagemap_t;		/* PTE page map bits */
-typedef uint64_t checksum_t;		/* Pagemap checksum */
 
 /*
- *  Memory map info, represents 1 or more pages
+ *  Map changes found when comparing a map against
+ *  the previous set of maps
+ */
+#define MAP_UNCHANGED		(0x00)	/* Same as previous map */
+#define MAP_ADDED		(0x01)	/* New map */
+#define MAP_RESIZED		(0x02)	/* Map end address changed */
+#define MAP_REPROT		(0x04)	/* Map attributes changed */
+
+/*
+ *  Page state pyramid node, the number of pages
+ *  in each state of the pages the node covers
+ */
+typedef struct {
+	uint32_t state[PAGE_STATE_MAX];	/* Pages in each state */
+} pyramid_node_t;
+
+/*
+ *  Counts of the kernel page flags of present pages
+ */
+typedef struct {
+	uint64_t pages;			/* Pages with flags read */
+	uint64_t thp;			/* Part of a transparent huge page */
+	uint64_t active;		/* On the active LRU */
+	uint64_t inactive;		/* On the inactive LRU */
+	uint64_t unevictable;		/* Unevictable or mlocked */
+	uint64_t ksm;			/* Merged by KSM */
+	uint64_t zero;			/* The zero page */
+	uint64_t mmap;			/* Memory mapped */
+	uint64_t anon;			/* Anonymous */
+	uint64_t dirty;			/* Dirty, not yet written back */
+	uint64_t writeback;		/* Being written back */
+} kflags_counts_t;
+
+/*
+ *  Counts of the map counts of present pages
+ */
+typedef struct {
+	uint64_t pages;			/* Pages with map counts read */
+	uint64_t uss;			/* Mapped once, unique set size */
+	uint64_t shared;		/* Mapped more than once */
+	uint64_t pss;			/* Proportional set size, PSS_SHIFT */
+} kcount_counts_t;
+
+/*
+ *  Sampled page states of a map, a 4 bit state per page
+ *  and a pyramid of state counts, the base level nodes
+ *  covering PYRAMID_BASE pages and each level above
+ *  covering twice the pages of the one below, so the
+ *  states of any range of pages can be counted from
+ *  a handful of nodes rather than from /proc. Pages
+ *  sampled in order from the start of the map are also
+ *  counted bit by bit in a pass, which becomes the map's
+ *  counts once it has covered the whole map.
+ */
+typedef struct {
+	uint8_t *pages;			/* Page states, 2 per byte */
+	pyramid_node_t *nodes;		/* Nodes of all levels */
+	size_t level[PYRAMID_LEVELS_MAX]; /* First node of each level */
+	size_t count[PYRAMID_LEVELS_MAX]; /* Nodes in each level */
+	uint32_t nlevels;		/* Number of levels */
+	page_counts_t pass;		/* Counts of the pass so far */
+	page_counts_t counts;		/* Counts of the last whole pass */
+	index_t swept;			/* Pages counted in the pass */
+	bool counted;			/* Has a pass been completed? */
+	uint32_t passes;		/* Passes completed */
+	uint32_t probe_pass;		/* Pass of the next huge page probe */
+	bool huge;			/* Did the last probe find any? */
+	uint16_t *stamps;		/* Interval each page was last written */
+	index_t written;		/* Pages written last interval */
+	uint8_t *ages;			/* Rounds each page was idle + 1 */
+	index_t cold;			/* Pages idle for the cold rounds */
+	kflags_counts_t flags;		/* Kernel page flags of last round */
+	kcount_counts_t share;		/* Map counts of last round */
+	kflags_counts_t flags_pass;	/* Kernel page flags of the round so far */
+	kcount_counts_t share_pass;	/* Map counts of the round so far */
+} map_state_t;
+
+/*
+ *  Estimated page counts of a map, from a pass of pages
+ *  drawn at random without replacement. The pages a pass
+ *  samples are sized from the last pass, or a pilot of the
+ *  first pages for the first one, so its intervals come
+ *  within the error asked for. A whole pass is kept while
+ *  the next pass is sampled.
+ */
+typedef struct {
+	uint32_t seed;			/* Permutation key of the pass */
+	uint32_t size;			/* Pages to sample, 0 if not sized */
+	uint32_t n;			/* Pages sampled by the pass */
+	uint32_t hits[EST_FIELDS];	/* Sampled pages of each field */
+	uint32_t last_n;		/* Pages sampled by the last pass */
+	uint32_t last[EST_FIELDS];	/* Sampled pages of each field */
+	uint64_t round;			/* Round the map was last sampled */
+} map_est_t;
+
+/*
+ *  Memory map info, represents 1 or more pages,
+ *  the map name is an id into the map name table
  */
 typedef struct {
 	addr_t begin;			/* Start of mapping */
 	addr_t end;			/* End of mapping */
+	index_t first;			/* Index of first page in map */
+	addr_t offset;			/* Offset into mapped file */
+	uint64_t inode;			/* Inode of mapped file */
+	map_state_t *state;		/* Sampled page states, or NULL */
+	uint32_t name_id;		/* Name of mapping */
+	uint8_t change;			/* MAP_* change flags */
+	uint8_t wp;			/* WP_* write-protect tracking */
+	bool reserved;			/* PROT_NONE with no pages, collapsed */
 	char attr[5];			/* Map attributes */
 	char dev[6];			/* Map device, if any */
-	char name[NAME_MAX + 1];	/* Name of mapping */
+	map_est_t est;			/* Estimated page counts */
 } map_t;
 
 /*
- *  Page info, 1 per page with map reference
- *  to the memory map it belongs to
+ *  Map changes between the last two reads of the maps
+ */
+typedef struct {
+	uint32_t added;			/* Maps added */
+	uint32_t removed;		/* Maps removed */
+	uint32_t resized;		/* Maps resized */
+	uint32_t reprot;		/* Maps with new attributes */
+} map_changes_t;
+
+/*
+ *  Page info, resolved from a page index by
+ *  looking up the memory map it belongs to
  */
 typedef struct {
 	addr_t addr;			/* Address */
 	map_t   *map;			/* Mapping it is in */
-	index_t index;			/* Index into map */
+	index_t index;			/* Index of page */
 } page_t;
 
+/*
+ *  Growable buffer, reused between reads
+ */
+typedef struct {
+	char *data;			/* Buffer data */
+	size_t size;			/* Allocated size */
+	size_t len;			/* Length of data */
+} buf_t;
+
+/*
+ *  String table, strings are interned once and
+ *  referred to by their offset into the table
+ */
+typedef struct {
+	char *data;			/* Strings, '\0' separated */
+	size_t len;			/* Length of used data */
+	size_t size;			/* Allocated size of data */
+	uint32_t *hash;			/* Open addressed hash of ids */
+	uint32_t nhash;			/* Size of hash, power of 2 */
+	uint32_t count;			/* Number of strings */
+} strtab_t;
+
 /*
  *  General memory mapping info, containing
- *  a fix set of memory maps, and pointer
- *  to an array of per page info.
+ *  an on demand grown array of memory maps, each
+ *  of which holds the index of its first page so
+ *  that page indexes can be resolved by searching
+ *  the maps rather than keeping per page info.
+ *  New maps are read into maps_new and diff'd
+ *  against the current maps.
  */
 typedef struct {
-	map_t maps[MAX_MAPS];		/* Mappings */
+	map_t *maps;			/* Mappings */
+	map_t *maps_new;		/* Newly read mappings */
+	uint32_t maps_size;		/* Allocated size of maps */
+	uint32_t maps_new_size;		/* Allocated size of maps_new */
 	uint32_t nmaps;			/* Number of mappings */
-	page_t *pages;			/* Pages */
 	addr_t npages;			/* Number of pages */
+	addr_t mapped;			/* Pages mapped, reserved included */
+	addr_t reserved;		/* Pages of reserved maps */
 	addr_t last_addr;		/* Last address */
+	map_changes_t changes;		/* Changes from last read */
+	uint64_t gen;			/* Bumped when maps change */
+	buf_t buf;			/* Raw /proc/$PID/maps data */
+	strtab_t names;			/* Map names */
 } mem_info_t;
 
+/*
+ *  /proc/$PID files that are kept open
+ */
+enum {
+	PROC_PAGEMAP = 0,
+	PROC_MEM,
+	PROC_MAPS,
+	PROC_STATUS,
+	PROC_STAT,
+	PROC_OOM,
+	PROC_REFS,
+	PROC_MAX
+};
+
+/*
+ *  /proc/$PID file name and open flags
+ */
+typedef struct {
+	const char *name;		/* File name in /proc/$PID */
+	int flags;			/* open() flags */
+} proc_info_t;
+
+/*
+ *  Open /proc/$PID files of the monitored process
+ */
+typedef struct {
+	pid_t pid;			/* Process the files belong to */
+	int fd[PROC_MAX];		/* File descriptors, -1 = closed */
+	buf_t buf;			/* Buffer for small files */
+} proc_t;
+
+/*
+ *  Extent of count pagemap words from start that
+ *  are to be sampled for a map
+ */
+typedef struct {
+	addr_t start;			/* First pagemap word */
+	uint32_t count;			/* Number of words */
+	map_t *map;			/* Map the words belong to */
+	page_counts_t counts;		/* Counts of the words read */
+} extent_t;
+
+/*
+ *  Called with the pagemap words of each extent read
+ */
+typedef void (*extent_func_t)(const extent_t *e, const pagemap_t *words,
+	void *arg);
+
+/*
+ *  Pagemap sampler, the pages to sample are planned as
+ *  extents, which are fetched in coalesced reads of at
+ *  most SAMPLE_READ_MAX words into buf, classified and
+ *  saved into the page state pyramids of their maps
+ */
+typedef struct {
+	extent_t *extents;		/* Extents to read */
+	size_t nextents;		/* Number of extents */
+	size_t extents_size;		/* Allocated size of extents */
+	pagemap_t *buf;			/* Pagemap words read */
+	size_t buf_words;		/* Size of buf in words */
+	uint8_t *states;		/* Page states of words read */
+	index_t visible;		/* Next visible page to sample */
+	index_t sweep;			/* Next page to sweep */
+	size_t nwords;			/* Words read this frame */
+	uint32_t syscalls;		/* Reads this frame */
+	double usecs;			/* Time sampling this frame */
+} sample_t;
+
+/*
+ *  Sweep worker, with its own pagemap file and read
+ *  buffers, range holds the chunks still to be read
+ *  by the worker, the first in the low 32 bits and
+ *  the end in the high 32 bits
+ */
+typedef struct {
+	pthread_t thread;		/* Worker thread, not worker 0 */
+	uint32_t id;			/* Worker number */
+	int fd;				/* /proc/$PID/pagemap */
+	pagemap_t *buf;			/* Pagemap words read */
+	uint8_t *states;		/* Page states of words read */
+	uint64_t range;			/* Chunks to read */
+	size_t nwords;			/* Words read this fetch */
+	uint32_t syscalls;		/* Reads this fetch */
+	sigjmp_buf env;			/* Worker fault abort jmp */
+	bool reading;			/* In pool_run(), env is set */
+} worker_t;
+
+/*
+ *  Sweep worker pool, large fetches are split into
+ *  chunks of extents that the workers read in parallel,
+ *  each worker starting on its own contiguous range of
+ *  chunks and stealing from the back of the others'
+ *  ranges when it runs out. Each chunk's counts are
+ *  kept in its extents, so they are merged in order
+ *  once all the workers are done without any locking.
+ */
+typedef struct {
+	worker_t *workers;		/* Workers, 0 is the caller */
+	uint32_t nworkers;		/* Number of workers */
+	uint32_t nthreads;		/* Workers started, including 0 */
+	index_t chunk_pages;		/* Pages in a chunk */
+	size_t *chunks;			/* First extent of each chunk */
+	size_t chunks_size;		/* Allocated size of chunks */
+	sample_t *sample;		/* Sample being fetched */
+	pthread_mutex_t lock;		/* Protects gen, busy and quit */
+	pthread_cond_t go;		/* Workers to start a fetch */
+	pthread_cond_t done;		/* Workers have finished a fetch */
+	uint64_t gen;			/* Bumped for each fetch */
+	uint32_t busy;			/* Workers still reading */
+	bool failed;			/* A worker faulted this fetch */
+	bool quit;			/* Workers to exit */
+	bool started;			/* Has the pool been started? */
+} pool_t;
+
+/*
+ *  Page view cell, summarising all the pages
+ *  in the cell's zoom bucket
+ */
+typedef struct {
+	addr_t addr;			/* Address of first page */
+	map_t *map;			/* Map, NULL if not mapped */
+	page_counts_t counts;		/* Counts of pages in cell */
+	uint8_t age;			/* Least idle rounds + 1, 0 unknown */
+} cell_t;
+
+/*
+ *  Page view frame, the cells of the page view
+ *  are counted from the map page state pyramids
+ */
+typedef struct {
+	cell_t *cells;			/* Cells */
+	size_t ncells;			/* Number of cells */
+	size_t cells_size;		/* Allocated size of cells */
+} frame_t;
+
+/*
+ *  View the UI wants sampled, posted by the
+ *  UI thread to the sampler thread
+ */
+typedef struct {
+	index_t page_index;		/* First page of the view */
+	index_t data_index;		/* Offset into page, memory view */
+	index_t cursor_index;		/* Page under the cursor */
+	int32_t xmax;			/* Width of view */
+	int32_t ymax;			/* Height of view */
+	int32_t zoom;			/* Page view zoom */
+	int32_t ticks;			/* Samples between dirty page checks */
+	uint32_t read_all;		/* Bumped to read in all pages */
+	int32_t table_top;		/* First row of maps table */
+	uint8_t table_sort;		/* TABLE_* column sorted by */
+	bool table_reverse;		/* Maps table in descending order */
+	char table_filter[TABLE_FILTER_MAX]; /* Maps table filter */
+	uint8_t view;			/* Page, memory or maps view */
+	bool tab_view;			/* Page pop-up info */
+	bool vm_view;			/* Process VM stats */
+	bool perf_view;			/* Perf statistics */
+	bool wss_view;			/* Working set size panel */
+	bool heat_view;			/* Idle and access heat colours */
+} request_t;
+
+/*
+ *  Dirty page tracking, pages are reset to clean every
+ *  ticks samples and the writes in between counted
+ */
+typedef struct {
+	uint8_t mode;			/* DIRTY_* tracking mode */
+	bool visible;			/* Only track the visible pages */
+	const char *maps;		/* Only track maps with this name */
+	struct timespec last;		/* Time of last reset */
+	uint64_t resets;		/* Number of resets */
+	uint64_t written;		/* Pages written last interval */
+	uint64_t faults;		/* Write faults caused, in total */
+	double rate;			/* Write faults a second */
+} dirty_t;
+
+/*
+ *  Present pages of a round, read from the pagemap and
+ *  sorted by PFN so that the files indexed by PFN, the
+ *  page_idle bitmap and kpageflags, are read in runs of
+ *  nearby words, each word once however many pages
+ *  share it. A round collects at most a budget of pages,
+ *  the next carrying on from where it left off.
+ */
+typedef struct {
+	uint64_t pfn;			/* Page frame number */
+	uint32_t map;			/* Index of map */
+	index_t index;			/* Page in map */
+} pfn_page_t;
+
+typedef struct {
+	pfn_page_t *pages;		/* Present pages of a round */
+	size_t npages;			/* Pages in the round */
+	size_t distinct;		/* Distinct PFNs of the pages */
+	size_t size;			/* Allocated pages */
+	index_t next;			/* Next page to collect */
+	sample_t sample;		/* Extents and buffers of a round */
+} pfns_t;
+
+/*
+ *  Idle page tracking, each round the present pages
+ *  are checked in and marked idle again in the
+ *  page_idle bitmap
+ */
+typedef struct {
+	int fd;				/* page_idle bitmap, or -1 */
+	uint32_t cold;			/* Rounds idle a page is cold after */
+	uint64_t rounds;		/* Rounds so far */
+	uint64_t *words;		/* Bitmap words of a run */
+	uint64_t pages;			/* Present pages last round */
+	double usecs;			/* Time of last round */
+} idle_t;
+
+/*
+ *  A /proc/kpage* file indexed by PFN, each round the
+ *  words of the present pages are read from it, the
+ *  kernel page flags from kpageflags and the map
+ *  counts from kpagecount, and counted for their maps
+ */
+typedef struct {
+	int fd;				/* /proc/kpage* file, or -1 */
+	uint64_t *words;		/* Words of a run */
+	uint64_t rounds;		/* Rounds so far */
+	uint32_t reads;			/* Reads last round */
+} kpage_t;
+
+/*
+ *  Sharing matrix, the distinct PFNs of the present pages
+ *  of each process are radix sorted so that the PFNs any
+ *  two processes share are counted with a merge
+ */
+typedef struct {
+	uint64_t *pfns;			/* Distinct PFNs in order */
+	size_t npfns;			/* Number of PFNs */
+	size_t size;			/* Allocated PFNs */
+	bool nomem;			/* Not all PFNs could be added */
+} share_proc_t;
+
+typedef struct {
+	uint32_t nprocs;		/* Processes, the target first */
+	pid_t pids[SHARE_PROCS_MAX];	/* Their process IDs */
+	uint64_t shared[SHARE_PROCS_MAX][SHARE_PROCS_MAX]; /* PFNs shared */
+	uint64_t rounds;		/* Rounds so far */
+} share_matrix_t;
+
+typedef struct {
+	share_matrix_t matrix;		/* PFNs each pair shares */
+	share_proc_t procs[SHARE_PROCS_MAX]; /* PFNs of each process */
+	uint64_t *tmp;			/* Radix sort buffer */
+	size_t tmp_size;		/* Allocated sort buffer */
+	sample_t sample;		/* Extents and buffers of a read */
+	buf_t maps;			/* /proc/$PID/maps of a process */
+} share_t;
+
+/*
+ *  DAMON region access monitoring, the kernel samples
+ *  the accesses of adaptively sized regions of the
+ *  process so the cost does not grow with its size.
+ *  Our kdamond has a stat scheme that does nothing
+ *  but list the regions it was tried on, with their
+ *  accesses and ages, when asked to.
+ */
+typedef struct {
+	addr_t begin;			/* Start address */
+	addr_t end;			/* End address */
+	uint32_t accesses;		/* Accesses seen in an aggregation */
+	uint32_t age;			/* Aggregations accesses held for */
+} damon_region_t;
+
+/*
+ *  Asking the kdamond for its regions waits until it next
+ *  applies the scheme, up to an aggregation interval, so
+ *  a refresh thread does it. Updates are asked for on a
+ *  tick and taken on a later tick once they are ready.
+ */
+typedef struct {
+	pthread_t thread;		/* Refresh thread */
+	pthread_mutex_t lock;		/* Protects all but thread */
+	pthread_cond_t go;		/* Refresh thread to update */
+	damon_region_t *regions;	/* Regions of the last update */
+	uint32_t nregions;		/* Number of regions */
+	uint32_t regions_size;		/* Allocated regions */
+	bool want;			/* Update asked for */
+	bool ready;			/* regions holds a new update */
+	bool failed;			/* Update failed, kdamond gone */
+	bool quit;			/* Refresh thread to exit */
+	sigjmp_buf env;			/* Refresh fault abort jmp */
+	bool scanning;			/* In damon_run(), env is set */
+} damon_refresh_t;
+
+typedef struct {
+	uint8_t state;			/* DAMON_* state */
+	bool started;			/* Is our kdamond set up? */
+	damon_refresh_t *refresh;	/* Refresh thread, if running */
+	uint32_t sample_us;		/* Sampling interval */
+	uint32_t aggr_us;		/* Aggregation interval */
+	damon_region_t *regions;	/* Regions in address order */
+	uint32_t nregions;		/* Number of regions */
+	uint32_t regions_size;		/* Allocated regions */
+	struct timespec last;		/* Time an update was last asked for */
+	uint64_t updates;		/* Updates so far */
+	uint64_t accessed;		/* Mapped pages accessed */
+	uint64_t cold;			/* Mapped pages cold */
+} damon_t;
+
+/*
+ *  Working set size, the distinct pages written over a
+ *  window of time. Written pages are stamped with the
+ *  dirty tracking interval they were last written in and
+ *  each interval counts the pages stamped with it, so a
+ *  page written again just moves between intervals and
+ *  the pages written in a window are the sum of its
+ *  intervals. Each window keeps a history of samples,
+ *  one a window length apart.
+ */
+typedef struct {
+	double time;			/* End of the interval */
+	uint64_t pages;			/* Pages last written in interval */
+} wss_interval_t;
+
+typedef struct {
+	uint32_t secs;			/* Window length in seconds */
+	uint32_t nhistory;		/* Samples in history */
+	uint32_t head;			/* Next history slot */
+	double next;			/* When the next sample is due */
+	uint64_t pages;			/* Pages written in the window */
+	uint64_t history[WSS_HISTORY];	/* Samples, oldest at head */
+} wss_window_t;
+
+typedef struct {
+	uint32_t interval;		/* Current interval */
+	uint32_t nwindows;		/* Number of windows */
+	uint64_t written;		/* Pages written last interval */
+	wss_window_t windows[WSS_WINDOWS_MAX]; /* Windows */
+	wss_interval_t intervals[WSS_INTERVALS]; /* Ring of intervals */
+} wss_t;
+
+/*
+ *  Vm line from /proc/$PID/status
+ */
+typedef struct {
+	char name[9];			/* Name, without the Vm prefix */
+	char unit[8];			/* Size units */
+	uint64_t size;			/* Size */
+} vm_stat_t;
+
+/*
+ *  Memory view row
+ */
+typedef struct {
+	addr_t addr;			/* Address of first byte */
+	bool mapped;			/* Is the row mapped? */
+} mem_row_t;
+
+/*
+ *  An estimated number of pages and the bounds
+ *  of its confidence interval
+ */
+typedef struct {
+	double pages;			/* Estimated pages */
+	double lo;			/* Lower bound */
+	double hi;			/* Upper bound */
+} est_value_t;
+
+/*
+ *  Page count estimates, each round spends a budget of
+ *  pagemap reads on the maps whose passes need them
+ */
+typedef struct {
+	double error;			/* Interval half width, of a map */
+	uint32_t reads;			/* Pagemap reads a round */
+	uint32_t seed;			/* Permutation key of this run */
+	uint32_t next;			/* Map the next round starts at */
+	uint32_t *touched;		/* Maps sampled by a round */
+	uint32_t touched_size;		/* Allocated size of touched */
+	uint64_t rounds;		/* Rounds made */
+} est_t;
+
+/*
+ *  Sampled pagemap words of a round, read in batches
+ */
+typedef struct {
+	uring_read_t reads[URING_ENTRIES];	/* Reads of the words */
+	pagemap_t words[URING_ENTRIES];	/* Words read */
+	map_t *maps[URING_ENTRIES];	/* Maps of the words */
+	size_t n;			/* Reads in the batch */
+} est_batch_t;
+
+/*
+ *  Maps table row, the values of a map's columns
+ */
+typedef struct {
+	uint32_t map;			/* Index of map */
+	int64_t value[TABLE_COLS];	/* Column values, -1 if not known */
+} table_row_t;
+
+/*
+ *  Snapshot of everything the UI needs to draw a view,
+ *  filled in by the sampler thread for a request. The
+ *  maps and their names are copies, so the UI can look
+ *  up pages without touching the sampler's maps.
+ */
+typedef struct {
+	request_t req;			/* Request sampled */
+	int rc;				/* Sampler error, OK if none */
+	map_t *maps;			/* Copy of maps, states not valid */
+	uint32_t maps_size;		/* Allocated size of maps */
+	uint32_t nmaps;			/* Number of maps */
+	addr_t npages;			/* Number of pages */
+	addr_t reserved;		/* Pages of reserved maps */
+	addr_t last_addr;		/* Last address */
+	uint64_t gen;			/* Generation of maps copied */
+	map_changes_t changes;		/* Map changes */
+	char *names;			/* Copy of map name table */
+	size_t names_size;		/* Allocated size of names */
+	frame_t frame;			/* Page view cells */
+	pagemap_t cursor_pagemap;	/* Pagemap bits of cursor page */
+	uint64_t cursor_kflags;		/* Kernel page flags of cursor page */
+	bool cursor_kflags_valid;	/* Were they read? */
+	double cursor_huge;		/* Huge page % of cursor map, or -1 */
+	int16_t *bytes;			/* Memory view bytes or MEM_BYTE_* */
+	size_t bytes_size;		/* Allocated size of bytes */
+	mem_row_t *rows;		/* Memory view rows */
+	size_t rows_size;		/* Allocated size of rows */
+	table_row_t *table;		/* Maps table rows shown */
+	uint32_t table_size;		/* Allocated size of table */
+	uint32_t ntable;		/* Number of maps table rows */
+	uint32_t table_maps;		/* Maps passing the table filter */
+	char state[13];			/* Process state */
+	vm_stat_t vm[VM_STATS_MAX];	/* Vm sizes */
+	uint32_t nvm;			/* Number of Vm sizes */
+	uint64_t minor;			/* Minor page faults */
+	uint64_t major;			/* Major page faults */
+	uint64_t score;			/* OOM score */
+	bool faults_valid;		/* Were faults read? */
+	bool score_valid;		/* Was OOM score read? */
+	page_counts_t counts;		/* Sampled pages of process */
+	double huge;			/* Huge page % of process, or -1 */
+	size_t nwords;			/* Pagemap words sampled */
+	uint32_t syscalls;		/* Pagemap reads */
+	double usecs;			/* Time sampling */
+	const char *io;			/* Read backend used */
+	const char *scan;		/* Populated page scan used */
+	dirty_t dirty;			/* Dirty page tracking */
+	wss_window_t wss[WSS_WINDOWS_MAX]; /* Working set size windows */
+	uint32_t nwss;			/* Number of windows */
+	bool idle_valid;		/* Is idle page tracking on? */
+	uint64_t idle_rounds;		/* Idle page tracking rounds */
+	uint64_t idle_pages;		/* Present pages checked */
+	uint64_t idle_cold;		/* Pages idle for the cold rounds */
+	damon_t damon;			/* DAMON stats, regions not valid */
+	bool kflags_valid;		/* Are kernel page flags read? */
+	size_t pfns;			/* Distinct PFNs last round */
+	kflags_counts_t kflags_counts;	/* Kernel page flags of process */
+	bool kcount_valid;		/* Are map counts read? */
+	kcount_counts_t kcount_counts;	/* Map counts of process */
+	share_matrix_t share;		/* Sharing matrix */
+	bool est_valid;			/* Are page counts estimated? */
+	est_value_t est[EST_FIELDS];	/* Estimated pages of process */
+	uint64_t est_sampled;		/* Pages the estimates are from */
+	index_t est_unsampled;		/* Pages of maps not sampled yet */
+#if defined(PERF_ENABLED)
+	uint64_t perf[PERF_MAX];	/* Perf counters */
+#endif
+} snapshot_t;
+
+/*
+ *  Maps table order, the maps that pass the filter
+ *  sorted by a column, with the column's value of
+ *  each as the sort key
+ */
+typedef struct {
+	int64_t key;			/* Value of the sort column */
+	uint32_t map;			/* Index of map */
+} table_entry_t;
+
+typedef struct {
+	table_entry_t *order;		/* Filtered maps in order */
+	uint32_t norder;		/* Number of filtered maps */
+	uint32_t size;			/* Allocated size of order */
+	uint64_t gen;			/* Generation of maps sorted */
+	uint8_t sort;			/* TABLE_* column sorted by */
+	bool reverse;			/* Sorted in descending order */
+	char filter[TABLE_FILTER_MAX];	/* Filter of the maps */
+	struct timespec sorted;		/* Time of last sort */
+} table_t;
+
+/*
+ *  Sampler thread, collects snapshots on its own
+ *  schedule and hands them to the UI through a
+ *  triple buffer. The sampler fills the back slot
+ *  and atomically swaps it with the latest slot,
+ *  the UI swaps the latest slot with its front slot
+ *  when a fresher one has been published, so neither
+ *  side ever waits for the other. The sampler waits
+ *  on a sampling timer and a wake up from the UI,
+ *  and only wakes the UI when a snapshot would
+ *  draw differently from the last one.
+ */
+typedef struct {
+	pthread_t thread;		/* Sampler thread */
+	pthread_mutex_t lock;		/* Protects req and quit */
+	request_t req;			/* Latest request */
+	bool quit;			/* Sampler to exit */
+	int epfd;			/* epoll fd */
+	int timerfd;			/* Sampling timer */
+	int wakefd;			/* UI posted a request or quit */
+	int notifyfd;			/* Snapshot for the UI */
+	uint64_t hash;			/* Hash of last snapshot */
+	bool running;			/* Thread started */
+	useconds_t udelay;		/* Delay between samples */
+	sigjmp_buf env;			/* Sampler abort jmp */
+	snapshot_t snaps[SNAP_SLOTS];	/* Snapshot slots */
+	uint32_t latest;		/* Latest slot, | SNAP_FRESH */
+	uint32_t back;			/* Slot being filled */
+	uint32_t front;			/* Slot being drawn */
+	bool taken;			/* Has the UI taken one yet? */
+	int32_t tick;			/* Samples since dirty page check */
+	uint32_t read_all;		/* Last read all request done */
+	uint8_t perf_ticker;		/* Samples since perf restart */
+} sampler_t;
+
+/*
+ *  UI event sources, multiplexed with epoll
+ *  along with stdin and the sampler's snapshots
+ */
+typedef struct {
+	int epfd;			/* epoll fd */
+	int sigfd;			/* Resize and termination signals */
+	int blinkfd;			/* Cursor blink timer */
+} ui_t;
+
+/*
+ *  Batch mode, a record of the process and optionally
+ *  of each of its maps is written to stdout on every
+ *  expiry of the record timer
+ */
+typedef struct {
+	int epfd;			/* epoll fd */
+	int sigfd;			/* Termination signals */
+	int timerfd;			/* Record timer */
+	uint8_t format;			/* BATCH_* record format */
+	bool started;			/* Has the first record been written? */
+	int32_t tick;			/* Records since dirty page check */
+	buf_t out;			/* Records of one interval */
+	snapshot_t snap;		/* Process state and Vm sizes */
+	vm_stat_t vm[VM_STATS_MAX];	/* Vm sizes in the CSV header */
+	uint32_t nvm;			/* Number of Vm sizes in header */
+} batch_t;
+
+/*
+ *  Maps table view, the row selected and how
+ *  the maps are sorted and filtered
+ */
+typedef struct {
+	int32_t top;			/* First row shown */
+	int32_t row;			/* Selected row */
+	uint8_t sort;			/* TABLE_* column sorted by */
+	bool reverse;			/* Sorted in descending order */
+	bool editing;			/* Filter being typed in */
+	char filter[TABLE_FILTER_MAX];	/* Name or attribute filter */
+} table_view_t;
+
 /*
  *  Cursor context, we have one each for the
- *  memory map and page contents views
+ *  memory map, page contents and maps views
  */
 typedef struct {
 	int32_t xpos;			/* Cursor x position */
@@ -177,9 +1100,8 @@ typedef struct {
 	WINDOW *mainwin;		/* curses main window */
 	sigjmp_buf env;			/* terminate abort jmp */
 	addr_t max_pages;		/* Max pages in system */
-	checksum_t checksum;		/* Pagemap check sum */
-	checksum_t prev_checksum;	/* Previous checksum */
 	uint32_t page_size;		/* Page size in bytes */
+	uint32_t huge_pages;		/* Pages in a PMD mapped huge page */
 	pid_t pid;			/* Process ID */
 	mem_info_t mem_info;		/* Mapping and page info */
 #if defined(PERF_ENABLED)
@@ -189,6 +1111,8 @@ typedef struct {
 	bool tab_view;			/* Page pop-up info */
 	bool vm_view;			/* Process VM stats */
 	bool help_view;			/* Help pop-up info */
+	bool wss_view;			/* Working set size panel */
+	bool heat_view;			/* Idle and access heat colours */
 	bool resized;			/* SIGWINCH occurred */
 	bool terminate;			/* SIGSEGV termination */
 	bool auto_zoom;			/* Automatic zoom */
@@ -196,18 +1120,44 @@ typedef struct {
 	bool perf_view;			/* Perf statistics */
 #endif
 	uint8_t view;			/* Default page or memory view */
-	uint8_t opt_flags;		/* User option flags */
-	char path_refs[PROCPATH_MAX];	/* /proc/$PID/clear_refs */
-	char path_pagemap[PROCPATH_MAX];/* /proc/$PID/pagemap */
-	char path_maps[PROCPATH_MAX];	/* /proc/$PID/maps */
-	char path_mem[PROCPATH_MAX];	/* /proc/$PID/mem */
-	char path_status[PROCPATH_MAX];	/* /proc/$PID/status */
-	char path_stat[PROCPATH_MAX];	/* /proc/$PID/stat */
-	char path_oom[PROCPATH_MAX];	/* /proc/$PID/oom_score */
+	uint16_t opt_flags;		/* User option flags */
+	proc_t proc;			/* /proc/$PID files */
+	sample_t sample;		/* Pagemap sampler */
+	pool_t pool;			/* Sweep workers */
+	uring_t uring;			/* io_uring for batched reads */
+	uint8_t scan;			/* PAGEMAP_SCAN support */
+	dirty_t dirty;			/* Dirty page tracking */
+	wss_t wss;			/* Working set size */
+	pfns_t pfns;			/* Present pages of a round */
+	idle_t idle;			/* Idle page tracking */
+	kpage_t kflags;			/* Kernel page flags */
+	kpage_t kcount;			/* Page map counts */
+	share_t share;			/* Sharing matrix */
+	damon_t damon;			/* DAMON region access monitoring */
+	table_t table;			/* Maps table order */
+	est_t est;			/* Page count estimates */
+	sampler_t sampler;		/* Sampler thread */
+	ui_t ui;			/* UI events */
+	batch_t batch;			/* Batch mode */
 } global_t;
 
 static global_t g;
 
+static const proc_info_t proc_info[PROC_MAX] = {
+	[PROC_PAGEMAP]	= { "pagemap",		O_RDONLY },
+	[PROC_MEM]	= { "mem",		O_RDONLY },
+	[PROC_MAPS]	= { "maps",		O_RDONLY },
+	[PROC_STATUS]	= { "status",		O_RDONLY },
+	[PROC_STAT]	= { "stat",		O_RDONLY },
+	[PROC_OOM]	= { "oom_score",	O_RDONLY },
+	[PROC_REFS]	= { "clear_refs",	O_WRONLY },
+};
+
+static void proc_close(void);
+static bool map_reserved(const map_t *map);
+static void pages_to_str(const int64_t pages, char *buf, const size_t buflen);
+static void *damon_thread(void *arg);
+
 /*
  *  mem_to_str()
  *	report memory in different units
@@ -258,36 +1208,301 @@ static int read_buf(
 }
 
 /*
- *  proc_name_to_pid()
- *	find a process by name, return PID of
- *	first match found. Zero indicates error
+ *  proc_fd()
+ *	get the file descriptor of a /proc/$PID file, opening
+ *	it on first use. Descriptors are kept open for the life
+ *	of the process and reopened if the process changes.
  */
-static pid_t proc_name_to_pid(char *const name)
+static int proc_fd(const int id)
 {
-	char *ptr;
-	bool isnum = true;
-	DIR *dir;
-	struct dirent *d;
-	pid_t pid = 0;
+	proc_t *proc = &g.proc;
 
-	/* Could be just a pid in numeric form */
-	for (ptr = name; *ptr; ptr++) {
-		if (!isdigit(*ptr)) {
-			isnum = false;
-			break;
-		}
+	if (proc->pid != g.pid) {
+		proc_close();
+		proc->pid = g.pid;
 	}
-	if (isnum) {
-		pid = (pid_t)strtol(name, NULL, 10);
-		if (errno || (pid < 1)) {
-			fprintf(stderr, "Invalid pid value '%s'\n", name);
-			return 0;
-		}
-		return pid;
+	if (proc->fd[id] < 0) {
+		char path[PROCPATH_MAX];
+
+		snprintf(path, sizeof(path), "/proc/%i/%s",
+			g.pid, proc_info[id].name);
+		proc->fd[id] = open(path, proc_info[id].flags);
 	}
+	return proc->fd[id];
+}
 
-	/* No, search for process name */
-	dir = opendir("/proc");
+/*
+ *  proc_init()
+ *	mark all the /proc/$PID files as closed
+ */
+static void proc_init(void)
+{
+	int i;
+
+	for (i = 0; i < PROC_MAX; i++)
+		g.proc.fd[i] = -1;
+	g.proc.pid = 0;
+}
+
+/*
+ *  proc_close()
+ *	close all the /proc/$PID files
+ */
+static void proc_close(void)
+{
+	int i;
+
+	for (i = 0; i < PROC_MAX; i++) {
+		if (g.proc.fd[i] > -1)
+			(void)close(g.proc.fd[i]);
+		g.proc.fd[i] = -1;
+	}
+	g.proc.pid = 0;
+}
+
+/*
+ *  fd_close()
+ *	close a file descriptor if it is open
+ */
+static void fd_close(int *fd)
+{
+	if (*fd >= 0) {
+		(void)close(*fd);
+		*fd = -1;
+	}
+}
+
+/*
+ *  fd_read()
+ *	read an entire file into a growable buffer
+ *	that is reused between calls, the data is
+ *	'\0' terminated
+ */
+static ssize_t fd_read(const int fd, buf_t *buf)
+{
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+
+	buf->len = 0;
+	for (;;) {
+		/* Keep room for at least a page and a terminator */
+		if (buf->size - buf->len < (size_t)g.page_size + 1) {
+			const size_t size = buf->size ?
+				buf->size * 2 : BUF_SIZE_MIN;
+			char *data = realloc(buf->data, size);
+
+			if (!data)
+				return -1;
+			buf->data = data;
+			buf->size = size;
+		}
+		ret = pread(fd, buf->data + buf->len,
+			buf->size - buf->len - 1, (off_t)buf->len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		buf->len += ret;
+	}
+	buf->data[buf->len] = '\0';
+
+	return (ssize_t)buf->len;
+}
+
+/*
+ *  proc_read()
+ *	read an entire /proc/$PID file
+ */
+static ssize_t proc_read(const int id, buf_t *buf)
+{
+	return fd_read(proc_fd(id), buf);
+}
+
+/*
+ *  strtab_hash()
+ *	FNV-1a hash of a string of a given length
+ */
+static inline uint32_t strtab_hash(const char *str, const size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)str[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ *  hash_mix()
+ *	mix a 64 bit value into a hash
+ */
+static inline uint64_t hash_mix(uint64_t h, const uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+
+	return h ^ (h >> 32);
+}
+
+/*
+ *  strtab_grow_hash()
+ *	double the size of the string table hash and
+ *	rehash all the interned strings into it
+ */
+static int strtab_grow_hash(strtab_t *st)
+{
+	const uint32_t nhash = st->nhash ? st->nhash * 2 : STRTAB_HASH_MIN;
+	uint32_t *hash, i;
+
+	hash = calloc(nhash, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	for (i = 0; i < st->nhash; i++) {
+		const uint32_t id = st->hash[i];
+		const char *str;
+		uint32_t h;
+
+		if (!id)
+			continue;
+		str = st->data + id;
+		h = strtab_hash(str, strlen(str)) & (nhash - 1);
+		while (hash[h])
+			h = (h + 1) & (nhash - 1);
+		hash[h] = id;
+	}
+	free(st->hash);
+	st->hash = hash;
+	st->nhash = nhash;
+
+	return 0;
+}
+
+/*
+ *  strtab_intern()
+ *	return the id of a string of a given length in the
+ *	string table, adding it if it is not already there.
+ *	The empty string is always id 0. Returns 0 if the
+ *	table cannot be grown.
+ */
+static uint32_t strtab_intern(strtab_t *st, const char *str, const size_t len)
+{
+	uint32_t h, id;
+
+	if (!len)
+		return 0;
+
+	/* Keep the hash at most half full */
+	if ((st->count + 1) * 2 > st->nhash) {
+		if (strtab_grow_hash(st) < 0)
+			return 0;
+	}
+
+	h = strtab_hash(str, len) & (st->nhash - 1);
+	while ((id = st->hash[h]) != 0) {
+		const char *s = st->data + id;
+
+		if (!strncmp(s, str, len) && (s[len] == '\0'))
+			return id;
+		h = (h + 1) & (st->nhash - 1);
+	}
+
+	/* Not found, so append it, id 0 is reserved for "" */
+	if (!st->data) {
+		st->data = malloc(BUF_SIZE_MIN);
+		if (!st->data)
+			return 0;
+		st->data[0] = '\0';
+		st->len = 1;
+		st->size = BUF_SIZE_MIN;
+	}
+	if (st->len + len + 1 > st->size) {
+		size_t size = st->size;
+		char *data;
+
+		while (st->len + len + 1 > size)
+			size *= 2;
+		data = realloc(st->data, size);
+		if (!data)
+			return 0;
+		st->data = data;
+		st->size = size;
+	}
+	id = (uint32_t)st->len;
+	memcpy(st->data + id, str, len);
+	st->data[id + len] = '\0';
+	st->len += len + 1;
+	st->hash[h] = id;
+	st->count++;
+
+	return id;
+}
+
+/*
+ *  parse_map()
+ *	parse one line of /proc/$PID/maps into map, returns
+ *	false if the line is malformed. The start of the
+ *	next line is returned in next.
+ */
+static bool parse_map(
+	const char *ptr,
+	const char *end,
+	map_t *map,
+	const char **next)
+{
+	maps_line_t line;
+
+	if (!maps_parse(ptr, end, &line, next))
+		return false;
+	map->begin = line.begin;
+	map->end = line.end;
+	map->offset = line.offset;
+	map->inode = line.inode;
+	memcpy(map->attr, line.attr, sizeof(map->attr));
+	memcpy(map->dev, line.dev, sizeof(map->dev));
+	map->name_id = strtab_intern(&g.mem_info.names, line.name,
+		line.name_len);
+
+	return true;
+}
+
+/*
+ *  proc_name_to_pid()
+ *	find a process by name, return PID of
+ *	first match found. Zero indicates error
+ */
+static pid_t proc_name_to_pid(char *const name)
+{
+	char *ptr;
+	bool isnum = true;
+	DIR *dir;
+	struct dirent *d;
+	pid_t pid = 0;
+
+	/* Could be just a pid in numeric form */
+	for (ptr = name; *ptr; ptr++) {
+		if (!isdigit(*ptr)) {
+			isnum = false;
+			break;
+		}
+	}
+	if (isnum) {
+		pid = (pid_t)strtol(name, NULL, 10);
+		if (errno || (pid < 1)) {
+			fprintf(stderr, "Invalid pid value '%s'\n", name);
+			return 0;
+		}
+		return pid;
+	}
+
+	/* No, search for process name */
+	dir = opendir("/proc");
 	if (!dir)
 		return pid;
 
@@ -329,13 +1544,14 @@ static int read_faults(
 	uint64_t *major_flt)
 {
 	int count = 0;
-	char buf[4096], *ptr = buf;
+	char *ptr;
 
 	*minor_flt = 0;
 	*major_flt = 0;
 
-	if (read_buf(g.path_stat, buf, sizeof(buf)) < 0)
+	if (proc_read(PROC_STAT, &g.proc.buf) < 1)
 		return -1;
+	ptr = g.proc.buf.data;
 
 	/*
 	 * Skipping over fields is less expensive
@@ -363,593 +1579,6502 @@ static int read_faults(
  */
 static int read_oom_score(uint64_t *score)
 {
-	char buf[4096];
-
 	*score = ~0ULL;
 
-	if (read_buf(g.path_oom, buf, sizeof(buf)) < 0)
+	if (proc_read(PROC_OOM, &g.proc.buf) < 1)
 		return -1;
 
-	if (sscanf(buf, "%" SCNu64, score) != 1)
+	if (sscanf(g.proc.buf.data, "%" SCNu64, score) != 1)
 		return -1;
 	return 0;
 }
 
 /*
- *  read_maps()
- *	read memory maps for a specifc process
+ *  map_size()
+ *	number of pages mapped by a map
  */
-static int read_maps(const bool force)
+static inline index_t map_size(const map_t *map)
 {
-	FILE *fp;
-	uint32_t i, j, n = 0;
-	char buffer[4096];
-	page_t *page;
-	checksum_t checksum = 0ULL;
-	map_t *map;
+	return (index_t)((map->end - map->begin) / g.page_size);
+}
 
-	g.mem_info.npages = 0;
-	g.mem_info.last_addr = 0;
+/*
+ *  map_pages()
+ *	number of pages of a map in the page index, a
+ *	reserved map is collapsed into a single page
+ */
+static inline index_t map_pages(const map_t *map)
+{
+	return map->reserved ? 1 : map_size(map);
+}
 
-	if (kill(g.pid, 0) < 0)
-		return ERR_NO_PROCESS;
-	if (force)
-		g.prev_checksum = 0;
+/*
+ *  map_name()
+ *	the name of a map, "" for anonymous maps
+ */
+static inline const char *map_name(const char *names, const map_t *map)
+{
+	return names ? names + map->name_id : "";
+}
 
-	fp = fopen(g.path_maps, "r");
-	if (fp == NULL)
-		return ERR_NO_MAP_INFO;
+/*
+ *  map_basename()
+ *	the basename of a map's name for display
+ */
+static const char *map_basename(const char *names, const map_t *map)
+{
+	const char *name = map_name(names, map), *ptr;
 
-	map = g.mem_info.maps;
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		int ret;
-		intptr_t length;
-
-		map->name[0] = '\0';
-		ret = sscanf(buffer, "%" SCNx64 "-%" SCNx64
-			" %5s %*s %6s %*d %s",
-			&map->begin,
-			&map->end,
-			map->attr,
-			map->dev,
-			map->name);
-		if ((ret != 5) && (ret != 4))
-			continue;
-		if (ret == 4)
-			map->name[0]= '\0';
+	if (*name == '\0')
+		return "[Anonymous]";
+	ptr = strrchr(name, '/');
 
-		/* Simple sanity check */
-		if (map->end < map->begin)
-			continue;
+	return (ptr && ptr[1]) ? ptr + 1 : name;
+}
 
-		length = map->end - map->begin;
-		/* Check for overflow */
-		if (g.mem_info.npages + length < g.mem_info.npages)
-			continue;
+/*
+ *  map_state_get()
+ *	get the sampled state of page index of a map
+ */
+static inline uint8_t map_state_get(const map_state_t *ms, const index_t index)
+{
+	return (ms->pages[index >> 1] >> ((index & 1) << 2)) & 0xf;
+}
 
-		if (g.mem_info.last_addr < map->end)
-			g.mem_info.last_addr = map->end;
-
-		checksum ^= map->begin;
-		checksum <<= 1;
-		checksum ^= map->end;
-		checksum <<= 1;
-		checksum ^= map->attr[0];
-		checksum <<= 1;
-		checksum ^= map->attr[1];
-		checksum <<= 1;
-		checksum ^= map->attr[2];
-		checksum <<= 1;
-		checksum ^= map->attr[3];
-		checksum <<= 1;
-		checksum ^= length;
-
-		g.mem_info.npages += length / g.page_size;
-		n++;
-		map++;
-		if (n >= MAX_MAPS)
+/*
+ *  map_state_alloc()
+ *	allocate the page states of a map if it does
+ *	not have them yet, the pages are counted as not
+ *	present until they are sampled
+ */
+static map_state_t *map_state_alloc(map_t *map)
+{
+	const index_t npages = map_pages(map);
+	map_state_t *ms;
+	size_t n, i, total = 0;
+	uint32_t l;
+
+	if (map->state)
+		return map->state;
+
+	ms = calloc(1, sizeof(*ms));
+	if (!ms)
+		return NULL;
+
+	/* Halve the nodes of each level until there is one at the top */
+	n = (size_t)((npages + PYRAMID_BASE - 1) >> PYRAMID_BASE_SHIFT);
+	for (l = 0; l < PYRAMID_LEVELS_MAX; l++) {
+		ms->level[l] = total;
+		ms->count[l] = n;
+		total += n;
+		if (n <= 1) {
+			l++;
 			break;
+		}
+		n = (n + 1) / 2;
 	}
-	fclose(fp);
-
-	checksum += g.mem_info.npages;
-	checksum += n;
-	g.checksum = checksum;
-
-	/* No change in maps, so nothing to do */
-	if (g.checksum == g.prev_checksum)
-		return OK;
-	g.prev_checksum = checksum;
-
-	/* Unlikely, but need to keep Coverity Scan happy */
-	if (g.mem_info.npages > g.max_pages)
-		return ERR_TOO_MANY_PAGES;
-	if (g.mem_info.npages == 0)
-		return ERR_TOO_FEW_PAGES;
-
-	free(g.mem_info.pages);
-	g.mem_info.nmaps = n;
-	g.mem_info.pages = calloc(g.mem_info.npages, sizeof(page_t));
-	if (!g.mem_info.pages) {
-		g.mem_info.nmaps = 0;
-		return ERR_ALLOC_NOMEM;
+	ms->nlevels = l;
+
+	ms->pages = calloc((size_t)(npages + 1) / 2, 1);
+	ms->nodes = calloc(MAXIMUM(total, 1), sizeof(*ms->nodes));
+	if (!ms->pages || !ms->nodes) {
+		free(ms->pages);
+		free(ms->nodes);
+		free(ms);
+		return NULL;
 	}
 
-	map = g.mem_info.maps;
-	page = g.mem_info.pages;
-	for (i = 0; i < g.mem_info.nmaps; i++, map++) {
-		addr_t addr = map->begin;
-		addr_t count = (map->end - map->begin) / g.page_size;
+	for (i = 0; i < ms->count[0]; i++) {
+		const index_t first = (index_t)i << PYRAMID_BASE_SHIFT;
 
-		for (j = 0; j < count; j++, page++) {
-			page->addr = addr;
-			page->map = map;
-			page->index = i;
-			addr += g.page_size;
+		ms->nodes[i].state[PAGE_STATE_NONE] =
+			(uint32_t)MINIMUM(PYRAMID_BASE, npages - first);
+	}
+	for (l = 1; l < ms->nlevels; l++) {
+		const pyramid_node_t *below = &ms->nodes[ms->level[l - 1]];
+		pyramid_node_t *nodes = &ms->nodes[ms->level[l]];
+
+		for (i = 0; i < ms->count[l]; i++) {
+			int s;
+
+			for (s = 0; s < PAGE_STATE_MAX; s++) {
+				nodes[i].state[s] = below[i * 2].state[s];
+				if (i * 2 + 1 < ms->count[l - 1])
+					nodes[i].state[s] +=
+						below[i * 2 + 1].state[s];
+			}
 		}
 	}
-	return (n == 0) ? ERR_NO_MAP_INFO : OK;
+	map->state = ms;
+
+	return ms;
 }
 
 /*
- *  handle_winch()
- *	handle SIGWINCH, flag a window resize
+ *  wss_unstamp()
+ *	take a page out of the interval it was last written
+ *	in, if that interval is still in the ring
  */
-static void handle_winch(int sig)
+static inline void wss_unstamp(wss_t *w, const uint16_t stamp)
 {
-	(void)sig;
+	const uint16_t age = (uint16_t)((uint16_t)w->interval - stamp);
+	wss_interval_t *iv = &w->intervals[stamp % WSS_INTERVALS];
 
-	g.resized = true;
+	if ((age < WSS_INTERVALS) && iv->pages)
+		iv->pages--;
 }
 
 /*
- *  handle_terminate()
- *	handle termination signals
+ *  wss_forget()
+ *	take the written pages of a map that has gone
+ *	out of the intervals they were written in
  */
-static void handle_terminate(int sig)
+static void wss_forget(wss_t *w, const uint16_t *stamps, const index_t n)
 {
-	static bool already_handled = false;
-	(void)sig;
-
-	if (already_handled) {
-		exit(EXIT_FAILURE);
-	}
-
-	g.terminate = true;
+	index_t i;
 
-	siglongjmp(g.env, 1);
+	for (i = 0; i < n; i++)
+		if (stamps[i])
+			wss_unstamp(w, stamps[i]);
 }
 
 /*
- *  show_usage()
- *	mini help info
+ *  map_state_free()
+ *	free the page states of a map
  */
-static void show_usage(void)
+static void map_state_free(map_t *map)
 {
-	printf(APP_NAME ", version " VERSION "\n\n"
-		"Usage: " APP_NAME " [options]\n"
-		" -a        enable automatic zoom mode\n"
-		" -d        delay in microseconds between refreshes, "
-			"default %u\n"
-		" -h        help\n"
-		" -p pid    process ID to monitor\n"
-		" -r        read (page back in) pages at start\n"
-		" -t ticks  ticks between dirty page checks\n"
-		" -v        enable VM view\n"
-		" -z zoom   set page zoom scale\n",
-		DEFAULT_UDELAY);
+	map_state_t *ms = map->state;
+
+	if (!ms)
+		return;
+	if (ms->stamps) {
+		wss_forget(&g.wss, ms->stamps, map_pages(map));
+		free(ms->stamps);
+	}
+	free(ms->ages);
+	free(ms->pages);
+	free(ms->nodes);
+	free(ms);
+	map->state = NULL;
 }
 
-#if defined(PERF_ENABLED)
 /*
- *  show_perf()
- *	show perf stats
+ *  map_state_update()
+ *	save the states of n sampled pages from page index
+ *	of a map, recount the base nodes they are in and
+ *	apply any change in the counts up the pyramid
  */
-static void show_perf(void)
+static void map_state_update(
+	map_t *map,
+	const index_t index,
+	const uint8_t *states,
+	const index_t n)
 {
-	int y = LINES - 6;
-	const int x = 2;
-	static uint8_t perf_ticker = 0;
+	map_state_t *ms = map->state;
+	const index_t npages = map_pages(map);
+	index_t i, b;
 
-	/* Don't hammer perf to death */
-	if (++perf_ticker > 10) {
-		perf_stop(&g.perf);
-		perf_start(&g.perf, g.pid);
-		perf_ticker = 0;
+	if (!ms || (n <= 0))
+		return;
+
+	for (i = 0; i < n; i++) {
+		const index_t k = index + i;
+		const int shift = (k & 1) << 2;
+		uint8_t *ptr = &ms->pages[k >> 1];
+
+		*ptr = (uint8_t)((*ptr & ~(0xf << shift)) | (states[i] << shift));
 	}
-	wattrset(g.mainwin, COLOR_PAIR(WHITE_CYAN) | A_BOLD);
-	mvwprintw(g.mainwin, y + 0, x,
-		" Page Faults (User Space):   %15" PRIu64 " ",
-		perf_counter(&g.perf, PERF_TP_PAGE_FAULT_USER));
-	mvwprintw(g.mainwin, y + 1, x,
-		" Page Faults (Kernel Space): %15" PRIu64 " ",
-		perf_counter(&g.perf, PERF_TP_PAGE_FAULT_KERNEL));
-	mvwprintw(g.mainwin, y + 2, x,
-		" Kernel Page Allocate:       %15" PRIu64 " ",
-		perf_counter(&g.perf, PERF_TP_MM_PAGE_ALLOC));
-	mvwprintw(g.mainwin, y + 3, x,
-		" Kernel Page Free:           %15" PRIu64 " ",
-		perf_counter(&g.perf, PERF_TP_MM_PAGE_FREE));
 
+	for (b = index >> PYRAMID_BASE_SHIFT;
+	     b <= (index + n - 1) >> PYRAMID_BASE_SHIFT; b++) {
+		const index_t end = MINIMUM((b + 1) << PYRAMID_BASE_SHIFT, npages);
+		const pyramid_node_t *base = &ms->nodes[b];
+		uint32_t counts[PAGE_STATE_MAX] = { 0 };
+		int32_t delta[PAGE_STATE_MAX];
+		bool changed = false;
+		size_t j;
+		uint32_t l;
+		int s;
+
+		for (i = b << PYRAMID_BASE_SHIFT; i < end; i++)
+			counts[map_state_get(ms, i)]++;
+		for (s = 0; s < PAGE_STATE_MAX; s++) {
+			delta[s] = (int32_t)(counts[s] - base->state[s]);
+			changed |= (delta[s] != 0);
+		}
+		if (!changed)
+			continue;
+
+		/* Nodes above the base may be shared with sweep workers */
+		for (l = 0, j = (size_t)b; l < ms->nlevels; l++, j >>= 1) {
+			pyramid_node_t *node = &ms->nodes[ms->level[l] + j];
+
+			for (s = 0; s < PAGE_STATE_MAX; s++)
+				if (delta[s])
+					(void)__atomic_add_fetch(&node->state[s],
+						(uint32_t)delta[s],
+						__ATOMIC_RELAXED);
+		}
+	}
 }
-#endif
 
 /*
- *  show_vm()
- *	show Virtual Memory stats
+ *  map_state_count()
+ *	add the states of pages lo to hi (exclusive) of a map
+ *	to counts, pages at unaligned ends are counted one by one
+ *	and the rest from the fewest pyramid nodes that cover them
  */
-static void show_vm(void)
+static void map_state_count(
+	const map_t *map,
+	index_t lo,
+	index_t hi,
+	page_counts_t *counts)
 {
-	FILE *fp;
-	char buffer[4096];
-	int y = 2;
-	const int x = COLS - 26;
-	uint64_t major, minor, score;
-
-	fp = fopen(g.path_status, "r");
-	if (fp == NULL)
+	const map_state_t *ms = map->state;
+	const index_t npages = map_pages(map);
+	const index_t mask = PYRAMID_BASE - 1;
+	size_t a, b;
+	uint32_t l;
+
+	counts->pages += hi - lo;
+	if (!ms) {
+		counts->state[PAGE_STATE_NONE] += hi - lo;
 		return;
+	}
 
-	wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		char vmname[9], size[8];
-		char state[6], longstate[13];
-		uint64_t sz;
+	while ((lo < hi) && (lo & mask))
+		counts->state[map_state_get(ms, lo++)]++;
+	/* The last node of a map may be partial, so can be used as is */
+	while ((lo < hi) && (hi & mask) && (hi < npages))
+		counts->state[map_state_get(ms, --hi)]++;
+	if (lo >= hi)
+		return;
 
-		if (sscanf(buffer, "State: %5s %12s", state, longstate) == 2) {
-			mvwprintw(g.mainwin, y++, x,
-				" State:    %-12.12s ", longstate);
-			continue;
+	a = (size_t)(lo >> PYRAMID_BASE_SHIFT);
+	b = (size_t)((hi + mask) >> PYRAMID_BASE_SHIFT);
+	for (l = 0; a < b; l++, a >>= 1, b >>= 1) {
+		const pyramid_node_t *nodes = &ms->nodes[ms->level[l]];
+		int s;
+
+		/* The top level may have more than one node for huge maps */
+		if (l == ms->nlevels - 1) {
+			for (; a < b; a++)
+				for (s = 0; s < PAGE_STATE_MAX; s++)
+					counts->state[s] += nodes[a].state[s];
+			break;
 		}
-		if (sscanf(buffer, "Vm%8s %" SCNu64 "%7s",
-		    vmname, &sz, size) == 3) {
-			mvwprintw(g.mainwin, y++, x,
-				" Vm%-6.6s %10" PRIu64 " %s ",
-				vmname, sz, size);
-			continue;
+		if (a & 1) {
+			for (s = 0; s < PAGE_STATE_MAX; s++)
+				counts->state[s] += nodes[a].state[s];
+			a++;
+		}
+		if (b & 1) {
+			b--;
+			for (s = 0; s < PAGE_STATE_MAX; s++)
+				counts->state[s] += nodes[b].state[s];
 		}
 	}
-	fclose(fp);
-
-	if (!read_faults(&minor, &major)) {
-		mvwprintw(g.mainwin, y++, x, " %-23s", "Page Faults:");
-		mvwprintw(g.mainwin, y++, x,
-			" Minor: %12" PRIu64 "    ", minor);
-		mvwprintw(g.mainwin, y++, x,
-			" Major: %12" PRIu64 "    ", major);
-	}
+}
 
-	if (!read_oom_score(&score)) {
-		mvwprintw(g.mainwin, y++, x,
-			" OOM Score: %8" PRIu64 "    ", score);
-	}
+/*
+ *  page_counts_add()
+ *	add the counts of b to a
+ */
+static void page_counts_add(page_counts_t *a, const page_counts_t *b)
+{
+	int s;
+
+	a->pages += b->pages;
+	a->present += b->present;
+	a->swapped += b->swapped;
+	a->file += b->file;
+	a->dirty += b->dirty;
+	a->exclusive += b->exclusive;
+	a->huge += b->huge;
+	for (s = 0; s < PAGE_STATE_MAX; s++)
+		a->state[s] += b->state[s];
 }
 
 /*
- *  show_page_bits()
- *	show info based on the page bit pattern
+ *  map_state_pass()
+ *	count the counts of n pages sampled from page index
+ *	of a map into the map's pass if they carry it on,
+ *	extents are split where the pass ends so they either
+ *	carry it on or do not touch it. Once the pass has
+ *	covered the whole map it becomes the map's counts.
  */
-static void show_page_bits(
-	const int fd,
+static void map_state_pass(
 	map_t *map,
-	const index_t index)
+	const index_t index,
+	const index_t n,
+	const page_counts_t *counts)
 {
-	pagemap_t pagemap_info;
-	off_t offset;
-	char buf[16];
-	const int x = 2;
+	map_state_t *ms = map->state;
+
+	if (!ms || (ms->swept != index) || (n <= 0))
+		return;
+
+	page_counts_add(&ms->pass, counts);
+	ms->swept += n;
+	if (ms->swept >= map_pages(map)) {
+		ms->counts = ms->pass;
+		ms->counted = true;
+		ms->passes++;
+		memset(&ms->pass, 0, sizeof(ms->pass));
+		ms->swept = 0;
+	}
+}
+
+/*
+ *  maps_grow()
+ *	double the size of a map array
+ */
+static int maps_grow(map_t **maps, uint32_t *size)
+{
+	const uint32_t new_size = *size ? *size * 2 : MAPS_MIN;
+	map_t *new_maps;
+
+	new_maps = realloc(*maps, new_size * sizeof(map_t));
+	if (!new_maps)
+		return -1;
+	*maps = new_maps;
+	*size = new_size;
+
+	return 0;
+}
+
+/*
+ *  map_same_object()
+ *	do two maps at the same address refer
+ *	to the same mapped object?
+ */
+static inline bool map_same_object(const map_t *m1, const map_t *m2)
+{
+	return !strcmp(m1->dev, m2->dev) && (m1->name_id == m2->name_id);
+}
+
+/*
+ *  diff_maps()
+ *	compare newly read maps against the current maps, both
+ *	sorted by address, and flag added, resized and reprotected
+ *	maps, carrying over the page states of maps that have
+ *	not been resized. Returns the index of the first new map
+ *	whose page index may differ from before, or n if none
+ *	have changed.
+ */
+static uint32_t diff_maps(
+	const map_t *maps,
+	const uint32_t nmaps,
+	map_t *maps_new,
+	const uint32_t n,
+	map_changes_t *changes)
+{
+	uint32_t i = 0, j = 0, first_change = n;
+
+	memset(changes, 0, sizeof(*changes));
+
+	while ((i < nmaps) || (j < n)) {
+		const map_t *old = &maps[i];
+		map_t *new = &maps_new[j];
+
+		if ((j >= n) || ((i < nmaps) && (old->begin < new->begin))) {
+			/* Old map no longer exists */
+			changes->removed++;
+			first_change = MINIMUM(first_change, j);
+			i++;
+			continue;
+		}
+		if ((i >= nmaps) || (old->begin > new->begin) ||
+		    !map_same_object(old, new)) {
+			/* A new map, or a different object at the same address */
+			if ((i < nmaps) && (old->begin == new->begin)) {
+				changes->removed++;
+				i++;
+			}
+			new->change = MAP_ADDED;
+			new->state = NULL;
+			new->wp = WP_UNKNOWN;
+			new->reserved = map_reserved(new);
+			memset(&new->est, 0, sizeof(new->est));
+			changes->added++;
+			first_change = MINIMUM(first_change, j);
+			j++;
+			continue;
+		}
+
+		new->change = MAP_UNCHANGED;
+		new->state = old->state;
+		new->wp = old->wp;
+		new->reserved = old->reserved;
+		new->est = old->est;
+		if (old->end != new->end) {
+			new->change |= MAP_RESIZED;
+			new->state = NULL;
+			changes->resized++;
+			/* Page indexes of following maps will shift */
+			first_change = MINIMUM(first_change, j + 1);
+		}
+		if (memcmp(old->attr, new->attr, sizeof(old->attr))) {
+			new->change |= MAP_REPROT;
+			changes->reprot++;
+		}
+		/* Pages can only appear in a resized or reprotected map */
+		if (new->change != MAP_UNCHANGED) {
+			memset(&new->est, 0, sizeof(new->est));
+			new->reserved = map_reserved(new);
+			if (new->reserved != old->reserved) {
+				new->state = NULL;
+				first_change = MINIMUM(first_change, j + 1);
+			}
+		}
+		i++;
+		j++;
+	}
+	return first_change;
+}
+
+/*
+ *  maps_free_states()
+ *	free the page states of old maps that have
+ *	not been carried over to the new maps
+ */
+static void maps_free_states(
+	map_t *old,
+	const uint32_t nold,
+	const map_t *new,
+	const uint32_t nnew)
+{
+	uint32_t i, j = 0;
+
+	for (i = 0; i < nold; i++) {
+		while ((j < nnew) && (new[j].begin < old[i].begin))
+			j++;
+		if ((j < nnew) && (new[j].state == old[i].state))
+			continue;
+		map_state_free(&old[i]);
+	}
+}
+
+/*
+ *  read_maps()
+ *	read memory maps for a specifc process, and
+ *	patch in any changes against the current maps
+ */
+static int read_maps(const bool force)
+{
+	uint32_t i, n = 0, first_change;
+	const char *ptr, *end;
+	map_t *map;
+	addr_t last_addr = 0;
+	index_t npages;
+	map_changes_t changes;
+
+	if (kill(g.pid, 0) < 0)
+		return ERR_NO_PROCESS;
+
+	if (proc_read(PROC_MAPS, &g.mem_info.buf) < 0)
+		return ERR_NO_MAP_INFO;
+
+	ptr = g.mem_info.buf.data;
+	end = ptr + g.mem_info.buf.len;
+	while (ptr < end) {
+		const char *next;
+
+		if (n >= g.mem_info.maps_new_size) {
+			if (maps_grow(&g.mem_info.maps_new,
+			    &g.mem_info.maps_new_size) < 0)
+				return ERR_ALLOC_NOMEM;
+		}
+		map = &g.mem_info.maps_new[n];
+		if (!parse_map(ptr, end, map, &next)) {
+			ptr = next;
+			continue;
+		}
+		ptr = next;
+
+		/* Simple sanity check */
+		if (map->end < map->begin)
+			continue;
+
+		if (last_addr < map->end)
+			last_addr = map->end;
+
+		n++;
+	}
+
+	first_change = diff_maps(g.mem_info.maps,
+		force ? 0 : g.mem_info.nmaps,
+		g.mem_info.maps_new, n, &changes);
+
+	/* No change in maps, so nothing to do apart from ageing changes */
+	if (!force && !changes.added && !changes.removed &&
+	    !changes.resized && !changes.reprot) {
+		if (memcmp(&g.mem_info.changes, &changes, sizeof(changes))) {
+			for (i = 0; i < g.mem_info.nmaps; i++)
+				g.mem_info.maps[i].change = MAP_UNCHANGED;
+			g.mem_info.changes = changes;
+			g.mem_info.gen++;
+		}
+		return OK;
+	}
+	g.mem_info.changes = changes;
+	g.mem_info.gen++;
+
+	/*
+	 *  Page indexes before the first change are still valid,
+	 *  only the prefix sum of pages from there on is updated
+	 */
+	map = g.mem_info.maps_new;
+	for (i = 0; i < first_change; i++)
+		map[i].first = g.mem_info.maps[i].first;
+	npages = (first_change > 0) ? map[first_change - 1].first +
+		map_pages(&map[first_change - 1]) : 0;
+	for (i = first_change; i < n; i++) {
+		const index_t length = map_pages(&map[i]);
+
+		/* Check for overflow */
+		if (npages + length < npages)
+			return ERR_TOO_MANY_PAGES;
+		map[i].first = npages;
+		npages += length;
+	}
+	g.mem_info.mapped = 0;
+	g.mem_info.reserved = 0;
+	for (i = 0; i < n; i++) {
+		g.mem_info.mapped += (addr_t)map_size(&map[i]);
+		if (map[i].reserved)
+			g.mem_info.reserved += (addr_t)map_size(&map[i]);
+	}
+
+	g.mem_info.maps_new = g.mem_info.maps;
+	g.mem_info.maps = map;
+	i = g.mem_info.maps_new_size;
+	g.mem_info.maps_new_size = g.mem_info.maps_size;
+	g.mem_info.maps_size = i;
+	maps_free_states(g.mem_info.maps_new, g.mem_info.nmaps, map, n);
+	g.mem_info.nmaps = n;
+	g.mem_info.npages = (addr_t)npages;
+	g.mem_info.last_addr = last_addr;
+
+	/* Unlikely, but need to keep Coverity Scan happy */
+	if (g.mem_info.npages > g.max_pages)
+		return ERR_TOO_MANY_PAGES;
+	if (g.mem_info.npages == 0)
+		return ERR_TOO_FEW_PAGES;
+
+	return (n == 0) ? ERR_NO_MAP_INFO : OK;
+}
+
+/*
+ *  maps_lookup()
+ *	resolve a page index into the page address and
+ *	the map it belongs to by binary searching the
+ *	first page indexes of the maps. Returns false
+ *	if the index is outside of the mapped pages.
+ */
+static bool maps_lookup(
+	const map_t *maps,
+	const uint32_t nmaps,
+	const addr_t npages,
+	const index_t index,
+	page_t *page)
+{
+	uint32_t lo = 0, hi = nmaps;
+
+	page->addr = 0;
+	page->map = NULL;
+	page->index = index;
+
+	if ((index < 0) || (index >= (index_t)npages))
+		return false;
+
+	/* Find the last map with a first page <= index */
+	while (hi - lo > 1) {
+		const uint32_t mid = lo + ((hi - lo) / 2);
+
+		if (maps[mid].first <= index)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	/* Skip over any zero sized maps sharing the same first index */
+	while ((lo < nmaps - 1) &&
+	       (index >= maps[lo].first + map_pages(&maps[lo])))
+		lo++;
+
+	page->map = (map_t *)&maps[lo];
+	page->addr = maps[lo].begin +
+		((addr_t)(index - maps[lo].first) * g.page_size);
+	return true;
+}
+
+/*
+ *  page_lookup()
+ *	resolve a page index using the sampler's maps
+ */
+static inline bool page_lookup(const index_t index, page_t *page)
+{
+	return maps_lookup(g.mem_info.maps, g.mem_info.nmaps,
+		g.mem_info.npages, index, page);
+}
+
+/*
+ *  snap_lookup()
+ *	resolve a page index using a snapshot's maps
+ */
+static inline bool snap_lookup(
+	const snapshot_t *snap,
+	const index_t index,
+	page_t *page)
+{
+	return maps_lookup(snap->maps, snap->nmaps,
+		snap->npages, index, page);
+}
+
+/*
+ *  page_advance()
+ *	move a resolved page on by n pages, this avoids
+ *	a lookup if the new page is in the same map
+ */
+static bool page_advance(page_t *page, const index_t n)
+{
+	map_t *map = page->map;
+	const index_t index = page->index + n;
+
+	if (map && (index >= map->first) &&
+	    (index < map->first + map_pages(map))) {
+		page->addr = map->begin +
+			((addr_t)(index - map->first) * g.page_size);
+		page->index = index;
+		return true;
+	}
+	return page_lookup(index, page);
+}
+
+/*
+ *  sample_alloc()
+ *	allocate the sampler read buffers
+ */
+static int sample_alloc(sample_t *s)
+{
+	if (!s->buf) {
+		/* Batched reads need room for more than one read */
+		s->buf_words = (g.uring.fd >= 0) ?
+			SAMPLE_BATCH_WORDS : SAMPLE_READ_MAX;
+		s->buf = malloc(s->buf_words * sizeof(*s->buf));
+		if (!s->buf)
+			return -1;
+	}
+	if (!s->states) {
+		s->states = malloc(SAMPLE_READ_MAX * sizeof(*s->states));
+		if (!s->states)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ *  sample_add_extent()
+ *	add count pagemap words from start of a map
+ *	to the sampler's fetch plan, splitting it at
+ *	multiples of the read or chunk size from the
+ *	start of the map and at the map's pass, so
+ *	chunks never share a pyramid base node and
+ *	no extent straddles the end of the pass
+ */
+static int sample_add_extent(
+	sample_t *s,
+	map_t *map,
+	addr_t start,
+	addr_t count)
+{
+	const addr_t first = map->begin / g.page_size;
+	const addr_t split = (addr_t)MINIMUM(SAMPLE_READ_MAX,
+		g.pool.chunk_pages);
+	const addr_t pass = first + (map->state ? map->state->swept : 0);
+
+	while (count) {
+		addr_t n = MINIMUM(count, split - ((start - first) % split));
+		extent_t *e;
+
+		if ((start < pass) && (start + n > pass))
+			n = pass - start;
+		if (s->nextents >= s->extents_size) {
+			const size_t size = s->extents_size ?
+				s->extents_size * 2 : SAMPLE_EXTENTS_MIN;
+			extent_t *extents = realloc(s->extents,
+				size * sizeof(*extents));
+
+			if (!extents)
+				return -1;
+			s->extents = extents;
+			s->extents_size = size;
+		}
+		e = &s->extents[s->nextents++];
+		e->start = start;
+		e->count = (uint32_t)n;
+		e->map = map;
+		start += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ *  sample_plan()
+ *	plan the sampling of n pages from page index, which
+ *	may span maps, allocating the page states of the maps
+ */
+static int sample_plan(sample_t *s, const index_t index, index_t n)
+{
+	page_t page;
+
+	s->nextents = 0;
+	(void)page_lookup(index, &page);
+	while (page.map && (n > 0)) {
+		const index_t k = MINIMUM(n,
+			page.map->first + map_pages(page.map) - page.index);
+
+		/* Reserved maps have no pages to read */
+		if (page.map->reserved) {
+			n -= k;
+			(void)page_advance(&page, k);
+			continue;
+		}
+		if (!map_state_alloc(page.map))
+			return ERR_ALLOC_NOMEM;
+		if (sample_add_extent(s, page.map, page.addr / g.page_size,
+		    (addr_t)k) < 0)
+			return ERR_ALLOC_NOMEM;
+		n -= k;
+		(void)page_advance(&page, k);
+	}
+	return OK;
+}
+
+/*
+ *  io_backend()
+ *	name of the backend used for batched reads
+ */
+static inline const char *io_backend(void)
+{
+	return (g.uring.fd >= 0) ? "io_uring" : "pread";
+}
+
+/*
+ *  scan_backend()
+ *	name of the way populated pages are found
+ */
+static inline const char *scan_backend(void)
+{
+	return (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) == SCAN_OK) ?
+		"PAGEMAP_SCAN" : "pagemap";
+}
+
+/*
+ *  dirty_written()
+ *	mark the pages of a write-protect tracked map that
+ *	have been written since the last reset as soft-dirty,
+ *	a written page has lost its uffd-wp bit
+ */
+static void dirty_written(pagemap_t *words, const size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		pagemap_t w = words[i] & ~PAGE_PTE_SOFT_DIRTY;
+
+		if ((w & (PAGE_PRESENT | PAGE_SWAPPED)) &&
+		    !(w & PAGE_PTE_UFFD_WP))
+			w |= PAGE_PTE_SOFT_DIRTY;
+		words[i] = w;
+	}
+}
+
+/*
+ *  dirty_name()
+ *	name of a dirty page tracking mode
+ */
+static inline const char *dirty_name(const uint8_t mode)
+{
+	static const char *const names[] = {
+		[DIRTY_NONE]	= "none",
+		[DIRTY_REFS]	= "clear_refs",
+		[DIRTY_WP]	= "PAGEMAP_SCAN",
+	};
+
+	return names[mode];
+}
+
+/*
+ *  scan_ioctl()
+ *	PAGEMAP_SCAN pagemap words start to end (exclusive) for
+ *	pages in all the categories of mask and any of anyof,
+ *	returns the number of regions found or -1 if the ioctl
+ *	failed or is not supported
+ */
+static int scan_ioctl(
+	const int fd,
+	const addr_t start,
+	const addr_t end,
+	const uint64_t mask,
+	const uint64_t anyof,
+	struct page_region *regions,
+	struct pm_scan_arg *arg,
+	uint32_t *syscalls)
+{
+	int n;
+
+	memset(arg, 0, sizeof(*arg));
+	arg->size = sizeof(*arg);
+	arg->start = start * g.page_size;
+	arg->end = end * g.page_size;
+	arg->vec = (uint64_t)(uintptr_t)regions;
+	arg->vec_len = SCAN_REGIONS_MAX;
+	arg->category_mask = mask;
+	arg->category_anyof_mask = anyof;
+	/* Regions split wherever a bit a huge page is filled in from changes */
+	arg->return_mask = PAGE_IS_PRESENT | PAGE_IS_SWAPPED | PAGE_IS_HUGE |
+		PAGE_IS_FILE | PAGE_IS_SOFT_DIRTY | PAGE_IS_WRITTEN;
+
+	(*syscalls)++;
+	n = ioctl(fd, PAGEMAP_SCAN, arg);
+	if (n < 0) {
+		/* Older kernels have no ioctls on pagemap */
+		if ((errno == ENOTTY) || (errno == EOPNOTSUPP))
+			__atomic_store_n(&g.scan, SCAN_NONE, __ATOMIC_RELAXED);
+		return -1;
+	}
+	__atomic_store_n(&g.scan, SCAN_OK, __ATOMIC_RELAXED);
+	return n;
+}
+
+/*
+ *  map_reserved()
+ *	is a map PROT_NONE address space that has never had
+ *	any pages, such as a guard or an allocator's reserve?
+ *	One PAGEMAP_SCAN finds if it has any present or swapped
+ *	pages. Without it the pagemap of the map is read until
+ *	the first populated word, at most RESERVED_READ_MAX
+ *	words with the rest taken to be empty, as a map keeps
+ *	the pages it had when it was made PROT_NONE. No pages
+ *	can appear in it until it is reprotected.
+ */
+static bool map_reserved(const map_t *map)
+{
+	struct page_region regions[SCAN_REGIONS_MAX];
+	pagemap_t words[RESERVED_READ_WORDS];
+	struct pm_scan_arg arg;
+	const addr_t first = map->begin / g.page_size;
+	const addr_t last = MINIMUM(map->end / g.page_size,
+		first + RESERVED_READ_MAX);
+	uint32_t syscalls = 0;
+	addr_t index;
+	int fd, n;
+
+	if (strncmp(map->attr, "---", 3))
+		return false;
+	if ((fd = proc_fd(PROC_PAGEMAP)) < 0)
+		return true;
+
+	if (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) != SCAN_NONE) {
+		n = scan_ioctl(fd, first, map->end / g.page_size, 0,
+			PAGE_IS_PRESENT | PAGE_IS_SWAPPED, regions, &arg,
+			&syscalls);
+		if (n >= 0)
+			return n == 0;
+		if (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) != SCAN_NONE)
+			return false;
+	}
+
+	for (index = first; index < last; index += RESERVED_READ_WORDS) {
+		const size_t len = (size_t)MINIMUM(last - index,
+			RESERVED_READ_WORDS) * sizeof(*words);
+		const ssize_t ret = pread(fd, words, len,
+			(off_t)(index * sizeof(*words)));
+		size_t i;
+
+		if (ret <= 0)
+			break;
+		for (i = 0; i < (size_t)ret / sizeof(*words); i++)
+			if (words[i] & (PAGE_PRESENT | PAGE_SWAPPED))
+				return false;
+	}
+	return true;
+}
+
+/*
+ *  huge_probe()
+ *	does a map have PMD mapped huge pages? The first read
+ *	of the map in every HUGE_PROBE_PASSES passes makes one
+ *	PAGEMAP_SCAN of the whole map for them, other reads go
+ *	by what it found, so huge pages that appear are found
+ *	a few passes later. Maps without room for an aligned
+ *	huge page are never probed.
+ */
+static bool huge_probe(const int fd, map_t *map, uint32_t *syscalls)
+{
+	struct page_region regions[SCAN_REGIONS_MAX];
+	struct pm_scan_arg arg;
+	map_state_t *ms = map->state;
+	const addr_t begin = map->begin / g.page_size;
+	const addr_t end = map->end / g.page_size;
+	const addr_t aligned = (begin + g.huge_pages - 1) &
+		~(addr_t)(g.huge_pages - 1);
+	uint32_t probe_pass;
+	bool huge;
+
+	if (!ms || (aligned + g.huge_pages > end) ||
+	    (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) == SCAN_NONE))
+		return false;
+	/* Sweep workers reading the same map probe it just once */
+	probe_pass = __atomic_load_n(&ms->probe_pass, __ATOMIC_RELAXED);
+	if (((int32_t)(ms->passes - probe_pass) < 0) ||
+	    !__atomic_compare_exchange_n(&ms->probe_pass, &probe_pass,
+	    ms->passes + HUGE_PROBE_PASSES, false,
+	    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return __atomic_load_n(&ms->huge, __ATOMIC_ACQUIRE);
+	huge = scan_ioctl(fd, begin, end, PAGE_IS_HUGE, 0, regions,
+		&arg, syscalls) > 0;
+	__atomic_store_n(&ms->huge, huge, __ATOMIC_RELEASE);
+
+	return huge;
+}
+
+/*
+ *  scan_worthwhile()
+ *	how the words pagemap words of extents lo to hi
+ *	(exclusive), coalesced into one range, should be scanned
+ *	before they are read. Too few words for a huge page are
+ *	read in one go, as are a few thousand words or those of
+ *	a map its last pass found mostly populated unless one of
+ *	the maps has huge pages, which only a scan finds. Ranges
+ *	with huge pages are always scanned so the huge pages are
+ *	not read.
+ */
+static int scan_worthwhile(
+	const int fd,
+	const extent_t *extents,
+	const size_t lo,
+	const size_t hi,
+	const addr_t words,
+	uint32_t *syscalls)
+{
+	const map_state_t *ms = extents[lo].map->state;
+	size_t i;
+
+	for (i = lo; i < hi; i++) {
+		const map_state_t *e_ms = extents[i].map->state;
+
+		if (e_ms && (e_ms->counts.huge || e_ms->pass.huge))
+			return SCAN_ALL;
+	}
+	if (words < g.huge_pages)
+		return SCAN_SKIP;
+	if ((words >= SCAN_WORDS_MIN) && (!ms || !ms->counted ||
+	    (ms->counts.present + ms->counts.swapped) * 2 <=
+	    ms->counts.pages))
+		return SCAN_ALL;
+	for (i = lo; i < hi; i++) {
+		if ((i > lo) && (extents[i].map == extents[i - 1].map))
+			continue;
+		if (huge_probe(fd, extents[i].map, syscalls))
+			return SCAN_ALL;
+	}
+	return SCAN_SKIP;
+}
+
+/*
+ *  scan_populated()
+ *	find the present and swapped pages of pagemap words
+ *	start to end (exclusive) with the PAGEMAP_SCAN ioctl
+ *	and fill in reads of just those words into buf, the
+ *	rest of buf is zeroed. Only the first word of each PMD
+ *	of a region of PMD mapped huge pages is read, the rest
+ *	are marked PAGE_HUGE_MAPPED for huge_fill() to fill in
+ *	from it and *huge is set. Returns the number of reads,
+ *	at most max_reads, or -1 if the words are better read
+ *	in one go because the ioctl is not supported, the pages
+ *	are too fragmented or most of them are populated anyway.
+ */
+static int scan_populated(
+	const int fd,
+	pagemap_t *buf,
+	const addr_t start,
+	const addr_t end,
+	const int mode,
+	uring_read_t *reads,
+	const int max_reads,
+	uint32_t *syscalls,
+	bool *huge)
+{
+	struct page_region regions[SCAN_REGIONS_MAX];
+	struct pm_scan_arg arg;
+	addr_t populated = 0;
+	int i, n, nreads = 0;
+
+	*huge = false;
+	if ((mode == SCAN_SKIP) ||
+	    (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) == SCAN_NONE))
+		return -1;
+
+	n = scan_ioctl(fd, start, end, 0, PAGE_IS_PRESENT | PAGE_IS_SWAPPED,
+		regions, &arg, syscalls);
+	/* Failed or ran out of regions before the end */
+	if ((n < 0) || (arg.walk_end < arg.end))
+		return -1;
+	for (i = 0; i < n; i++) {
+		if (regions[i].categories & PAGE_IS_HUGE)
+			*huge = true;
+		else
+			populated += (regions[i].end - regions[i].start) /
+				g.page_size;
+	}
+	if (!*huge && (populated * 2 > end - start))
+		return -1;
+
+	memset(buf, 0, (end - start) * sizeof(*buf));
+	for (i = 0; i < n; i++) {
+		const addr_t first = regions[i].start / g.page_size;
+		const addr_t last = regions[i].end / g.page_size;
+		const bool pmd = !!(regions[i].categories & PAGE_IS_HUGE);
+		addr_t j, next;
+
+		/*
+		 *  The PMDs of a region can differ in flags the scan
+		 *  does not split regions on, such as exclusive, so
+		 *  each one gets a read of its first word
+		 */
+		for (j = first; j < last; j = next) {
+			next = pmd ? MINIMUM((j + g.huge_pages) &
+				~(addr_t)(g.huge_pages - 1), last) : last;
+			if (nreads == max_reads) {
+				*huge = false;
+				return -1;
+			}
+			reads[nreads].fd = fd;
+			reads[nreads].buf = buf + (j - start);
+			reads[nreads].len = (pmd ? 1 : next - j) *
+				sizeof(pagemap_t);
+			reads[nreads].offset = (off_t)(j * sizeof(pagemap_t));
+			nreads++;
+			for (j++; pmd && (j < next); j++)
+				buf[j - start] = PAGE_HUGE_MAPPED;
+		}
+	}
+	return nreads;
+}
+
+/*
+ *  huge_fill()
+ *	fill in the words of huge pages left unread by
+ *	scan_populated() from the first word of their PMD,
+ *	which all the words of a PMD share but for the PFN,
+ *	the PFNs of a PMD following on from the first one.
+ */
+static void huge_fill(pagemap_t *words, const size_t n)
+{
+	size_t i;
+
+	for (i = 1; i < n; i++) {
+		if (words[i] != PAGE_HUGE_MAPPED)
+			continue;
+		if (words[i - 1] & PAGE_PRESENT) {
+			const pagemap_t pfn = words[i - 1] & PAGE_PFN_MASK;
+
+			words[i - 1] |= PAGE_HUGE_MAPPED;
+			words[i] = (words[i - 1] & ~PAGE_PFN_MASK) |
+				(pfn ? pfn + 1 : 0);
+		} else {
+			/* Gone before it was read */
+			words[i] = 0;
+		}
+	}
+}
+
+/*
+ *  read_batch()
+ *	make n reads, as one batch with io_uring if ring is
+ *	set up, otherwise one pread at a time. If io_uring
+ *	fails the ring is closed and pread is used from then
+ *	on. Returns the number of system calls made.
+ */
+static uint32_t read_batch(uring_t *ring, uring_read_t *reads, const size_t n)
+{
+	size_t i;
+	int ret;
+
+	if (ring && (ring->fd >= 0)) {
+		if ((ret = uring_read(ring, reads, n)) >= 0)
+			return (uint32_t)ret;
+		uring_close(ring);
+	}
+	for (i = 0; i < n; i++) {
+		uring_read_t *r = &reads[i];
+
+		r->ret = pread(r->fd, r->buf, r->len, r->offset);
+		if (r->ret < 0)
+			r->ret = -errno;
+	}
+	return (uint32_t)n;
+}
+
+/*
+ *  sample_read()
+ *	read extents lo to hi (exclusive) from pagemap fd,
+ *	coalescing neighbouring extents into one range when
+ *	the gap between them is small. Large ranges are
+ *	scanned first so only their populated words are read.
+ *	As many ranges as fit into the buf_words words of buf
+ *	are read as a batch, then the page states and counts
+ *	of their maps are updated and func, if set, is called
+ *	with the words of each extent.
+ */
+static void sample_read(
+	uring_t *ring,
+	const int fd,
+	pagemap_t *buf,
+	const size_t buf_words,
+	uint8_t *states,
+	extent_t *extents,
+	size_t lo,
+	const size_t hi,
+	size_t *nwords,
+	uint32_t *syscalls,
+	const extent_func_t func,
+	void *arg)
+{
+	while (lo < hi) {
+		uring_read_t reads[URING_ENTRIES];
+		size_t first[URING_ENTRIES + 1];
+		size_t offset[URING_ENTRIES + 1];
+		bool huge[URING_ENTRIES];
+		size_t i, j, k, nranges = 0, nreads = 0, used = 0;
+
+		for (i = lo; (i < hi) &&
+		     (nreads + SCAN_REGIONS_MAX <= URING_ENTRIES); i = j) {
+			const addr_t start = extents[i].start;
+			addr_t end = start + extents[i].count;
+			uring_read_t *r = &reads[nreads];
+			int n = -1;
+
+			for (j = i + 1; j < hi; j++) {
+				const extent_t *e = &extents[j];
+				const addr_t e_end = e->start + e->count;
+
+				if ((e->start > end + SAMPLE_GAP_MAX) ||
+				    (e_end - start > SAMPLE_READ_MAX))
+					break;
+				end = MAXIMUM(end, e_end);
+			}
+			if (used + (end - start) > buf_words)
+				break;
+			/* Room for a read of each PMD if all are huge */
+			if (nreads && (nreads + SCAN_REGIONS_MAX +
+			    (end - start) / g.huge_pages + 1 > URING_ENTRIES))
+				break;
+
+			n = scan_populated(fd, buf + used, start, end,
+				scan_worthwhile(fd, extents, i, j, end - start,
+					syscalls),
+				r, (int)(URING_ENTRIES - nreads), syscalls,
+				&huge[nranges]);
+			if (n < 0) {
+				r->fd = fd;
+				r->buf = buf + used;
+				r->len = (end - start) * sizeof(pagemap_t);
+				r->offset = (off_t)(start * sizeof(pagemap_t));
+				n = 1;
+			}
+			for (k = 0; k < (size_t)n; k++)
+				*nwords += r[k].len / sizeof(pagemap_t);
+			nreads += (size_t)n;
+			offset[nranges] = used;
+			first[nranges++] = i;
+			used += end - start;
+		}
+		first[nranges] = i;
+		offset[nranges] = used;
+		*syscalls += read_batch(ring, reads, nreads);
+
+		/* Anything we could not read is treated as not mapped */
+		for (k = 0; k < nreads; k++) {
+			const uring_read_t *r = &reads[k];
+			const size_t ret = (r->ret < 0) ? 0 : (size_t)r->ret;
+
+			if (ret < r->len)
+				memset((uint8_t *)r->buf + ret, 0, r->len - ret);
+		}
+
+		for (k = 0; k < nranges; k++) {
+			pagemap_t *words = buf + offset[k];
+			const addr_t start = extents[first[k]].start;
+
+			if (huge[k])
+				huge_fill(words, offset[k + 1] - offset[k]);
+			for (i = first[k]; i < first[k + 1]; i++) {
+				extent_t *e = &extents[i];
+
+				if (e->map->wp == WP_YES)
+					dirty_written(&words[e->start - start],
+						e->count);
+				memset(&e->counts, 0, sizeof(e->counts));
+				classify_pagemap(&words[e->start - start],
+					e->count, states, &e->counts);
+				map_state_update(e->map, (index_t)(e->start -
+					e->map->begin / g.page_size), states,
+					(index_t)e->count);
+				if (func)
+					func(e, &words[e->start - start], arg);
+			}
+		}
+		lo = first[nranges];
+	}
+}
+
+/*
+ *  sample_map()
+ *	read count pagemap words from start of a map with
+ *	sample_read(), calling func with the words of each
+ *	extent. fd need not be our pagemap, nor map one of
+ *	our maps, the page states are only updated if the
+ *	map has any. The words are planned SAMPLE_BATCH_WORDS
+ *	at a time, so a large map costs few extents.
+ */
+static int sample_map(
+	sample_t *s,
+	const int fd,
+	map_t *map,
+	addr_t start,
+	addr_t count,
+	const extent_func_t func,
+	void *arg)
+{
+	if (sample_alloc(s) < 0)
+		return -1;
+	while (count) {
+		const addr_t n = MINIMUM(count, SAMPLE_BATCH_WORDS);
+
+		s->nextents = 0;
+		if (sample_add_extent(s, map, start, n) < 0)
+			return -1;
+		sample_read(&g.uring, fd, s->buf, s->buf_words, s->states,
+			s->extents, 0, s->nextents, &s->nwords,
+			&s->syscalls, func, arg);
+		s->nextents = 0;
+		start += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ *  pool_init()
+ *	set the sweep pool defaults, a worker
+ *	per online CPU up to SWEEP_WORKERS_DEFAULT
+ */
+static void pool_init(pool_t *pool)
+{
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	pool->nworkers = (uint32_t)MINIMUM(MAXIMUM(cpus, 1),
+		SWEEP_WORKERS_DEFAULT);
+	pool->chunk_pages = SWEEP_CHUNK_DEFAULT;
+}
+
+/*
+ *  pool_take()
+ *	take a chunk from a worker's range of chunks, the
+ *	owner takes from the front and thieves from the back
+ */
+static bool pool_take(worker_t *w, const bool steal, uint32_t *chunk)
+{
+	uint64_t range = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+	for (;;) {
+		uint32_t lo = (uint32_t)range, hi = (uint32_t)(range >> 32);
+
+		if (lo >= hi)
+			return false;
+		if (steal)
+			*chunk = --hi;
+		else
+			*chunk = lo++;
+		if (__atomic_compare_exchange_n(&w->range, &range,
+		    ((uint64_t)hi << 32) | lo, false,
+		    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return true;
+	}
+}
+
+/*
+ *  pool_work()
+ *	read the chunks of a worker's range, then
+ *	steal chunks from the other workers until
+ *	there are none left
+ */
+static void pool_work(pool_t *pool, worker_t *w)
+{
+	extent_t *extents = pool->sample->extents;
+
+	for (;;) {
+		uint32_t chunk, i;
+
+		if (!pool_take(w, false, &chunk)) {
+			for (i = 1; i < pool->nworkers; i++) {
+				worker_t *victim = &pool->workers[(w->id + i) %
+					pool->nworkers];
+
+				if (pool_take(victim, true, &chunk))
+					break;
+			}
+			if (i >= pool->nworkers)
+				return;
+		}
+		sample_read(NULL, w->fd, w->buf, SAMPLE_READ_MAX, w->states,
+			extents, pool->chunks[chunk], pool->chunks[chunk + 1],
+			&w->nwords, &w->syscalls, NULL, NULL);
+	}
+}
+
+/*
+ *  pool_run()
+ *	pool_work() for a worker thread, a fault while
+ *	reading fails the fetch and the other workers
+ *	steal the chunks left in the worker's range
+ */
+static void pool_run(pool_t *pool, worker_t *w)
+{
+	if (sigsetjmp(w->env, 1)) {
+		__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+	} else {
+		w->reading = true;
+		pool_work(pool, w);
+	}
+	w->reading = false;
+}
+
+/*
+ *  pool_thread()
+ *	sweep worker, works on each fetch it is woken for
+ */
+static void *pool_thread(void *arg)
+{
+	worker_t *w = (worker_t *)arg;
+	pool_t *pool = &g.pool;
+	uint64_t gen = 0;
+
+	for (;;) {
+		(void)pthread_mutex_lock(&pool->lock);
+		while (!pool->quit && (pool->gen == gen))
+			(void)pthread_cond_wait(&pool->go, &pool->lock);
+		gen = pool->gen;
+		if (pool->quit) {
+			(void)pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		(void)pthread_mutex_unlock(&pool->lock);
+
+		pool_run(pool, w);
+
+		(void)pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			(void)pthread_cond_signal(&pool->done);
+		(void)pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/*
+ *  pool_start()
+ *	open the workers' pagemap files and start
+ *	their threads, the caller of pool_fetch()
+ *	is worker 0. Fewer workers are used if not
+ *	all of them can be started.
+ */
+static int pool_start(pool_t *pool)
+{
+	char path[PROCPATH_MAX];
+	uint32_t i;
+
+	pool->workers = calloc(pool->nworkers, sizeof(*pool->workers));
+	if (!pool->workers)
+		return ERR_ALLOC_NOMEM;
+	(void)pthread_mutex_init(&pool->lock, NULL);
+	(void)pthread_cond_init(&pool->go, NULL);
+	(void)pthread_cond_init(&pool->done, NULL);
+	pool->started = true;
+
+	snprintf(path, sizeof(path), "/proc/%i/pagemap", g.pid);
+	for (i = 0; i < pool->nworkers; i++) {
+		worker_t *w = &pool->workers[i];
+
+		w->id = i;
+		w->fd = open(path, O_RDONLY | O_CLOEXEC);
+		w->buf = malloc(SAMPLE_READ_MAX * sizeof(*w->buf));
+		w->states = malloc(SAMPLE_READ_MAX * sizeof(*w->states));
+		if ((w->fd < 0) || !w->buf || !w->states ||
+		    (i && pthread_create(&w->thread, NULL, pool_thread, w))) {
+			fd_close(&w->fd);
+			free(w->buf);
+			free(w->states);
+			break;
+		}
+		pool->nthreads = i + 1;
+	}
+	if (!pool->nthreads)
+		return ERR_NO_MAP_INFO;
+	pool->nworkers = pool->nthreads;
+
+	return OK;
+}
+
+/*
+ *  pool_fetch()
+ *	read the sampler's extents with the pool, the
+ *	extents are grouped into chunks of about chunk
+ *	pages each, that are dealt out to the workers in
+ *	contiguous ranges so each worker reads ahead
+ *	through its own part of the address space
+ */
+static int pool_fetch(pool_t *pool, sample_t *s)
+{
+	const index_t mask = PYRAMID_BASE - 1;
+	size_t i, nchunks = 0, words = 0;
+	uint32_t w;
+
+	if ((s->nextents + 1) > pool->chunks_size) {
+		size_t *chunks = realloc(pool->chunks,
+			(s->nextents + 1) * sizeof(*chunks));
+
+		if (!chunks)
+			return ERR_ALLOC_NOMEM;
+		pool->chunks = chunks;
+		pool->chunks_size = s->nextents + 1;
+	}
+
+	/* Chunks only start on a new map or a new base node */
+	for (i = 0; i < s->nextents; i++) {
+		const extent_t *e = &s->extents[i];
+
+		if (!i || ((words >= (size_t)pool->chunk_pages) &&
+		    ((e->map != e[-1].map) ||
+		     !((e->start - e->map->begin / g.page_size) & mask)))) {
+			pool->chunks[nchunks++] = i;
+			words = 0;
+		}
+		words += e->count;
+	}
+	pool->chunks[nchunks] = s->nextents;
+
+	(void)pthread_mutex_lock(&pool->lock);
+	pool->sample = s;
+	for (w = 0; w < pool->nworkers; w++) {
+		worker_t *worker = &pool->workers[w];
+		const uint64_t lo = (nchunks * w) / pool->nworkers;
+		const uint64_t hi = (nchunks * (w + 1)) / pool->nworkers;
+
+		worker->range = (hi << 32) | lo;
+		worker->nwords = 0;
+		worker->syscalls = 0;
+	}
+	pool->busy = pool->nworkers - 1;
+	pool->failed = false;
+	pool->gen++;
+	(void)pthread_cond_broadcast(&pool->go);
+	(void)pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, &pool->workers[0]);
+
+	(void)pthread_mutex_lock(&pool->lock);
+	while (pool->busy)
+		(void)pthread_cond_wait(&pool->done, &pool->lock);
+	(void)pthread_mutex_unlock(&pool->lock);
+
+	for (w = 0; w < pool->nworkers; w++) {
+		s->nwords += pool->workers[w].nwords;
+		s->syscalls += pool->workers[w].syscalls;
+	}
+	return pool->failed ? ERR_FAULT : OK;
+}
+
+/*
+ *  pool_stop()
+ *	stop the sweep workers and free the pool
+ */
+static void pool_stop(pool_t *pool)
+{
+	uint32_t i;
+
+	if (!pool->started)
+		return;
+
+	(void)pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	(void)pthread_cond_broadcast(&pool->go);
+	(void)pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nworkers; i++) {
+		worker_t *w = &pool->workers[i];
+
+		if (i)
+			(void)pthread_join(w->thread, NULL);
+		fd_close(&w->fd);
+		free(w->buf);
+		free(w->states);
+	}
+	free(pool->workers);
+	free(pool->chunks);
+	pool->workers = NULL;
+	pool->chunks = NULL;
+	pool->chunks_size = 0;
+	pool->started = false;
+}
+
+/*
+ *  sample_fetch()
+ *	read the sampler's extents from pagemap, with the
+ *	sweep pool when there is more than a chunk to read,
+ *	and count them into the passes of their maps in order
+ */
+static int sample_fetch(sample_t *s)
+{
+	pool_t *pool = &g.pool;
+	struct timespec t1, t2;
+	size_t i, words = 0;
+	int rc;
+
+	if (sample_alloc(s) < 0)
+		return ERR_ALLOC_NOMEM;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < s->nextents; i++)
+		words += s->extents[i].count;
+
+	if ((pool->nworkers > 1) && (words > (size_t)pool->chunk_pages)) {
+		if (!pool->started && ((rc = pool_start(pool)) < 0))
+			return rc;
+		if ((rc = pool_fetch(pool, s)) < 0)
+			return rc;
+	} else {
+		const int fd = proc_fd(PROC_PAGEMAP);
+
+		if (fd < 0)
+			return ERR_NO_MAP_INFO;
+		sample_read(&g.uring, fd, s->buf, s->buf_words, s->states,
+			s->extents, 0, s->nextents, &s->nwords, &s->syscalls,
+			NULL, NULL);
+	}
+
+	for (i = 0; i < s->nextents; i++) {
+		const extent_t *e = &s->extents[i];
+
+		map_state_pass(e->map, (index_t)(e->start -
+			e->map->begin / g.page_size), (index_t)e->count,
+			&e->counts);
+	}
+	s->nextents = 0;
+	(void)clock_gettime(CLOCK_MONOTONIC, &t2);
+	s->usecs += ((t2.tv_sec - t1.tv_sec) * 1000000.0) +
+		((t2.tv_nsec - t1.tv_nsec) / 1000.0);
+
+	return OK;
+}
+
+/*
+ *  sample_pages()
+ *	sample the pagemap of n pages from page index
+ */
+static int sample_pages(sample_t *s, const index_t index, const index_t n)
+{
+	int rc;
+
+	if ((rc = sample_plan(s, index, n)) < 0)
+		return rc;
+	return sample_fetch(s);
+}
+
+/*
+ *  sample_frame()
+ *	sample the visible pages of the page view, at most
+ *	SAMPLE_VISIBLE_MAX of them a frame when zoomed far out,
+ *	and sweep on through the rest of the process so that
+ *	whole process and zoomed out counts stay fresh
+ */
+static int sample_frame(
+	sample_t *s,
+	const index_t page_index,
+	const index_t visible)
+{
+	const index_t npages = (index_t)g.mem_info.npages;
+	const index_t end = MINIMUM(page_index + visible, npages);
+	index_t n;
+	int rc;
+
+	s->syscalls = 0;
+	s->nwords = 0;
+	s->usecs = 0.0;
+
+	if (end - page_index <= SAMPLE_VISIBLE_MAX) {
+		s->visible = page_index;
+		n = end - page_index;
+	} else {
+		if ((s->visible < page_index) || (s->visible >= end))
+			s->visible = page_index;
+		n = MINIMUM(SAMPLE_VISIBLE_MAX, end - s->visible);
+	}
+	if ((rc = sample_pages(s, s->visible, n)) < 0)
+		return rc;
+	s->visible += n;
+
+	if ((s->sweep < 0) || (s->sweep >= npages))
+		s->sweep = 0;
+	n = MINIMUM(SAMPLE_SWEEP_MAX, npages - s->sweep);
+	if ((rc = sample_pages(s, s->sweep, n)) < 0)
+		return rc;
+	s->sweep += n;
+
+	return OK;
+}
+
+/*
+ *  sample_sweep()
+ *	sweep at most budget pages, finishing the passes of
+ *	maps that have not been counted yet first and then
+ *	carrying on round the process from where the last
+ *	sweep left off, so every map is counted whole and
+ *	no sweep costs more than the budget
+ */
+static int sample_sweep(sample_t *s, index_t budget)
+{
+	const index_t npages = (index_t)g.mem_info.npages;
+	index_t n, swept = 0;
+	uint32_t i;
+	int rc;
+
+	s->syscalls = 0;
+	s->nwords = 0;
+	s->usecs = 0.0;
+
+	for (i = 0; (i < g.mem_info.nmaps) && (budget > 0); i++) {
+		const map_t *map = &g.mem_info.maps[i];
+		const map_state_t *ms = map->state;
+		const index_t first = ms ? ms->swept : 0;
+
+		if (map->reserved || (ms && ms->counted))
+			continue;
+		n = MINIMUM(budget, map_pages(map) - first);
+		if ((rc = sample_pages(s, map->first + first, n)) < 0)
+			return rc;
+		budget -= n;
+	}
+
+	while ((budget > 0) && (swept < npages)) {
+		if ((s->sweep < 0) || (s->sweep >= npages))
+			s->sweep = 0;
+		n = MINIMUM(budget, npages - s->sweep);
+		if ((rc = sample_pages(s, s->sweep, n)) < 0)
+			return rc;
+		s->sweep += n;
+		budget -= n;
+		swept += n;
+	}
+	return OK;
+}
+
+/*
+ *  sample_free()
+ *	free sampler buffers
+ */
+static void sample_free(sample_t *s)
+{
+	free(s->extents);
+	free(s->buf);
+	free(s->states);
+	memset(s, 0, sizeof(*s));
+}
+
+/*
+ *  mem_counts()
+ *	count the sampled states of all the pages
+ *	of the process from the map pyramids
+ */
+static void mem_counts(page_counts_t *counts)
+{
+	uint32_t i;
+
+	memset(counts, 0, sizeof(*counts));
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_t *map = &g.mem_info.maps[i];
+
+		map_state_count(map, 0, map_pages(map), counts);
+	}
+}
+
+/*
+ *  huge_init()
+ *	find the pages in a PMD mapped huge page, if there is no
+ *	transparent huge page support to say then a PMD maps a
+ *	page of page table entries
+ */
+static void huge_init(void)
+{
+	char buf[32];
+	uint64_t size;
+
+	g.huge_pages = g.page_size / sizeof(pagemap_t);
+	if ((read_buf("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+	    buf, sizeof(buf)) == 0) &&
+	    (sscanf(buf, "%" SCNu64, &size) == 1) &&
+	    (size >= g.page_size) && (size / g.page_size <= UINT32_MAX))
+		g.huge_pages = (uint32_t)(size / g.page_size);
+}
+
+/*
+ *  mem_passes()
+ *	add up the counts of the last whole pass of
+ *	each map, returns the pages of maps not yet
+ *	counted by a whole pass
+ */
+static index_t mem_passes(page_counts_t *counts)
+{
+	index_t unsampled = 0;
+	uint32_t i;
+
+	memset(counts, 0, sizeof(*counts));
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_t *map = &g.mem_info.maps[i];
+
+		if (map->state && map->state->counted)
+			page_counts_add(counts, &map->state->counts);
+		else if (!map->reserved)
+			unsampled += map_pages(map);
+	}
+	return unsampled;
+}
+
+/*
+ *  huge_coverage()
+ *	percentage of the present pages of counts that are PMD
+ *	mapped huge pages, as found by PAGEMAP_SCAN in sweeps, or
+ *	without PAGEMAP_SCAN of the pages with kernel page flags
+ *	read that are part of a transparent huge page, -1 if
+ *	neither is known
+ */
+static double huge_coverage(const page_counts_t *c, const kflags_counts_t *f)
+{
+	if ((__atomic_load_n(&g.scan, __ATOMIC_RELAXED) == SCAN_OK) &&
+	    c->present)
+		return 100.0 * (double)c->huge / (double)c->present;
+	if (f->pages)
+		return 100.0 * (double)f->thp / (double)f->pages;
+	return -1.0;
+}
+
+/*
+ *  est_init()
+ *	page counts are not estimated until asked for, the
+ *	permutations of the pages differ from run to run
+ */
+static void est_init(est_t *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->error = EST_ERROR_DEFAULT / 100.0;
+	e->reads = EST_READS_DEFAULT;
+	e->seed = (uint32_t)hash_mix((uint64_t)time(NULL), (uint64_t)getpid());
+}
+
+/*
+ *  est_options()
+ *	parse the error percent and optional reads
+ *	a round of page count estimates
+ */
+static int est_options(est_t *e, const char *str)
+{
+	char *end;
+	const double error = strtod(str, &end);
+	unsigned long reads = EST_READS_DEFAULT;
+
+	if ((end == str) || ((*end != '\0') && (*end != ',')) ||
+	    (error < EST_ERROR_MIN) || (error > EST_ERROR_MAX))
+		return -1;
+	if (*end == ',') {
+		str = end + 1;
+		reads = strtoul(str, &end, 10);
+		if ((end == str) || *end || !reads || (reads > EST_READS_MAX))
+			return -1;
+	}
+	e->error = error / 100.0;
+	e->reads = (uint32_t)reads;
+	return 0;
+}
+
+/*
+ *  est_free()
+ *	free the maps sampled by a round
+ */
+static void est_free(est_t *e)
+{
+	free(e->touched);
+	e->touched = NULL;
+	e->touched_size = 0;
+}
+
+/*
+ *  est_permute()
+ *	the page of a map sampled ith by its pass, the pages
+ *	of a pass are a pseudo random permutation of the pages
+ *	of the map from a four round Feistel network, cycle
+ *	walked until it lands in the map
+ */
+static index_t est_permute(const map_t *map, const index_t i)
+{
+	const uint64_t npages = (uint64_t)map_size(map);
+	const uint64_t key = hash_mix(hash_mix(g.est.seed, map->begin),
+		map->est.seed);
+	uint64_t x = (uint64_t)i, mask;
+	uint32_t bits = 2, half, r;
+
+	while ((1ULL << bits) < npages)
+		bits += 2;
+	half = bits / 2;
+	mask = (1ULL << half) - 1;
+	do {
+		uint64_t hi = x >> half, lo = x & mask;
+
+		for (r = 0; r < 4; r++) {
+			const uint64_t t = hi ^ (hash_mix(key + r, lo) & mask);
+
+			hi = lo;
+			lo = t;
+		}
+		x = (hi << half) | lo;
+	} while (x >= npages);
+
+	return (index_t)x;
+}
+
+/*
+ *  est_bounds()
+ *	estimate the pages of a field of a map of npages pages
+ *	from the hits of n pages sampled without replacement,
+ *	bounded by the Wilson score interval. The sample is
+ *	scaled up by the finite population correction, so a
+ *	census of the map has no error.
+ */
+static void est_bounds(
+	const uint32_t hits,
+	const uint32_t n,
+	const index_t npages,
+	est_value_t *v)
+{
+	const double z2 = EST_Z * EST_Z;
+	const double p = (double)hits / (double)n;
+	double ne, c, h;
+
+	v->pages = p * (double)npages;
+	if ((index_t)n >= npages) {
+		v->lo = v->pages;
+		v->hi = v->pages;
+		return;
+	}
+	ne = (double)n * (double)(npages - 1) / (double)(npages - n);
+	c = (p + z2 / (2.0 * ne)) / (1.0 + z2 / ne);
+	h = EST_Z / (1.0 + z2 / ne) *
+		sqrt((p * (1.0 - p) / ne) + (z2 / (4.0 * ne * ne)));
+	v->lo = MAXIMUM(c - h, 0.0) * (double)npages;
+	v->hi = MINIMUM(c + h, 1.0) * (double)npages;
+}
+
+/*
+ *  est_fields()
+ *	estimate the fields of a map from a pass, returns the
+ *	widest half width of their intervals as a fraction
+ *	of the map
+ */
+static double est_fields(
+	const uint32_t *hits,
+	const uint32_t n,
+	const index_t npages,
+	est_value_t *v)
+{
+	double width = 0.0;
+	int f;
+
+	for (f = 0; f < EST_FIELDS; f++) {
+		est_bounds(hits[f], n, npages, &v[f]);
+		width = MAXIMUM(width, (v[f].hi - v[f].lo) / 2.0);
+	}
+	return width / (double)npages;
+}
+
+/*
+ *  est_map()
+ *	estimate the fields of a map from its last whole pass,
+ *	or from the pass so far if there is none yet. Returns
+ *	the widest half width of their intervals as a fraction
+ *	of the map, or -1 if none of the map has been sampled.
+ *	Reserved maps are known to have no pages.
+ */
+static double est_map(const map_t *map, est_value_t *v, uint32_t *sampled)
+{
+	const map_est_t *e = &map->est;
+	const uint32_t n = e->last_n ? e->last_n : e->n;
+
+	*sampled = n;
+	if (map->reserved) {
+		memset(v, 0, sizeof(*v) * EST_FIELDS);
+		return 0.0;
+	}
+	if (!n)
+		return -1.0;
+	return est_fields(e->last_n ? e->last : e->hits, n,
+		map_size(map), v);
+}
+
+/*
+ *  est_counts()
+ *	page counts from estimated fields, the exclusively
+ *	mapped pages are the present pages not shared
+ */
+static void est_counts(const est_value_t *v, page_counts_t *counts)
+{
+	memset(counts, 0, sizeof(*counts));
+	counts->present = (uint64_t)(v[EST_PRESENT].pages + 0.5);
+	counts->swapped = (uint64_t)(v[EST_SWAPPED].pages + 0.5);
+	counts->dirty = (uint64_t)(v[EST_DIRTY].pages + 0.5);
+	counts->file = (uint64_t)(v[EST_FILE].pages + 0.5);
+	counts->exclusive = counts->present -
+		MINIMUM((uint64_t)(v[EST_SHARED].pages + 0.5), counts->present);
+}
+
+/*
+ *  est_total()
+ *	estimate the fields of the whole process, the maps are
+ *	the strata of a stratified sample, so the estimates add
+ *	up and so do the squares of their half widths. Returns
+ *	the pages of the maps not sampled yet.
+ */
+static index_t est_total(est_value_t *v, uint64_t *sampled)
+{
+	double var[EST_FIELDS];
+	index_t unsampled = 0;
+	uint32_t i;
+	int f;
+
+	memset(v, 0, sizeof(*v) * EST_FIELDS);
+	memset(var, 0, sizeof(var));
+	*sampled = 0;
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_t *map = &g.mem_info.maps[i];
+		est_value_t mv[EST_FIELDS];
+		uint32_t n;
+
+		if (est_map(map, mv, &n) < 0.0) {
+			unsampled += map_size(map);
+			continue;
+		}
+		*sampled += n;
+		for (f = 0; f < EST_FIELDS; f++) {
+			const double h = (mv[f].hi - mv[f].lo) / 2.0;
+
+			v[f].pages += mv[f].pages;
+			var[f] += h * h;
+		}
+	}
+	for (f = 0; f < EST_FIELDS; f++) {
+		const double h = sqrt(var[f]);
+
+		v[f].lo = MAXIMUM(v[f].pages - h, 0.0);
+		v[f].hi = v[f].pages + h;
+	}
+	return unsampled;
+}
+
+/*
+ *  est_size()
+ *	pages a map's pass samples for its intervals to be
+ *	within the error, from the proportions of the last pass,
+ *	or of the pilot pages of the first pass. Sizing the pass
+ *	before sampling the rest of it keeps a run of unlikely
+ *	pages from ending it early. Fewer are needed of small
+ *	maps.
+ */
+static uint32_t est_size(const map_t *map)
+{
+	const map_est_t *e = &map->est;
+	const double npages = (double)map_size(map);
+	const double z2 = EST_Z * EST_Z;
+	const uint32_t n = e->last_n ? e->last_n : e->n;
+	const uint32_t *hits = e->last_n ? e->last : e->hits;
+	double n0 = EST_SAMPLES_MIN;
+	int f;
+
+	for (f = 0; f < EST_FIELDS; f++) {
+		const double p = ((double)hits[f] + z2 / 2.0) /
+			((double)n + z2);
+
+		n0 = MAXIMUM(n0, z2 * p * (1.0 - p) /
+			(g.est.error * g.est.error));
+	}
+	n0 = MINIMUM(n0 * npages / (n0 + npages - 1.0) + 1.0, npages);
+	return (uint32_t)n0;
+}
+
+/*
+ *  est_add()
+ *	add a sampled pagemap word to the pass of a map
+ */
+static void est_add(map_t *map, pagemap_t w)
+{
+	uint32_t *hits = map->est.hits;
+
+	if (map->wp == WP_YES)
+		dirty_written(&w, 1);
+	hits[EST_PRESENT] += !!(w & PAGE_PRESENT);
+	hits[EST_SWAPPED] += !!(w & PAGE_SWAPPED);
+	hits[EST_DIRTY] += !!(w & PAGE_PTE_SOFT_DIRTY);
+	hits[EST_FILE] += !!(w & PAGE_FILE_SHARED_ANON);
+	hits[EST_SHARED] += (w & PAGE_PRESENT) &&
+		!(w & PAGE_EXCLUSIVE_MAPPED);
+}
+
+/*
+ *  est_words()
+ *	add the pagemap words of an extent to the pass of
+ *	their map
+ */
+static void est_words(const extent_t *e, const pagemap_t *words, void *arg)
+{
+	uint32_t i;
+
+	(void)arg;
+	for (i = 0; i < e->count; i++)
+		est_add(e->map, words[i]);
+}
+
+/*
+ *  est_whole()
+ *	read all the pagemap words of a map into its pass
+ */
+static void est_whole(sample_t *s, const int fd, map_t *map)
+{
+	const index_t npages = map_size(map);
+
+	memset(map->est.hits, 0, sizeof(map->est.hits));
+	map->est.n = (sample_map(s, fd, map, map->begin / g.page_size,
+		(addr_t)npages, est_words, NULL) < 0) ? 0 : (uint32_t)npages;
+}
+
+/*
+ *  est_flush()
+ *	read the sampled pagemap words and add them
+ *	to the passes of their maps
+ */
+static void est_flush(sample_t *s, est_batch_t *b)
+{
+	size_t i;
+
+	if (!b->n)
+		return;
+	s->syscalls += read_batch(&g.uring, b->reads, b->n);
+	s->nwords += b->n;
+	for (i = 0; i < b->n; i++)
+		est_add(b->maps[i],
+			(b->reads[i].ret == (ssize_t)sizeof(pagemap_t)) ?
+			b->words[i] : 0);
+	b->n = 0;
+}
+
+/*
+ *  est_visit()
+ *	sample the next pages of a map's pass, only the pilot
+ *	pages until the pass is sized. Maps that cost no more
+ *	to read whole are read whole, which leaves no error.
+ *	Returns the pagemap reads spent.
+ */
+static index_t est_visit(
+	sample_t *s,
+	est_batch_t *b,
+	const int fd,
+	map_t *map,
+	const index_t budget)
+{
+	map_est_t *est = &map->est;
+	const index_t npages = map_size(map);
+	const addr_t first = map->begin / g.page_size;
+	const index_t cost = (npages + EST_READ_WORDS - 1) / EST_READ_WORDS;
+	index_t need, n, j;
+
+	if (!est->size && (est->last_n || (est->n >= EST_SAMPLES_MIN)))
+		est->size = est_size(map);
+	need = est->size ? (index_t)est->size :
+		MINIMUM(EST_SAMPLES_MIN, npages);
+	if ((cost <= need) && (cost <= budget)) {
+		est_whole(s, fd, map);
+		return cost;
+	}
+	if (need <= (index_t)est->n)
+		return 0;
+	n = MINIMUM(need - (index_t)est->n, budget);
+	for (j = 0; j < n; j++) {
+		const index_t index = est_permute(map, (index_t)est->n + j);
+		uring_read_t *r = &b->reads[b->n];
+
+		r->fd = fd;
+		r->buf = &b->words[b->n];
+		r->len = sizeof(pagemap_t);
+		r->offset = (off_t)((first + (addr_t)index) *
+			sizeof(pagemap_t));
+		b->maps[b->n] = map;
+		if (++b->n == URING_ENTRIES)
+			est_flush(s, b);
+	}
+	est->n += (uint32_t)n;
+	return n;
+}
+
+/*
+ *  est_check()
+ *	end a map's pass once it has sampled all its pages,
+ *	it then becomes the map's last pass and a new pass
+ *	starts
+ */
+static void est_check(map_t *map)
+{
+	map_est_t *e = &map->est;
+
+	if (!e->n || (((index_t)e->n < map_size(map)) &&
+	    (!e->size || (e->n < e->size))))
+		return;
+	e->last_n = e->n;
+	memcpy(e->last, e->hits, sizeof(e->last));
+	e->size = 0;
+	e->n = 0;
+	memset(e->hits, 0, sizeof(e->hits));
+	e->seed++;
+}
+
+/*
+ *  est_round()
+ *	spend a round's budget of pagemap reads on the passes
+ *	of the maps. Maps with no whole pass yet are visited
+ *	over and over until they have one or the budget is
+ *	spent, what is left starts the next passes of the
+ *	others in turn, so estimates are refreshed in time.
+ */
+static int est_round(est_t *e, sample_t *s)
+{
+	est_batch_t b;
+	const uint32_t nmaps = g.mem_info.nmaps;
+	const int fd = proc_fd(PROC_PAGEMAP);
+	struct timespec t1, t2;
+	index_t budget = (index_t)e->reads, spent;
+	uint32_t i, k, ntouched;
+	int phase;
+
+	s->syscalls = 0;
+	s->nwords = 0;
+	s->usecs = 0.0;
+	b.n = 0;
+
+	if (fd < 0)
+		return ERR_NO_MAP_INFO;
+	if (sample_alloc(s) < 0)
+		return ERR_ALLOC_NOMEM;
+	if (e->touched_size < nmaps) {
+		uint32_t *touched = realloc(e->touched,
+			nmaps * sizeof(*touched));
+
+		if (!touched)
+			return ERR_ALLOC_NOMEM;
+		e->touched = touched;
+		e->touched_size = nmaps;
+	}
+	if (e->next >= nmaps)
+		e->next = 0;
+	/* Rounds count from 1, new maps were never sampled */
+	e->rounds++;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (phase = 0; (phase < 2) && (budget > 0); phase++) {
+		do {
+			spent = 0;
+			ntouched = 0;
+			for (k = 0; (k < nmaps) && (budget > spent); k++) {
+				const uint32_t m = (e->next + k) % nmaps;
+				map_t *map = &g.mem_info.maps[m];
+
+				/* First maps with no whole pass, then the rest */
+				if (map->reserved || !map_size(map) ||
+				    (!phase != !map->est.last_n) ||
+				    (phase && (map->est.round == e->rounds)))
+					continue;
+				map->est.round = e->rounds;
+				spent += est_visit(s, &b, fd, map,
+					budget - spent);
+				e->touched[ntouched++] = m;
+			}
+			est_flush(s, &b);
+			for (i = 0; i < ntouched; i++)
+				est_check(&g.mem_info.maps[e->touched[i]]);
+			budget -= spent;
+			/* Carry on from the map after the last one sampled */
+			if (!budget)
+				e->next = (e->next + k) % nmaps;
+		} while (!phase && spent && budget);
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &t2);
+	s->usecs = ((t2.tv_sec - t1.tv_sec) * 1000000.0) +
+		((t2.tv_nsec - t1.tv_nsec) / 1000.0);
+
+	return OK;
+}
+
+/*
+ *  damon_init()
+ *	DAMON is off until started, with
+ *	the default intervals
+ */
+static void damon_init(damon_t *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->sample_us = DAMON_SAMPLE_US;
+	d->aggr_us = DAMON_AGGR_US;
+}
+
+/*
+ *  damon_intervals()
+ *	parse sampling,aggregation intervals in
+ *	microseconds, returns -1 if not valid
+ */
+static int damon_intervals(damon_t *d, const char *str)
+{
+	char *end;
+	const unsigned long sample = strtoul(str, &end, 10);
+	unsigned long aggr;
+
+	if ((end == str) || (*end != ','))
+		return -1;
+	str = end + 1;
+	aggr = strtoul(str, &end, 10);
+	if ((end == str) || *end || !sample || (aggr < sample) ||
+	    (aggr > DAMON_AGGR_US_MAX))
+		return -1;
+	d->sample_us = (uint32_t)sample;
+	d->aggr_us = (uint32_t)aggr;
+	return 0;
+}
+
+/*
+ *  damon_name()
+ *	name of a DAMON state
+ */
+static inline const char *damon_name(const uint8_t state)
+{
+	static const char *const names[] = {
+		[DAMON_OFF]	= "off",
+		[DAMON_ON]	= "on",
+		[DAMON_BUSY]	= "busy",
+		[DAMON_NONE]	= "unavailable",
+		[DAMON_FAILED]	= "failed",
+	};
+
+	return names[state];
+}
+
+/*
+ *  damon_write()
+ *	write a value to a DAMON sysfs file, just
+ *	system calls so damon_stop() can use it from
+ *	handle_terminate()
+ */
+static int damon_write(const char *path, const char *value)
+{
+	const int fd = open(path, O_WRONLY | O_CLOEXEC);
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+	ret = write(fd, value, strlen(value));
+	(void)close(fd);
+
+	return (ret < 0) ? -1 : 0;
+}
+
+/*
+ *  damon_read()
+ *	read a number from a DAMON sysfs file
+ */
+static int damon_read(const char *path, uint64_t *value)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	char buf[32], *end;
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, sizeof(buf) - 1);
+	(void)close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	errno = 0;
+	*value = strtoull(buf, &end, 10);
+
+	return (errno || (end == buf)) ? -1 : 0;
+}
+
+/*
+ *  damon_stop()
+ *	turn our kdamond off and remove it, also
+ *	called by handle_terminate() if cleaning
+ *	up after a fault faults again
+ */
+static void damon_stop(damon_t *d)
+{
+	if (!d->started)
+		return;
+	d->started = false;
+	/* Fails if the kdamond stopped when the process exited */
+	(void)damon_write(DAMON_KDAMOND "/state", "off");
+	(void)damon_write(DAMON_ADMIN "/kdamonds/nr_kdamonds", "0");
+}
+
+/*
+ *  damon_close()
+ *	stop DAMON and free the regions
+ */
+static void damon_close(damon_t *d)
+{
+	damon_refresh_t *r = d->refresh;
+
+	if (r) {
+		(void)pthread_mutex_lock(&r->lock);
+		r->quit = true;
+		(void)pthread_cond_signal(&r->go);
+		(void)pthread_mutex_unlock(&r->lock);
+	}
+	/* Turning the kdamond off ends any update being waited for */
+	damon_stop(d);
+	if (r) {
+		(void)pthread_join(r->thread, NULL);
+		(void)pthread_mutex_destroy(&r->lock);
+		(void)pthread_cond_destroy(&r->go);
+		free(r->regions);
+		free(r);
+		d->refresh = NULL;
+	}
+	free(d->regions);
+	d->regions = NULL;
+	d->nregions = 0;
+	d->regions_size = 0;
+}
+
+/*
+ *  damon_start()
+ *	set up a kdamond to monitor the process with a stat
+ *	scheme that matches every region. Setting the number
+ *	of kdamonds removes any there are, so DAMON is left
+ *	alone if anything else is using it. The refresh
+ *	thread is started once the kdamond is on.
+ */
+static int damon_start(damon_t *d)
+{
+	char pid[16], sample[16], aggr[16], sz[24], max[16];
+	const struct {
+		const char *path;
+		const char *value;
+	} attrs[] = {
+		{ DAMON_KDAMOND "/contexts/nr_contexts", "1" },
+		{ DAMON_CONTEXT "/operations", "vaddr" },
+		{ DAMON_CONTEXT "/targets/nr_targets", "1" },
+		{ DAMON_CONTEXT "/targets/0/pid_target", pid },
+		{ DAMON_CONTEXT "/monitoring_attrs/intervals/sample_us",
+		  sample },
+		{ DAMON_CONTEXT "/monitoring_attrs/intervals/aggr_us", aggr },
+		{ DAMON_CONTEXT "/schemes/nr_schemes", "1" },
+		{ DAMON_SCHEME "/action", "stat" },
+		{ DAMON_SCHEME "/access_pattern/sz/max", sz },
+		{ DAMON_SCHEME "/access_pattern/nr_accesses/max", max },
+		{ DAMON_SCHEME "/access_pattern/age/max", max },
+		{ DAMON_KDAMOND "/state", "on" },
+	};
+	damon_refresh_t *r;
+	uint64_t n;
+	size_t i;
+
+	if (damon_read(DAMON_ADMIN "/kdamonds/nr_kdamonds", &n) < 0) {
+		d->state = DAMON_NONE;
+		return -1;
+	}
+	if (n) {
+		d->state = DAMON_BUSY;
+		return -1;
+	}
+
+	(void)snprintf(pid, sizeof(pid), "%d", g.pid);
+	(void)snprintf(sample, sizeof(sample), "%" PRIu32, d->sample_us);
+	(void)snprintf(aggr, sizeof(aggr), "%" PRIu32, d->aggr_us);
+	(void)snprintf(sz, sizeof(sz), "%lu", ULONG_MAX);
+	(void)snprintf(max, sizeof(max), "%u", UINT_MAX);
+
+	d->state = DAMON_FAILED;
+	if (damon_write(DAMON_ADMIN "/kdamonds/nr_kdamonds", "1") < 0)
+		return -1;
+	d->started = true;
+	for (i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+		if (damon_write(attrs[i].path, attrs[i].value) < 0) {
+			damon_stop(d);
+			return -1;
+		}
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		damon_stop(d);
+		return -1;
+	}
+	(void)pthread_mutex_init(&r->lock, NULL);
+	(void)pthread_cond_init(&r->go, NULL);
+	if (pthread_create(&r->thread, NULL, damon_thread, r)) {
+		(void)pthread_mutex_destroy(&r->lock);
+		(void)pthread_cond_destroy(&r->go);
+		free(r);
+		damon_stop(d);
+		return -1;
+	}
+	d->refresh = r;
+	d->state = DAMON_ON;
+
+	return 0;
+}
+
+/*
+ *  damon_region_cmp()
+ *	order regions by address for qsort
+ */
+static int damon_region_cmp(const void *p1, const void *p2)
+{
+	const damon_region_t *a = (const damon_region_t *)p1;
+	const damon_region_t *b = (const damon_region_t *)p2;
+
+	return (a->begin > b->begin) - (a->begin < b->begin);
+}
+
+/*
+ *  damon_cold()
+ *	has a region gone unaccessed for DAMON_COLD_USECS?
+ */
+static inline bool damon_cold(const damon_t *d, const damon_region_t *r)
+{
+	return !r->accesses &&
+		((uint64_t)r->age * d->aggr_us >= DAMON_COLD_USECS);
+}
+
+/*
+ *  damon_heat()
+ *	the idle age a region is shown as, red for regions
+ *	accessed in at least half the samples of an aggregation,
+ *	yellow for those accessed less, green for unaccessed
+ *	regions and blue for cold ones
+ */
+static inline uint8_t damon_heat(const damon_t *d, const damon_region_t *r)
+{
+	if ((uint64_t)r->accesses * 2 * d->sample_us >= d->aggr_us)
+		return 1;
+	if (r->accesses)
+		return 2;
+	return damon_cold(d, r) ? 5 : 3;
+}
+
+/*
+ *  damon_find()
+ *	index of the first region ending after addr
+ */
+static uint32_t damon_find(const damon_t *d, const addr_t addr)
+{
+	uint32_t lo = 0, hi = d->nregions;
+
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+
+		if (d->regions[mid].end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ *  damon_age()
+ *	least idle age of the regions overlapping
+ *	begin to end (exclusive), or age if less
+ */
+static uint8_t damon_age(
+	const damon_t *d,
+	const addr_t begin,
+	const addr_t end,
+	uint8_t age)
+{
+	uint32_t i;
+
+	for (i = damon_find(d, begin); (i < d->nregions) &&
+	     (d->regions[i].begin < end) && (age != 1); i++) {
+		const uint8_t a = damon_heat(d, &d->regions[i]);
+
+		if (!age || (a < age))
+			age = a;
+	}
+	return age;
+}
+
+/*
+ *  damon_pages()
+ *	pages of begin to end (exclusive) in accessed
+ *	regions, those in cold regions are added to cold
+ *	if it is not NULL
+ */
+static uint64_t damon_pages(
+	const damon_t *d,
+	const addr_t begin,
+	const addr_t end,
+	uint64_t *cold)
+{
+	uint64_t accessed = 0;
+	uint32_t i;
+
+	for (i = damon_find(d, begin); (i < d->nregions) &&
+	     (d->regions[i].begin < end); i++) {
+		const damon_region_t *r = &d->regions[i];
+		const uint64_t pages = (MINIMUM(r->end, end) -
+			MAXIMUM(r->begin, begin)) / g.page_size;
+
+		if (r->accesses)
+			accessed += pages;
+		else if (cold && damon_cold(d, r))
+			*cold += pages;
+	}
+	return accessed;
+}
+
+/*
+ *  damon_field()
+ *	read a field of a region the scheme was tried on
+ */
+static int damon_field(const char *region, const char *field, uint64_t *value)
+{
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), DAMON_SCHEME "/tried_regions/%s/%s",
+		region, field);
+	return damon_read(path, value);
+}
+
+/*
+ *  damon_scan()
+ *	read the regions the scheme was last tried on
+ *	into regions, of size allocated regions that is
+ *	grown as needed, sorted into address order
+ */
+static void damon_scan(
+	damon_region_t **regions,
+	uint32_t *size,
+	uint32_t *nregions)
+{
+	struct dirent *de;
+	uint32_t n = 0;
+	DIR *dir;
+
+	*nregions = 0;
+	dir = opendir(DAMON_SCHEME "/tried_regions");
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		uint64_t begin, end, accesses, age;
+		damon_region_t *r;
+
+		if (!isdigit((unsigned char)de->d_name[0]))
+			continue;
+		if ((damon_field(de->d_name, "start", &begin) < 0) ||
+		    (damon_field(de->d_name, "end", &end) < 0) ||
+		    (damon_field(de->d_name, "nr_accesses", &accesses) < 0) ||
+		    (damon_field(de->d_name, "age", &age) < 0) ||
+		    (end <= begin))
+			continue;
+		if (n >= *size) {
+			const uint32_t new_size = MAXIMUM(*size * 2, 64);
+			damon_region_t *new_regions = realloc(*regions,
+				new_size * sizeof(*new_regions));
+
+			if (!new_regions)
+				break;
+			*regions = new_regions;
+			*size = new_size;
+		}
+		r = &(*regions)[n++];
+		r->begin = begin;
+		r->end = end;
+		r->accesses = (uint32_t)MINIMUM(accesses, UINT32_MAX);
+		r->age = (uint32_t)MINIMUM(age, UINT32_MAX);
+	}
+	(void)closedir(dir);
+
+	/* Regions are listed in directory order */
+	qsort(*regions, n, sizeof(**regions), damon_region_cmp);
+	*nregions = n;
+}
+
+/*
+ *  damon_run()
+ *	list the regions the kdamond has written out, a fault
+ *	while parsing them fails the refresh rather than
+ *	taking down the process. Returns -1 if it faulted.
+ */
+static int damon_run(
+	damon_refresh_t *r,
+	damon_region_t **regions,
+	uint32_t *size,
+	uint32_t *n)
+{
+	if (sigsetjmp(r->env, 1)) {
+		r->scanning = false;
+		return -1;
+	}
+	r->scanning = true;
+	damon_scan(regions, size, n);
+	r->scanning = false;
+
+	return 0;
+}
+
+/*
+ *  damon_thread()
+ *	DAMON refresh thread, each update asked for has
+ *	the kdamond list the regions of the process with
+ *	their accesses and ages. The write waits for the
+ *	scheme to be applied next, which may take up to
+ *	an aggregation interval.
+ */
+static void *damon_thread(void *arg)
+{
+	damon_refresh_t *r = (damon_refresh_t *)arg;
+	damon_region_t *regions = NULL, *tmp;
+	uint32_t size = 0, n, tmp_size;
+
+	for (;;) {
+		(void)pthread_mutex_lock(&r->lock);
+		while (!r->quit && !r->want)
+			(void)pthread_cond_wait(&r->go, &r->lock);
+		if (r->quit) {
+			(void)pthread_mutex_unlock(&r->lock);
+			break;
+		}
+		(void)pthread_mutex_unlock(&r->lock);
+
+		/* The kdamond stops when the process exits */
+		if ((damon_write(DAMON_KDAMOND "/state",
+		     "update_schemes_tried_regions") < 0) ||
+		    (damon_run(r, &regions, &size, &n) < 0)) {
+			(void)pthread_mutex_lock(&r->lock);
+			r->failed = true;
+			(void)pthread_mutex_unlock(&r->lock);
+			break;
+		}
+
+		/* Swap buffers, the old ones are reused next time */
+		(void)pthread_mutex_lock(&r->lock);
+		tmp = r->regions;
+		tmp_size = r->regions_size;
+		r->regions = regions;
+		r->regions_size = size;
+		r->nregions = n;
+		r->ready = true;
+		r->want = false;
+		(void)pthread_mutex_unlock(&r->lock);
+		regions = tmp;
+		size = tmp_size;
+	}
+	free(regions);
+
+	return NULL;
+}
+
+/*
+ *  damon_update()
+ *	take the regions of an update the refresh thread has
+ *	finished, if any, and ask for another at most once an
+ *	aggregation interval. It never waits for the kdamond,
+ *	so the regions lag a tick or more behind.
+ */
+static void damon_update(damon_t *d)
+{
+	damon_refresh_t *r = d->refresh;
+	struct timespec now;
+	bool taken = false;
+	uint32_t i;
+
+	if ((d->state != DAMON_ON) || !r)
+		return;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	(void)pthread_mutex_lock(&r->lock);
+	if (r->failed) {
+		(void)pthread_mutex_unlock(&r->lock);
+		d->state = DAMON_FAILED;
+		d->nregions = 0;
+		return;
+	}
+	if (r->ready) {
+		damon_region_t *regions = d->regions;
+		const uint32_t size = d->regions_size;
+
+		d->regions = r->regions;
+		d->regions_size = r->regions_size;
+		d->nregions = r->nregions;
+		r->regions = regions;
+		r->regions_size = size;
+		r->ready = false;
+		taken = true;
+	}
+	if (!r->want &&
+	    ((((now.tv_sec - d->last.tv_sec) * 1000000.0) +
+	      ((now.tv_nsec - d->last.tv_nsec) / 1000.0)) >= d->aggr_us)) {
+		r->want = true;
+		d->last = now;
+		(void)pthread_cond_signal(&r->go);
+	}
+	(void)pthread_mutex_unlock(&r->lock);
+	if (!taken)
+		return;
+
+	d->accessed = 0;
+	d->cold = 0;
+	for (i = 0; i < g.mem_info.nmaps; i++)
+		d->accessed += damon_pages(d, g.mem_info.maps[i].begin,
+			g.mem_info.maps[i].end, &d->cold);
+	d->updates++;
+}
+
+/*
+ *  cell_age()
+ *	least idle age of the pages first to last (exclusive)
+ *	of a map whose age is known, or age if less
+ */
+static uint8_t cell_age(
+	const map_t *map,
+	const index_t first,
+	const index_t last,
+	uint8_t age)
+{
+	const map_state_t *ms = map->state;
+	index_t i;
+
+	if (!ms || !ms->ages)
+		return age;
+	for (i = first; (i < last) && (age != 1); i++) {
+		const uint8_t a = ms->ages[i];
+
+		if (a && (!age || (a < age)))
+			age = a;
+	}
+	return age;
+}
+
+/*
+ *  frame_cells()
+ *	count the page states of the ncells cells of the
+ *	page view starting at page_index, each cell covering
+ *	zoom pages that may span maps. With heat set the
+ *	least idle or DAMON age of each cell is found too.
+ */
+static int frame_cells(
+	frame_t *f,
+	const index_t page_index,
+	const size_t ncells,
+	const int32_t zoom,
+	const bool heat)
+{
+	size_t i;
+	page_t page;
+
+	if (ncells > f->cells_size) {
+		cell_t *cells = realloc(f->cells, ncells * sizeof(*cells));
+
+		if (!cells)
+			return ERR_ALLOC_NOMEM;
+		f->cells = cells;
+		f->cells_size = ncells;
+	}
+
+	(void)page_lookup(page_index, &page);
+	for (i = 0; i < ncells; i++) {
+		cell_t *cell = &f->cells[i];
+		index_t remaining = zoom;
+
+		cell->addr = page.addr;
+		cell->map = page.map;
+		cell->age = 0;
+		memset(&cell->counts, 0, sizeof(cell->counts));
+
+		while (page.map && remaining) {
+			const index_t first = page.index - page.map->first;
+			const index_t n = MINIMUM(remaining,
+				map_pages(page.map) - first);
+
+			map_state_count(page.map, first, first + n,
+				&cell->counts);
+			if (heat) {
+				const addr_t begin = page.map->begin +
+					(addr_t)first * g.page_size;
+
+				cell->age = cell_age(page.map, first,
+					first + n, cell->age);
+				cell->age = damon_age(&g.damon, begin,
+					begin + (addr_t)n * g.page_size,
+					cell->age);
+			}
+			remaining -= n;
+			(void)page_advance(&page, n);
+		}
+	}
+	f->ncells = ncells;
+
+	return OK;
+}
+
+/*
+ *  read_pagemap()
+ *	read the pagemap bits of a page
+ */
+static pagemap_t read_pagemap(const page_t *page)
+{
+	const int fd = proc_fd(PROC_PAGEMAP);
+	pagemap_t pagemap = 0;
+
+	if ((fd < 0) || (pread(fd, &pagemap, sizeof(pagemap),
+	    (off_t)((page->addr / g.page_size) * sizeof(pagemap))) !=
+	    sizeof(pagemap)))
+		return 0;
+
+	return pagemap;
+}
+
+/*
+ *  frame_free()
+ *	free frame buffers
+ */
+static void frame_free(frame_t *f)
+{
+	free(f->cells);
+	memset(f, 0, sizeof(*f));
+}
+
+/*
+ *  handle_terminate()
+ *	handle termination signals
+ */
+static void handle_terminate(int sig)
+{
+	static bool already_handled = false;
+	const pthread_t self = pthread_self();
+	uint32_t i;
+	(void)sig;
+
+	/* A fault while cleaning up, just leave DAMON off */
+	if (already_handled) {
+		damon_stop(&g.damon);
+		exit(EXIT_FAILURE);
+	}
+
+	/* A fault in the sampler stops just the sampler */
+	if (g.sampler.running && pthread_equal(self, g.sampler.thread))
+		siglongjmp(g.sampler.env, 1);
+
+	/* A fault in a sweep worker fails just that fetch */
+	if (g.pool.started) {
+		for (i = 1; i < g.pool.nthreads; i++)
+			if (g.pool.workers[i].reading &&
+			    pthread_equal(self, g.pool.workers[i].thread))
+				siglongjmp(g.pool.workers[i].env, 1);
+	}
+
+	/* A fault in the DAMON refresh thread fails just DAMON */
+	if (g.damon.refresh && g.damon.refresh->scanning &&
+	    pthread_equal(self, g.damon.refresh->thread))
+		siglongjmp(g.damon.refresh->env, 1);
+
+	g.terminate = true;
+	already_handled = true;
+
+	siglongjmp(g.env, 1);
+}
+
+/*
+ *  show_usage()
+ *	mini help info
+ */
+static void show_usage(void)
+{
+	printf(APP_NAME ", version " VERSION "\n\n"
+		"Usage: " APP_NAME " [options]\n"
+		" -a        enable automatic zoom mode\n"
+		" -A s,a    DAMON access monitoring, sampling and aggregation\n"
+		"           intervals in microseconds, default %u,%u\n"
+		" -b        batch mode, write records to stdout\n"
+		" -c pages  pages in each chunk of a parallel sweep, "
+			"default %u\n"
+		" -d        delay in microseconds between refreshes, "
+			"default %u\n"
+		"           or between batch records, default %u\n"
+		" -D mode   dirty page tracking, none, refs or wp\n"
+		" -e err,n  estimate map page counts to err%% at 95%%,\n"
+		"           with n pagemap reads a refresh, default %u\n"
+		" -h        help\n"
+		" -i rounds track idle pages, cold after rounds idle\n"
+		" -k        read kernel page flags of present pages\n"
+		" -m        batch mode records for each map too\n"
+		" -o fmt    batch mode record format, json or csv\n"
+		" -p pid    process ID to monitor\n"
+		" -r        read (page back in) pages at start\n"
+		" -R range  track dirty pages of visible pages or "
+			"maps named range\n"
+		" -s        read page map counts for PSS and USS\n"
+		" -S pids   count the pages shared with these processes\n"
+		" -t ticks  ticks between dirty page resets\n"
+		" -u        use io_uring for batched reads if available\n"
+		" -v        enable VM view\n"
+		" -w n      number of sweep workers, at most %u, default\n"
+		"           1 per CPU up to %u\n"
+		" -W secs   working set size windows, default 1,10,60,600\n"
+		" -z zoom   set page zoom scale\n",
+		DAMON_SAMPLE_US, DAMON_AGGR_US, SWEEP_CHUNK_DEFAULT,
+		DEFAULT_UDELAY, BATCH_UDELAY, EST_READS_DEFAULT,
+		SWEEP_WORKERS_MAX, SWEEP_WORKERS_DEFAULT);
+}
+
+#if defined(PERF_ENABLED)
+/*
+ *  show_perf()
+ *	show perf stats
+ */
+static void show_perf(const snapshot_t *snap)
+{
+	int y = LINES - 6;
+	const int x = 2;
+
+	wattrset(g.mainwin, COLOR_PAIR(WHITE_CYAN) | A_BOLD);
+	mvwprintw(g.mainwin, y + 0, x,
+		" Page Faults (User Space):   %15" PRIu64 " ",
+		snap->perf[PERF_TP_PAGE_FAULT_USER]);
+	mvwprintw(g.mainwin, y + 1, x,
+		" Page Faults (Kernel Space): %15" PRIu64 " ",
+		snap->perf[PERF_TP_PAGE_FAULT_KERNEL]);
+	mvwprintw(g.mainwin, y + 2, x,
+		" Kernel Page Allocate:       %15" PRIu64 " ",
+		snap->perf[PERF_TP_MM_PAGE_ALLOC]);
+	mvwprintw(g.mainwin, y + 3, x,
+		" Kernel Page Free:           %15" PRIu64 " ",
+		snap->perf[PERF_TP_MM_PAGE_FREE]);
+
+}
+#endif
+
+/*
+ *  show_wss()
+ *	show the pages written in each working set size
+ *	window, with a sparkline of its history
+ */
+static void show_wss(const snapshot_t *snap)
+{
+	static const char ramp[] = " .:-=+*#%@";
+	int y = LINES - 2 - (int)snap->nwss;
+	const int x = 2;
+	uint32_t i, j;
+	char size[16];
+
+#if defined(PERF_ENABLED)
+	/* Keep clear of the perf stats */
+	if (g.perf_view && snap->req.perf_view)
+		y -= 5;
+#endif
+	wattrset(g.mainwin, COLOR_PAIR(WHITE_GREEN) | A_BOLD);
+	if (snap->dirty.mode == DIRTY_NONE) {
+		mvwprintw(g.mainwin, LINES - 3, x,
+			" Working set size needs dirty tracking (-D) ");
+		return;
+	}
+	mvwprintw(g.mainwin, y++, x, " %-6s %9s  %-*s ",
+		"Window", "Written", WSS_HISTORY, "History");
+	for (i = 0; i < snap->nwss; i++) {
+		const wss_window_t *win = &snap->wss[i];
+		uint64_t max = 1;
+
+		for (j = 0; j < win->nhistory; j++)
+			max = MAXIMUM(max, win->history[j]);
+		mem_to_str((addr_t)(win->pages * g.page_size),
+			size, sizeof(size));
+		mvwprintw(g.mainwin, y++, x, " %5" PRIu32 "s %9s  ",
+			win->secs, size);
+
+		/* Oldest sample first */
+		for (j = 0; j < WSS_HISTORY; j++) {
+			const uint64_t pages =
+				win->history[(win->head + j) % WSS_HISTORY];
+			int ch = ' ';
+
+			if ((j >= WSS_HISTORY - win->nhistory) && pages)
+				ch = ramp[1 + ((pages * 8) + max - 1) / max];
+			wprintw(g.mainwin, "%c", ch);
+		}
+		wprintw(g.mainwin, " ");
+	}
+}
+
+/*
+ *  show_vm()
+ *	show Virtual Memory stats
+ */
+static void show_vm(const snapshot_t *snap)
+{
+	int y = 2;
+	const int x = COLS - 26;
+	uint32_t i;
+	char reserved[16];
+
+	wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
+	if (*snap->state)
+		mvwprintw(g.mainwin, y++, x,
+			" State:    %-12.12s ", snap->state);
+	for (i = 0; i < snap->nvm; i++) {
+		const vm_stat_t *vm = &snap->vm[i];
+
+		mvwprintw(g.mainwin, y++, x,
+			" Vm%-6.6s %10" PRIu64 " %s ",
+			vm->name, vm->size, vm->unit);
+	}
+
+	if (snap->faults_valid) {
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Page Faults:");
+		mvwprintw(g.mainwin, y++, x,
+			" Minor: %12" PRIu64 "    ", snap->minor);
+		mvwprintw(g.mainwin, y++, x,
+			" Major: %12" PRIu64 "    ", snap->major);
+	}
+
+	if (snap->score_valid) {
+		mvwprintw(g.mainwin, y++, x,
+			" OOM Score: %8" PRIu64 "    ", snap->score);
+	}
+
+	mvwprintw(g.mainwin, y++, x, " %-23s", "Dirty Tracking:");
+	mvwprintw(g.mainwin, y++, x,
+		" Mode:  %12s    ", dirty_name(snap->dirty.mode));
+	if (snap->dirty.mode != DIRTY_NONE) {
+		mvwprintw(g.mainwin, y++, x,
+			" Resets:%12" PRIu64 "    ", snap->dirty.resets);
+		mvwprintw(g.mainwin, y++, x,
+			" Faults:%12" PRIu64 "    ", snap->dirty.faults);
+		mvwprintw(g.mainwin, y++, x,
+			" Rate:  %12.1f /s ", snap->dirty.rate);
+	}
+
+	if (snap->idle_valid) {
+		char cold[16];
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Idle Pages:");
+		if (g.idle.fd < 0) {
+			mvwprintw(g.mainwin, y++, x, " %-23s",
+				"page_idle unavailable");
+		} else {
+			mem_to_str((addr_t)(snap->idle_cold * g.page_size),
+				cold, sizeof(cold));
+			mvwprintw(g.mainwin, y++, x,
+				" Rounds:%12" PRIu64 "    ", snap->idle_rounds);
+			mvwprintw(g.mainwin, y++, x,
+				" Pages: %12" PRIu64 "    ", snap->idle_pages);
+			mvwprintw(g.mainwin, y++, x,
+				" Cold:     %9s    ", cold);
+		}
+	}
+
+	if (snap->kflags_valid) {
+		const kflags_counts_t *c = &snap->kflags_counts;
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Page Flags:");
+		if (g.kflags.fd < 0) {
+			mvwprintw(g.mainwin, y++, x, " %-23s",
+				"kpageflags unavailable");
+		} else {
+			mvwprintw(g.mainwin, y++, x,
+				" Pages: %12" PRIu64 "    ", c->pages);
+			mvwprintw(g.mainwin, y++, x,
+				" PFNs:  %12zu    ", snap->pfns);
+			mvwprintw(g.mainwin, y++, x,
+				" THP:   %12" PRIu64 "    ", c->thp);
+			mvwprintw(g.mainwin, y++, x,
+				" Active:%12" PRIu64 "    ", c->active);
+			mvwprintw(g.mainwin, y++, x,
+				" Inact: %12" PRIu64 "    ", c->inactive);
+			mvwprintw(g.mainwin, y++, x,
+				" Unevic:%12" PRIu64 "    ", c->unevictable);
+			mvwprintw(g.mainwin, y++, x,
+				" KSM:   %12" PRIu64 "    ", c->ksm);
+			mvwprintw(g.mainwin, y++, x,
+				" Mmap:  %12" PRIu64 "    ", c->mmap);
+			mvwprintw(g.mainwin, y++, x,
+				" Anon:  %12" PRIu64 "    ", c->anon);
+			mvwprintw(g.mainwin, y++, x,
+				" Dirty: %12" PRIu64 "    ", c->dirty);
+			mvwprintw(g.mainwin, y++, x,
+				" Wrback:%12" PRIu64 "    ", c->writeback);
+		}
+	}
+
+	if (snap->kcount_valid || (snap->share.nprocs > 1)) {
+		const kcount_counts_t *c = &snap->kcount_counts;
+		char size[16];
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Sharing:");
+		if (snap->kcount_valid && (g.kcount.fd < 0)) {
+			mvwprintw(g.mainwin, y++, x, " %-23s",
+				"kpagecount unavailable");
+		} else if (snap->kcount_valid) {
+			mem_to_str((addr_t)(c->uss * g.page_size),
+				size, sizeof(size));
+			mvwprintw(g.mainwin, y++, x,
+				" USS:      %9s    ", size);
+			mem_to_str((addr_t)((c->pss * g.page_size) >> PSS_SHIFT),
+				size, sizeof(size));
+			mvwprintw(g.mainwin, y++, x,
+				" PSS:      %9s    ", size);
+			mem_to_str((addr_t)(c->shared * g.page_size),
+				size, sizeof(size));
+			mvwprintw(g.mainwin, y++, x,
+				" Shared:   %9s    ", size);
+		}
+		/* Pages shared with each of the other processes */
+		for (i = 1; i < snap->share.nprocs; i++) {
+			mem_to_str((addr_t)(snap->share.shared[0][i] *
+				g.page_size), size, sizeof(size));
+			mvwprintw(g.mainwin, y++, x,
+				" PID %-7d%9s    ", snap->share.pids[i], size);
+		}
+	}
+
+	if (snap->damon.state != DAMON_OFF) {
+		char accessed[16], cold[16];
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "DAMON:");
+		mvwprintw(g.mainwin, y++, x,
+			" State: %12s    ", damon_name(snap->damon.state));
+		if (snap->damon.updates) {
+			mem_to_str((addr_t)(snap->damon.accessed * g.page_size),
+				accessed, sizeof(accessed));
+			mem_to_str((addr_t)(snap->damon.cold * g.page_size),
+				cold, sizeof(cold));
+			mvwprintw(g.mainwin, y++, x,
+				" Region:%12" PRIu32 "    ",
+				snap->damon.nregions);
+			mvwprintw(g.mainwin, y++, x,
+				" Accessed: %9s    ", accessed);
+			mvwprintw(g.mainwin, y++, x,
+				" Cold:     %9s    ", cold);
+		}
+	}
+
+	mvwprintw(g.mainwin, y++, x, " %-23s", "Map Changes:");
+	mvwprintw(g.mainwin, y++, x,
+		" Maps:  %12" PRIu32 "    ", snap->nmaps);
+	mem_to_str((addr_t)(snap->reserved * g.page_size),
+		reserved, sizeof(reserved));
+	mvwprintw(g.mainwin, y++, x,
+		" Resvd:    %9s    ", reserved);
+	mvwprintw(g.mainwin, y++, x,
+		" Added: %12" PRIu32 "    ", snap->changes.added);
+	mvwprintw(g.mainwin, y++, x,
+		" Remove:%12" PRIu32 "    ", snap->changes.removed);
+	mvwprintw(g.mainwin, y++, x,
+		" Resize:%12" PRIu32 "    ", snap->changes.resized);
+	mvwprintw(g.mainwin, y++, x,
+		" Prot:  %12" PRIu32 "    ", snap->changes.reprot);
+
+	if (snap->est_valid) {
+		static const char *const names[] = {
+			"Pres:", "Swap:", "Dirty:", "Shrd:"
+		};
+		static const int fields[] = {
+			EST_PRESENT, EST_SWAPPED, EST_DIRTY, EST_SHARED
+		};
+		char size[16], error[8];
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Estimates, 95% CI:");
+		for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+			const est_value_t *v = &snap->est[fields[i]];
+
+			mem_to_str((addr_t)(v->pages * g.page_size),
+				size, sizeof(size));
+			pages_to_str((int64_t)((v->hi - v->lo) / 2.0 + 0.5),
+				error, sizeof(error));
+			mvwprintw(g.mainwin, y++, x,
+				" %-6s%9s +-%s ", names[i], size, error);
+		}
+		mem_to_str((addr_t)(snap->est_unsampled * g.page_size),
+			size, sizeof(size));
+		mvwprintw(g.mainwin, y++, x,
+			" Unsamp:   %9s    ", size);
+		mvwprintw(g.mainwin, y++, x,
+			" Pages: %12" PRIu64 "    ", snap->est_sampled);
+	}
+
+	if (snap->req.view == VIEW_PAGE) {
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Frame Sampling:");
+		mvwprintw(g.mainwin, y++, x,
+			" Reads: %12" PRIu32 "    ", snap->syscalls);
+		mvwprintw(g.mainwin, y++, x,
+			" Words: %12zu    ", snap->nwords);
+		mvwprintw(g.mainwin, y++, x,
+			" Time:  %12.1f us ", snap->usecs);
+		mvwprintw(g.mainwin, y++, x,
+			" ISA:   %12s    ", classify_isa());
+		mvwprintw(g.mainwin, y++, x,
+			" I/O:   %12s    ", snap->io);
+		mvwprintw(g.mainwin, y++, x,
+			" Scan:  %12s    ", snap->scan);
+
+		mvwprintw(g.mainwin, y++, x, " %-23s", "Sampled Pages:");
+		mvwprintw(g.mainwin, y++, x,
+			" Present:%11" PRIu64 "    ",
+			snap->counts.state[PAGE_STATE_PRESENT]);
+		mvwprintw(g.mainwin, y++, x,
+			" Swapped:%11" PRIu64 "    ",
+			snap->counts.state[PAGE_STATE_SWAPPED]);
+		mvwprintw(g.mainwin, y++, x,
+			" Mapped: %11" PRIu64 "    ",
+			snap->counts.state[PAGE_STATE_FILE]);
+		mvwprintw(g.mainwin, y++, x,
+			" Huge:   %11" PRIu64 "    ",
+			snap->counts.state[PAGE_STATE_HUGE]);
+		mvwprintw(g.mainwin, y++, x,
+			" Dirty:  %11" PRIu64 "    ",
+			snap->counts.state[PAGE_STATE_DIRTY]);
+		if (snap->huge >= 0.0)
+			mvwprintw(g.mainwin, y++, x,
+				" Huge %%: %10.1f%%    ", snap->huge);
+		else
+			mvwprintw(g.mainwin, y++, x,
+				" Huge %%: %11s    ", "n/a");
+	}
+}
+
+/*
+ *  kflags_names()
+ *	comma separated names of the kernel page flags
+ *	of interest that are set
+ */
+static void kflags_names(const uint64_t flags, char *buf, const size_t size)
+{
+	static const struct {
+		uint8_t bit;
+		const char *name;
+	} names[] = {
+		{ KPF_THP,		"thp" },
+		{ KPF_HUGE,		"huge" },
+		{ KPF_LRU,		"lru" },
+		{ KPF_ACTIVE,		"active" },
+		{ KPF_REFERENCED,	"referenced" },
+		{ KPF_UNEVICTABLE,	"unevictable" },
+		{ KPF_MLOCKED,		"mlocked" },
+		{ KPF_KSM,		"ksm" },
+		{ KPF_ZERO_PAGE,	"zero" },
+		{ KPF_MMAP,		"mmap" },
+		{ KPF_ANON,		"anon" },
+		{ KPF_SWAPCACHE,	"swapcache" },
+		{ KPF_DIRTY,		"dirty" },
+		{ KPF_WRITEBACK,	"writeback" },
+	};
+	size_t i, len = 0;
+
+	*buf = '\0';
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		int n;
+
+		if (!((flags >> names[i].bit) & 1))
+			continue;
+		n = snprintf(buf + len, size - len, "%s%s",
+			len ? "," : "", names[i].name);
+		if ((n < 0) || ((size_t)n >= size - len))
+			break;
+		len += (size_t)n;
+	}
+}
+
+/*
+ *  show_page_bits()
+ *	show info based on the page bit pattern
+ */
+static void show_page_bits(const snapshot_t *snap, const page_t *page)
+{
+	char buf[16];
+	const int x = 2;
+	const map_t *map = page->map;
+	const pagemap_t pagemap_info = snap->cursor_pagemap;
 
 	mem_to_str(map->end - map->begin, buf, sizeof(buf) - 1);
 	wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
-	mvwprintw(g.mainwin, 2, x,
-		" Page:      0x%16.16" PRIx64 "%18s",
-		g.mem_info.pages[index].addr, "");
-	mvwprintw(g.mainwin, 3, x,
-		" Page Size: 0x%8.8" PRIx32 " bytes%20s",
-		g.page_size, "");
-	mvwprintw(g.mainwin, 4, x,
-		" Map:       0x%16.16" PRIx64 "-%16.16" PRIx64 " ",
-		map->begin, map->end - 1);
-	mvwprintw(g.mainwin, 5, x,
-		" Map Size:  %s%27s", buf, "");
-	mvwprintw(g.mainwin, 6, x,
-		" Device:    %5.5s%31s",
-		map->dev, "");
-	mvwprintw(g.mainwin, 7, x,
-		" Prot:      %4.4s%32s",
-		map->attr, "");
-	mvwprintw(g.mainwin, 8, x,
-		" Map Name:  %-35.35s ", map->name[0] == '\0' ?
-			"[Anonymous]" : basename(map->name));
+	mvwprintw(g.mainwin, 2, x,
+		" Page:      0x%16.16" PRIx64 "%18s",
+		page->addr, "");
+	mvwprintw(g.mainwin, 3, x,
+		" Page Size: 0x%8.8" PRIx32 " bytes%20s",
+		g.page_size, "");
+	mvwprintw(g.mainwin, 4, x,
+		" Map:       0x%16.16" PRIx64 "-%16.16" PRIx64 " ",
+		map->begin, map->end - 1);
+	if (map->reserved)
+		mvwprintw(g.mainwin, 5, x,
+			" Map Size:  %s Reserved%18s", buf, "");
+	else
+		mvwprintw(g.mainwin, 5, x,
+			" Map Size:  %s%27s", buf, "");
+	mvwprintw(g.mainwin, 6, x,
+		" Device:    %5.5s%31s",
+		map->dev, "");
+	mvwprintw(g.mainwin, 7, x,
+		" Prot:      %4.4s%32s",
+		map->attr, "");
+	mvwprintw(g.mainwin, 8, x,
+		" Map Name:  %-35.35s ", map_basename(snap->names, map));
+
+	mvwprintw(g.mainwin, 9, x,
+		" Flag:      0x%16.16" PRIx64 "%18s", pagemap_info, "");
+	if (pagemap_info & PAGE_SWAPPED) {
+		mvwprintw(g.mainwin, 10, x,
+			"   Swap Type:           0x%2.2" PRIx64 "%20s",
+			pagemap_info & 0x1f, "");
+		mvwprintw(g.mainwin, 11, x,
+			"   Swap Offset:         0x%16.16" PRIx64 "%6s",
+			(pagemap_info & 0x00ffffffffffffffULL) >> 5, "");
+	} else {
+		mvwprintw(g.mainwin, 10, x, "%48s", "");
+		mvwprintw(g.mainwin, 11, x,
+			"   Page Frame Number:   0x%16.16" PRIx64 "%6s",
+			pagemap_info & 0x00ffffffffffffffULL, "");
+	}
+	mvwprintw(g.mainwin, 12, x,
+		"   Soft-dirty PTE:      %3s%21s",
+		(pagemap_info & PAGE_PTE_SOFT_DIRTY) ? "Yes" : "No ", "");
+	mvwprintw(g.mainwin, 13, x,
+		"   Exclusively Mapped:  %3s%21s",
+		(pagemap_info & PAGE_EXCLUSIVE_MAPPED) ? "Yes" : "No ", "");
+	mvwprintw(g.mainwin, 14, x,
+		"   File or Shared Anon: %3s%21s",
+		(pagemap_info & PAGE_FILE_SHARED_ANON) ? "Yes" : "No ", "");
+	mvwprintw(g.mainwin, 15, x,
+		"   Present in Swap:     %3s%21s",
+		(pagemap_info & PAGE_SWAPPED) ? "Yes" : "No ", "");
+	mvwprintw(g.mainwin, 16, x,
+		"   Present in RAM:      %3s%21s",
+		(pagemap_info & PAGE_PRESENT) ? "Yes" : "No ", "");
+	if (snap->cursor_huge >= 0.0)
+		mvwprintw(g.mainwin, 17, x,
+			"   Map Huge Pages:      %5.1f%%%18s",
+			snap->cursor_huge, "");
+	else
+		mvwprintw(g.mainwin, 17, x,
+			"   Map Huge Pages:      %-24s", "n/a");
+	if (g.opt_flags & OPT_FLAG_KFLAGS) {
+		char names[48];
+
+		*names = '\0';
+		if (snap->cursor_kflags_valid) {
+			kflags_names(snap->cursor_kflags, names, sizeof(names));
+			mvwprintw(g.mainwin, 18, x,
+				"   Page Flags:          0x%16.16" PRIx64 "%6s",
+				snap->cursor_kflags, "");
+		} else {
+			mvwprintw(g.mainwin, 18, x,
+				"   Page Flags:          %-24s", "n/a");
+		}
+		mvwprintw(g.mainwin, 19, x, "   %-45.45s", names);
+	}
+}
+
+/*
+ *  banner()
+ *	clear a banner across the window
+ */
+static inline void banner(const int y)
+{
+	mvwprintw(g.mainwin, y, 0, "%*s", COLS, "");
+}
+
+/*
+ *  show_pages()
+ *	show page mapping
+ */
+static void show_pages(const snapshot_t *snap, const position_t *p)
+{
+	static const char state_ch[PAGE_STATE_MAX] = {
+		'.', 'P', 'S', 'M', 'H', 'D'
+	};
+	static const int state_attr[PAGE_STATE_MAX] = {
+		COLOR_PAIR(BLACK_WHITE),
+		COLOR_PAIR(WHITE_YELLOW),
+		COLOR_PAIR(WHITE_GREEN),
+		COLOR_PAIR(WHITE_RED),
+		COLOR_PAIR(WHITE_MAGENTA),
+		COLOR_PAIR(WHITE_CYAN),
+	};
+	/* Idle for 0, 1, 2 to 3 and 4 or more rounds */
+	static const int heat_attr[] = {
+		COLOR_PAIR(WHITE_RED),
+		COLOR_PAIR(WHITE_YELLOW),
+		COLOR_PAIR(WHITE_GREEN),
+		COLOR_PAIR(WHITE_GREEN),
+		COLOR_PAIR(WHITE_BLUE),
+	};
+	int32_t i;
+	const int32_t xmax = p->xmax, ymax = p->ymax;
+	const request_t *req = &snap->req;
+	page_t page;
+
+	for (i = 1; i <= ymax; i++) {
+		/* The snapshot may be for a smaller window */
+		const cell_t *row = (i <= req->ymax) ?
+			&snap->frame.cells[(size_t)(i - 1) * req->xmax] : NULL;
+		int32_t j;
+
+		if (!row || !row->map) {
+			wattrset(g.mainwin, COLOR_PAIR(BLACK_BLACK));
+			mvwprintw(g.mainwin, i, 0, "---------------- ");
+		} else {
+			/* Highlight rows starting in recently changed maps */
+			wattrset(g.mainwin, row->map->change ?
+				COLOR_PAIR(WHITE_RED) : COLOR_PAIR(BLACK_WHITE));
+			mvwprintw(g.mainwin, i, 0, "%16.16" PRIx64 " ",
+				row->addr);
+		}
+
+		for (j = 0; j < xmax; j++) {
+			const cell_t *cell = (row && (j < req->xmax)) ?
+				&row[j] : NULL;
+			char state = '~';
+			int attr = COLOR_PAIR(BLACK_BLACK);
+
+			if (cell && cell->map) {
+				const page_counts_t *c = &cell->counts;
+				int s, max = PAGE_STATE_NONE;
+
+				/*
+				 *  Show the most common state other than not
+				 *  present, in lower case if fewer than half
+				 *  of the pages in the cell are in that state
+				 */
+				for (s = PAGE_STATE_DIRTY; s > PAGE_STATE_NONE; s--) {
+					if (c->state[s] > c->state[max] ||
+					    (c->state[s] && max == PAGE_STATE_NONE))
+						max = s;
+				}
+				state = state_ch[max];
+				attr = state_attr[max];
+				if (c->state[max] * 2 < c->pages)
+					state = tolower(state);
+				/* A reserved map collapsed into one page */
+				if (cell->map->reserved &&
+				    (max == PAGE_STATE_NONE))
+					state = '-';
+				if (cell->age && g.heat_view)
+					attr = heat_attr[MINIMUM(cell->age - 1,
+						4)];
+			}
+			wattrset(g.mainwin, attr);
+			mvwprintw(g.mainwin, i, ADDR_OFFSET + j, "%c", state);
+		}
+	}
+	wattrset(g.mainwin, A_NORMAL);
+
+	if (g.tab_view && req->tab_view &&
+	    snap_lookup(snap, req->cursor_index, &page))
+		show_page_bits(snap, &page);
+	if (g.vm_view && req->vm_view)
+		show_vm(snap);
+	if (g.wss_view && req->wss_view)
+		show_wss(snap);
+#if defined(PERF_ENABLED)
+	if (g.perf_view && req->perf_view)
+		show_perf(snap);
+#endif
+}
+
+/*
+ *  show_memory()
+ *	show memory contents
+ */
+static void show_memory(const snapshot_t *snap, const position_t *p)
+{
+	int32_t i;
+	const int32_t xmax = p->xmax, ymax = p->ymax;
+	const request_t *req = &snap->req;
+
+	for (i = 1; i <= ymax; i++) {
+		/* The snapshot may be for a smaller window */
+		const mem_row_t *row = (i <= req->ymax) ?
+			&snap->rows[i - 1] : NULL;
+		const int16_t *bytes = row ?
+			&snap->bytes[(size_t)(i - 1) * req->xmax] : NULL;
+		int32_t j;
+
+		wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
+		if (!row || !row->mapped)
+			mvwprintw(g.mainwin, i, 0, "---------------- ");
+		else
+			mvwprintw(g.mainwin, i, 0, "%16.16" PRIx64 " ",
+				row->addr);
+		mvwprintw(g.mainwin, i, COLS - 3, "   ");
+
+		for (j = 0; j < xmax; j++) {
+			const int16_t byte = (bytes && (j < req->xmax)) ?
+				bytes[j] : MEM_BYTE_END;
+
+			if (byte == MEM_BYTE_END) {
+				/* End of memory */
+				wattrset(g.mainwin, COLOR_PAIR(BLACK_BLACK));
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * j), "   ");
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * xmax) + j, " ");
+			} else if (byte == MEM_BYTE_FAILED) {
+				/* Failed to read data */
+				wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE));
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * j), "?? ");
+				wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * xmax) + j, "?");
+			} else {
+				/* We have some legimate data to display */
+				const uint8_t ch = byte & 0x7f;
+
+				wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE));
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * j), "%2.2" PRIx8 " ",
+					(uint8_t)byte);
+				wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
+				mvwprintw(g.mainwin, i, ADDR_OFFSET +
+					(HEX_WIDTH * xmax) + j, "%c",
+					(ch < 32 || ch > 126) ? '.' : ch);
+			}
+			wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
+			mvwprintw(g.mainwin, i, 16 + (HEX_WIDTH * xmax), " ");
+		}
+	}
+}
+
+/*
+ *  Maps table column headings
+ */
+static const char *const table_heads[TABLE_COLS] = {
+	"Begin", "Size", "Pres", "Swap", "Dirty", "File",
+	"Excl", "Huge", "Cold", "Err", "Attr", "Name"
+};
+
+/*
+ *  pages_to_str()
+ *	report pages as memory in 5 characters,
+ *	"-" if the number of pages is not known
+ */
+static void pages_to_str(const int64_t pages, char *buf, const size_t buflen)
+{
+	static const char units[] = "KMGTP";
+	uint64_t val;
+	int i;
+
+	if (pages < 0) {
+		snprintf(buf, buflen, "%5s", "-");
+		return;
+	}
+	val = (uint64_t)pages * (g.page_size / KB);
+	for (i = 0; (val > 9999) && units[i + 1]; i++)
+		val /= KB;
+	snprintf(buf, buflen, "%4" PRIu64 "%c", val, units[i]);
+}
+
+/*
+ *  table_selected()
+ *	the selected row of the maps table, NULL
+ *	if it is not in the snapshot
+ */
+static const table_row_t *table_selected(
+	const snapshot_t *snap,
+	const table_view_t *tv)
+{
+	const int32_t i = tv->row - snap->req.table_top;
+
+	if ((snap->req.view != VIEW_MAPS) || (i < 0) ||
+	    (i >= (int32_t)snap->ntable))
+		return NULL;
+	return &snap->table[i];
+}
+
+/*
+ *  show_table()
+ *	show the maps table, a row of page counts per map
+ */
+static void show_table(
+	const snapshot_t *snap,
+	const position_t *p,
+	const table_view_t *tv)
+{
+	const request_t *req = &snap->req;
+	char buf[8];
+	int32_t i;
+	int c, x;
+
+	wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
+	banner(1);
+	for (c = 0, x = 0; c < TABLE_COLS; c++) {
+		wattrset(g.mainwin, (c == req->table_sort) ?
+			COLOR_PAIR(WHITE_RED) | A_BOLD :
+			COLOR_PAIR(WHITE_BLUE) | A_BOLD);
+		if (c == TABLE_BEGIN) {
+			mvwprintw(g.mainwin, 1, x, "%-16s", table_heads[c]);
+			x += 17;
+		} else if (c < TABLE_ATTR) {
+			mvwprintw(g.mainwin, 1, x, "%5s", table_heads[c]);
+			x += 6;
+		} else {
+			mvwprintw(g.mainwin, 1, x, "%-4s", table_heads[c]);
+			x += 5;
+		}
+	}
+
+	for (i = 0; i < p->ymax; i++) {
+		/* The snapshot may be for a smaller window */
+		const table_row_t *row = (i < req->ymax) &&
+			(i < (int32_t)snap->ntable) ? &snap->table[i] : NULL;
+		const map_t *map;
+
+		if (!row) {
+			wattrset(g.mainwin, COLOR_PAIR(BLACK_BLACK));
+			banner(i + 2);
+			continue;
+		}
+		map = &snap->maps[row->map];
+		/* Highlight the selected row and recently changed maps */
+		if (req->table_top + i == tv->row)
+			wattrset(g.mainwin, COLOR_PAIR(WHITE_BLACK) | A_BOLD);
+		else
+			wattrset(g.mainwin, map->change ?
+				COLOR_PAIR(WHITE_RED) :
+				COLOR_PAIR(BLACK_WHITE));
+		banner(i + 2);
+		mvwprintw(g.mainwin, i + 2, 0, "%16.16" PRIx64, map->begin);
+		for (c = TABLE_SIZE; c < TABLE_ERROR; c++) {
+			pages_to_str(row->value[c], buf, sizeof(buf));
+			wprintw(g.mainwin, " %s", buf);
+		}
+		if (row->value[TABLE_ERROR] < 0)
+			wprintw(g.mainwin, " %5s", "-");
+		else
+			wprintw(g.mainwin, " %4.1f%%", MINIMUM(99.9,
+				(double)row->value[TABLE_ERROR] / 100.0));
+		wprintw(g.mainwin, " %-4.4s %.*s", map->attr,
+			MAXIMUM(COLS - 76, 0), map_basename(snap->names, map));
+	}
+	wattrset(g.mainwin, A_NORMAL);
+
+	if (g.vm_view && req->vm_view)
+		show_vm(snap);
+	if (g.wss_view && req->wss_view)
+		show_wss(snap);
+#if defined(PERF_ENABLED)
+	if (g.perf_view && req->perf_view)
+		show_perf(snap);
+#endif
+}
+
+/*
+ *  read_all_pages()
+ *	read in all pages into memory, this
+ *	will force swapped out pages back into
+ *	memory
+ */
+static int read_all_pages(void)
+{
+	uring_read_t reads[URING_ENTRIES];
+	uint8_t bytes[URING_ENTRIES];
+	size_t n = 0;
+	int fd;
+	uint32_t i;
+
+	if ((fd = proc_fd(PROC_MEM)) < 0)
+		return ERR_NO_MEM_INFO;
+
+	/* A byte of each page, read in batches */
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_t *map = &g.mem_info.maps[i];
+		addr_t addr;
+
+		/* Reading would fault in zero pages */
+		if (map->reserved)
+			continue;
+		for (addr = map->begin; addr < map->end; addr += g.page_size) {
+			reads[n].fd = fd;
+			reads[n].buf = &bytes[n];
+			reads[n].len = sizeof(bytes[n]);
+			reads[n].offset = (off_t)addr;
+			if (++n == URING_ENTRIES) {
+				(void)read_batch(&g.uring, reads, n);
+				n = 0;
+			}
+		}
+	}
+	(void)read_batch(&g.uring, reads, n);
+
+	return 0;
+}
+
+/*
+ *  clear_soft_dirty()
+ *	clear the soft-dirty bits of all the pages
+ *	of the process
+ */
+static void clear_soft_dirty(void)
+{
+	const int fd = proc_fd(PROC_REFS);
+
+	if (fd > -1) {
+		const ssize_t ret = pwrite(fd, "4", 1, 0);
+
+		(void)ret;
+	}
+}
+
+/*
+ *  dirty_wp_probe()
+ *	can the writes to a map be tracked with PAGEMAP_SCAN,
+ *	only maps the process has registered for asynchronous
+ *	userfaultfd write-protection can be
+ */
+static uint8_t dirty_wp_probe(const int fd, const map_t *map)
+{
+	struct page_region region;
+	struct pm_scan_arg arg;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.size = sizeof(arg);
+	arg.start = map->begin;
+	arg.end = map->end;
+	arg.vec = (uint64_t)(uintptr_t)&region;
+	arg.vec_len = 1;
+	arg.max_pages = 1;
+	arg.category_mask = PAGE_IS_WPALLOWED;
+	arg.return_mask = PAGE_IS_WPALLOWED;
+
+	return (ioctl(fd, PAGEMAP_SCAN, &arg) > 0) ? WP_YES : WP_NO;
+}
+
+/*
+ *  wss_init()
+ *	set the default working set size windows
+ */
+static void wss_init(wss_t *w)
+{
+	static const uint32_t secs[] = { 1, 10, 60, 600 };
+	uint32_t i;
+
+	for (i = 0; i < WSS_WINDOWS_MAX; i++)
+		w->windows[i].secs = secs[i];
+	w->nwindows = WSS_WINDOWS_MAX;
+}
+
+/*
+ *  wss_windows()
+ *	parse a comma separated list of window lengths
+ *	in seconds, returns -1 if it is not valid
+ */
+static int wss_windows(wss_t *w, const char *str)
+{
+	uint32_t n = 0;
+
+	while (*str) {
+		char *end;
+		const unsigned long secs = strtoul(str, &end, 10);
+
+		if ((end == str) || !secs || (secs > 86400) ||
+		    (n == WSS_WINDOWS_MAX) || (*end && (*end != ',')))
+			return -1;
+		w->windows[n++].secs = (uint32_t)secs;
+		str = *end ? end + 1 : end;
+	}
+	if (!n)
+		return -1;
+	w->nwindows = n;
+	return 0;
+}
+
+/*
+ *  wss_next()
+ *	start a new interval ending now, the written pages
+ *	of each map are counted afresh. Intervals whose low
+ *	16 bits are zero are skipped as a zero stamp means a
+ *	page has not been written.
+ */
+static void wss_next(wss_t *w, const double now)
+{
+	uint32_t i;
+
+	w->interval++;
+	if (!(uint16_t)w->interval) {
+		w->intervals[w->interval % WSS_INTERVALS] =
+			w->intervals[(w->interval - 1) % WSS_INTERVALS];
+		w->intervals[w->interval % WSS_INTERVALS].pages = 0;
+		w->interval++;
+	}
+	w->intervals[w->interval % WSS_INTERVALS].time = now;
+	w->intervals[w->interval % WSS_INTERVALS].pages = 0;
+	w->written = 0;
+
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		map_state_t *ms = g.mem_info.maps[i].state;
+
+		if (ms)
+			ms->written = 0;
+	}
+}
+
+/*
+ *  wss_written()
+ *	stamp n pages from index of a map as written in the
+ *	current interval, moving them out of the interval
+ *	they were last written in
+ */
+static void wss_written(wss_t *w, map_t *map, const index_t index,
+	const index_t n)
+{
+	const uint16_t stamp = (uint16_t)w->interval;
+	wss_interval_t *iv = &w->intervals[w->interval % WSS_INTERVALS];
+	map_state_t *ms = map_state_alloc(map);
+	index_t i;
+
+	if (!ms)
+		return;
+	if (!ms->stamps) {
+		ms->stamps = calloc((size_t)map_pages(map),
+			sizeof(*ms->stamps));
+		if (!ms->stamps)
+			return;
+	}
+	for (i = index; i < index + n; i++) {
+		if (ms->stamps[i] == stamp)
+			continue;
+		if (ms->stamps[i])
+			wss_unstamp(w, ms->stamps[i]);
+		ms->stamps[i] = stamp;
+		iv->pages++;
+		ms->written++;
+		w->written++;
+	}
+}
+
+/*
+ *  wss_sample()
+ *	count the pages written in each window, walking back
+ *	over the intervals that started inside it, at least
+ *	the last one, and add a sample to the history of the
+ *	windows that are due one
+ */
+static void wss_sample(wss_t *w, const double now)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < w->nwindows; i++) {
+		wss_window_t *win = &w->windows[i];
+		const double start = now - win->secs;
+		uint32_t interval = w->interval;
+
+		win->pages = w->intervals[interval % WSS_INTERVALS].pages;
+		for (j = 1; (j < WSS_INTERVALS - 1) && (interval > 1); j++) {
+			const wss_interval_t *prev =
+				&w->intervals[(interval - 1) % WSS_INTERVALS];
+
+			/* Interval started before the window */
+			if (prev->time < start)
+				break;
+			interval--;
+			win->pages += w->intervals[interval % WSS_INTERVALS].pages;
+		}
+		if (now >= win->next) {
+			win->history[win->head] = win->pages;
+			win->head = (win->head + 1) % WSS_HISTORY;
+			win->nhistory = MINIMUM(win->nhistory + 1, WSS_HISTORY);
+			win->next = now + win->secs;
+		}
+	}
+}
+
+/*
+ *  dirty_wp_reset()
+ *	count the pages of a map written from address begin
+ *	to end and write-protect them again in the same walk,
+ *	stamping them as written if record is set. Returns the
+ *	pages written, or -1 on failure.
+ */
+static int64_t dirty_wp_reset(
+	const int fd,
+	map_t *map,
+	addr_t begin,
+	const addr_t end,
+	const bool record)
+{
+	struct page_region regions[SCAN_REGIONS_MAX];
+	struct pm_scan_arg arg;
+	int64_t written = 0;
+	int i, n;
+
+	while (begin < end) {
+		memset(&arg, 0, sizeof(arg));
+		arg.size = sizeof(arg);
+		arg.flags = PM_SCAN_WP_MATCHING;
+		arg.start = begin;
+		arg.end = end;
+		arg.vec = (uint64_t)(uintptr_t)regions;
+		arg.vec_len = SCAN_REGIONS_MAX;
+		arg.category_mask = PAGE_IS_WPALLOWED | PAGE_IS_WRITTEN;
+		arg.return_mask = PAGE_IS_WRITTEN;
+
+		n = ioctl(fd, PAGEMAP_SCAN, &arg);
+		if (n < 0)
+			return -1;
+		for (i = 0; i < n; i++) {
+			const index_t pages = (index_t)((regions[i].end -
+				regions[i].start) / g.page_size);
+
+			if (record)
+				wss_written(&g.wss, map, (index_t)
+					((regions[i].start - map->begin) /
+					g.page_size), pages);
+			written += (int64_t)pages;
+		}
+		/* Stopped early when the regions ran out */
+		if (arg.walk_end <= begin)
+			break;
+		begin = arg.walk_end;
+	}
+	return written;
+}
+
+/*
+ *  dirty_demote()
+ *	demote the pages of pyramid node i of level l of a map
+ *	that were sampled as dirty to present, as their soft-dirty
+ *	bits are about to be cleared, stamping them as written
+ *	first if record is set. Nodes with no dirty pages are
+ *	skipped. A dirty page was present or swapped, its state
+ *	is put right when it is next sampled. Returns the pages
+ *	demoted, those sampled dirty since the last reset.
+ */
+static uint64_t dirty_demote(map_t *map, const uint32_t l, const size_t i,
+	const bool record)
+{
+	const map_state_t *ms = map->state;
+	uint64_t demoted = 0;
+
+	if (!ms->nodes[ms->level[l] + i].state[PAGE_STATE_DIRTY])
+		return 0;
+	if (!l) {
+		const index_t first = (index_t)i << PYRAMID_BASE_SHIFT;
+		const index_t last = MINIMUM(first + PYRAMID_BASE,
+			map_pages(map));
+		uint8_t states[PYRAMID_BASE];
+		index_t index;
+
+		for (index = first; index < last; index++) {
+			uint8_t *state = &states[index - first];
+
+			*state = map_state_get(ms, index);
+			if (*state != PAGE_STATE_DIRTY)
+				continue;
+			*state = PAGE_STATE_PRESENT;
+			if (record)
+				wss_written(&g.wss, map, index, 1);
+			demoted++;
+		}
+		map_state_update(map, first, states, last - first);
+		return demoted;
+	}
+	demoted = dirty_demote(map, l - 1, i * 2, record);
+	if (i * 2 + 1 < ms->count[l - 1])
+		demoted += dirty_demote(map, l - 1, i * 2 + 1, record);
+	return demoted;
+}
+
+/*
+ *  dirty_reset()
+ *	start a new dirty page tracking interval. With
+ *	clear_refs the soft-dirty bits of the whole process
+ *	are cleared. With PAGEMAP_SCAN just the tracked maps
+ *	are write-protected again, only pages lo to lo + n of
+ *	them if tracking the visible pages, or the maps of the
+ *	nrows rows of the maps table if rows is set. Each page
+ *	written in an interval cost the process a write fault,
+ *	which
+ *	is the overhead reported. With clear_refs only the
+ *	pages sampled dirty since the last reset are seen, so
+ *	the faults reported are a lower bound.
+ */
+static void dirty_reset(
+	dirty_t *d,
+	const index_t lo,
+	const index_t n,
+	const table_entry_t *rows,
+	const uint32_t nrows)
+{
+	const int fd = proc_fd(PROC_PAGEMAP);
+	const bool record = d->resets > 0;
+	const bool by_row = d->visible && rows;
+	struct timespec now;
+	uint64_t written = 0;
+	uint32_t i;
+	double secs;
+
+	if (d->mode == DIRTY_NONE)
+		return;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	wss_next(&g.wss, (double)now.tv_sec + (double)now.tv_nsec / 1.0E9);
+
+	if (d->mode == DIRTY_REFS) {
+		/*
+		 *  Only the sampled pages are known to be dirty, they
+		 *  are demoted so that the next interval counts just
+		 *  the pages sampled dirty again after the reset
+		 */
+		for (i = 0; i < g.mem_info.nmaps; i++) {
+			map_t *map = &g.mem_info.maps[i];
+			const map_state_t *ms = map->state;
+			size_t j;
+
+			if (!ms)
+				continue;
+			for (j = 0; j < ms->count[ms->nlevels - 1]; j++)
+				written += dirty_demote(map,
+					ms->nlevels - 1, j, record);
+		}
+		clear_soft_dirty();
+	} else for (i = 0; i < (by_row ? nrows : g.mem_info.nmaps); i++) {
+		map_t *map = &g.mem_info.maps[by_row ? rows[i].map : i];
+		const index_t first = map->first;
+		const index_t last = first + map_pages(map);
+		addr_t begin = map->begin, end = map->end;
+		int64_t ret;
+
+		if (d->visible && !by_row) {
+			if ((last <= lo) || (first >= lo + n))
+				continue;
+			if (first < lo)
+				begin += (addr_t)(lo - first) * g.page_size;
+			if (last > lo + n)
+				end -= (addr_t)(last - (lo + n)) * g.page_size;
+		}
+		if (map->reserved || (d->maps &&
+		    !strstr(map_name(g.mem_info.names.data, map), d->maps)))
+			continue;
+		if (fd < 0)
+			break;
+		if (map->wp == WP_UNKNOWN)
+			map->wp = dirty_wp_probe(fd, map);
+		if (map->wp != WP_YES)
+			continue;
+		if ((ret = dirty_wp_reset(fd, map, begin, end, record)) < 0) {
+			map->wp = WP_NO;
+			continue;
+		}
+		written += (uint64_t)ret;
+	}
+
+	/* The first interval's writes were not caused by us */
+	if (record) {
+		secs = (double)(now.tv_sec - d->last.tv_sec) +
+			(double)(now.tv_nsec - d->last.tv_nsec) / 1.0E9;
+		d->written = written;
+		d->faults += written;
+		d->rate = (secs > 0.0) ? (double)written / secs : 0.0;
+	}
+	d->last = now;
+	d->resets++;
+	wss_sample(&g.wss, (double)now.tv_sec + (double)now.tv_nsec / 1.0E9);
+}
+
+/*
+ *  idle_init()
+ *	idle page tracking is off until opened
+ */
+static void idle_init(idle_t *id)
+{
+	memset(id, 0, sizeof(*id));
+	id->fd = -1;
+}
+
+/*
+ *  idle_open()
+ *	open the page_idle bitmap, idle page tracking
+ *	needs CONFIG_IDLE_PAGE_TRACKING
+ */
+static int idle_open(idle_t *id)
+{
+	id->words = malloc(IDLE_RUN_WORDS * sizeof(*id->words));
+	if (!id->words)
+		return -1;
+	id->fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR | O_CLOEXEC);
+
+	return id->fd;
+}
+
+/*
+ *  idle_close()
+ *	close the page_idle bitmap and free the run buffer
+ */
+static void idle_close(idle_t *id)
+{
+	fd_close(&id->fd);
+	free(id->words);
+	id->words = NULL;
+}
+
+/*
+ *  idle_age()
+ *	set the idle age of a page, keeping
+ *	the count of cold pages of its map
+ */
+static inline void idle_age(
+	const idle_t *id,
+	map_state_t *ms,
+	const index_t index,
+	const uint8_t age)
+{
+	const uint8_t old = ms->ages[index];
+
+	ms->cold += (age > id->cold) - (old > id->cold);
+	ms->ages[index] = age;
+}
+
+/*
+ *  pfns_collect()
+ *	add the present pages of an extent read by a round
+ *	to the round, the idle ages of other pages are no
+ *	longer known
+ */
+static void pfns_collect(const extent_t *e, const pagemap_t *words, void *arg)
+{
+	pfns_t *p = (pfns_t *)arg;
+	map_t *map = e->map;
+	map_state_t *ms = map->state;
+	const index_t index = (index_t)(e->start - map->begin / g.page_size);
+	uint32_t j;
+
+	for (j = 0; j < e->count; j++) {
+		const pagemap_t w = words[j];
+
+		if (!(w & PAGE_PRESENT) || !(w & PAGE_PFN_MASK)) {
+			if (ms->ages)
+				idle_age(&g.idle, ms, index + j, 0);
+			continue;
+		}
+		p->pages[p->npages].pfn = w & PAGE_PFN_MASK;
+		p->pages[p->npages].map = (uint32_t)(map - g.mem_info.maps);
+		p->pages[p->npages].index = index + j;
+		p->npages++;
+	}
+}
+
+/*
+ *  pfn_page_cmp()
+ *	order pages by PFN for qsort
+ */
+static int pfn_page_cmp(const void *p1, const void *p2)
+{
+	const pfn_page_t *a = (const pfn_page_t *)p1;
+	const pfn_page_t *b = (const pfn_page_t *)p2;
+
+	return (a->pfn > b->pfn) - (a->pfn < b->pfn);
+}
+
+/*
+ *  pfn_run()
+ *	end of the run of pages from i whose words, of per
+ *	PFNs each, are at most gap words apart and span at
+ *	most max words, the last word of the run is in *last
+ */
+static size_t pfn_run(
+	const pfns_t *p,
+	const size_t i,
+	const uint64_t per,
+	const uint64_t gap,
+	const uint64_t max,
+	uint64_t *last)
+{
+	const uint64_t w0 = p->pages[i].pfn / per;
+	uint64_t w1 = w0;
+	size_t j;
+
+	for (j = i + 1; j < p->npages; j++) {
+		const uint64_t w = p->pages[j].pfn / per;
+
+		if ((w > w1 + gap) || (w - w0 >= max))
+			break;
+		w1 = w;
+	}
+	*last = w1;
+	return j;
+}
+
+/*
+ *  idle_round()
+ *	check which pages of a round have been accessed since
+ *	the last round and mark them all idle again. A page
+ *	still idle ages by a round, an accessed page is young
+ *	again. Runs of nearby bitmap words are read and written
+ *	back in one go, with just the bits of our pages set.
+ */
+static void idle_round(idle_t *id, const pfns_t *p)
+{
+	struct timespec t1, t2;
+	size_t i, j;
+
+	if (id->fd < 0)
+		return;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < p->npages; i = j) {
+		const uint64_t w0 = p->pages[i].pfn / 64;
+		uint64_t w1;
+		size_t len, k;
+		ssize_t ret;
+
+		j = pfn_run(p, i, 64, IDLE_GAP_WORDS, IDLE_RUN_WORDS, &w1);
+		len = (size_t)(w1 - w0 + 1) * sizeof(*id->words);
+
+		/* Pages that cannot be checked are taken as accessed */
+		ret = pread(id->fd, id->words, len, (off_t)(w0 * 8));
+		if (ret < (ssize_t)len)
+			memset((uint8_t *)id->words + MAXIMUM(ret, 0), 0,
+				len - (size_t)MAXIMUM(ret, 0));
+		for (k = i; k < j; k++) {
+			const pfn_page_t *pg = &p->pages[k];
+			map_state_t *ms = g.mem_info.maps[pg->map].state;
+			const uint8_t age = ms->ages[pg->index];
+			const bool idle = (id->words[pg->pfn / 64 - w0] >>
+				(pg->pfn % 64)) & 1;
+
+			idle_age(id, ms, pg->index, (idle && age && id->rounds) ?
+				(uint8_t)MINIMUM(age + 1, IDLE_AGE_MAX) : 1);
+		}
+
+		memset(id->words, 0, len);
+		for (k = i; k < j; k++)
+			id->words[p->pages[k].pfn / 64 - w0] |=
+				1ULL << (p->pages[k].pfn % 64);
+		ret = pwrite(id->fd, id->words, len, (off_t)(w0 * 8));
+		(void)ret;
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t2);
+	id->usecs = ((t2.tv_sec - t1.tv_sec) * 1000000.0) +
+		((t2.tv_nsec - t1.tv_nsec) / 1000.0);
+	id->pages = p->npages;
+	id->rounds++;
+}
+
+/*
+ *  idle_cold()
+ *	pages of the process idle for the cold rounds
+ */
+static uint64_t idle_cold(void)
+{
+	uint64_t cold = 0;
+	uint32_t i;
+
+	for (i = 0; i < g.mem_info.nmaps; i++)
+		if (g.mem_info.maps[i].state)
+			cold += g.mem_info.maps[i].state->cold;
+	return cold;
+}
+
+/*
+ *  kpage_init()
+ *	a /proc/kpage* file is not read until opened
+ */
+static void kpage_init(kpage_t *kp)
+{
+	memset(kp, 0, sizeof(*kp));
+	kp->fd = -1;
+}
+
+/*
+ *  kpage_open()
+ *	open a /proc/kpage* file, which needs
+ *	root and CONFIG_PROC_PAGE_MONITOR
+ */
+static int kpage_open(kpage_t *kp, const char *path)
+{
+	kp->words = malloc(KPAGE_RUN_WORDS * sizeof(*kp->words));
+	if (!kp->words)
+		return -1;
+	kp->fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	return kp->fd;
+}
+
+/*
+ *  kpage_close()
+ *	close a /proc/kpage* file and free the run buffer
+ */
+static void kpage_close(kpage_t *kp)
+{
+	fd_close(&kp->fd);
+	free(kp->words);
+	kp->words = NULL;
+}
+
+/*
+ *  kpage_read()
+ *	read the word of a PFN
+ */
+static int kpage_read(const kpage_t *kp, const uint64_t pfn, uint64_t *word)
+{
+	if (kp->fd < 0)
+		return -1;
+	return (pread(kp->fd, word, sizeof(*word),
+		(off_t)(pfn * sizeof(*word))) == sizeof(*word)) ? 0 : -1;
+}
+
+/*
+ *  kpage_run()
+ *	read the words of PFNs w0 to w1 into the run
+ *	buffer, returns the number of words read
+ */
+static uint64_t kpage_run(kpage_t *kp, const uint64_t w0, const uint64_t w1)
+{
+	const ssize_t ret = pread(kp->fd, kp->words,
+		(size_t)(w1 - w0 + 1) * sizeof(*kp->words),
+		(off_t)(w0 * sizeof(*kp->words)));
+
+	kp->reads++;
+	return (ret < 0) ? 0 : (uint64_t)ret / sizeof(*kp->words);
+}
+
+/*
+ *  kflags_count()
+ *	add the kernel page flags of a page to counts
+ */
+static inline void kflags_count(kflags_counts_t *c, const uint64_t flags)
+{
+	const uint64_t lru = (flags >> KPF_LRU) & 1;
+	const uint64_t active = (flags >> KPF_ACTIVE) & 1;
+
+	c->pages++;
+	c->thp += (flags >> KPF_THP) & 1;
+	c->active += lru & active;
+	c->inactive += lru & !active;
+	c->unevictable += ((flags >> KPF_UNEVICTABLE) |
+		(flags >> KPF_MLOCKED)) & 1;
+	c->ksm += (flags >> KPF_KSM) & 1;
+	c->zero += (flags >> KPF_ZERO_PAGE) & 1;
+	c->mmap += (flags >> KPF_MMAP) & 1;
+	c->anon += (flags >> KPF_ANON) & 1;
+	c->dirty += (flags >> KPF_DIRTY) & 1;
+	c->writeback += (flags >> KPF_WRITEBACK) & 1;
+}
+
+/*
+ *  kcount_count()
+ *	add the map count of a page to counts, a page mapped
+ *	n times adds 1/n of a page to the PSS. Pages with no
+ *	count, such as the zero page, are not counted.
+ */
+static inline void kcount_count(kcount_counts_t *c, const uint64_t count)
+{
+	if (!count)
+		return;
+	c->pages++;
+	if (count == 1)
+		c->uss++;
+	else
+		c->shared++;
+	c->pss += (1ULL << PSS_SHIFT) / count;
+}
+
+/*
+ *  kpage_round()
+ *	read the kernel page flags and map counts of the
+ *	pages of a round, runs of nearby PFNs in one read of
+ *	each file, and count them for the map of each page.
+ *	Pages whose words cannot be read are not counted.
+ */
+static void kpage_round(const pfns_t *p)
+{
+	kpage_t *kf = &g.kflags, *kc = &g.kcount;
+	size_t i, j, k;
+
+	if ((kf->fd < 0) && (kc->fd < 0))
+		return;
+
+	kf->reads = 0;
+	kc->reads = 0;
+	for (i = 0; i < p->npages; i = j) {
+		const uint64_t w0 = p->pages[i].pfn;
+		uint64_t w1, got;
+
+		j = pfn_run(p, i, 1, KPAGE_GAP_WORDS, KPAGE_RUN_WORDS, &w1);
+		if (kf->fd >= 0) {
+			got = kpage_run(kf, w0, w1);
+			for (k = i; k < j; k++) {
+				const pfn_page_t *pg = &p->pages[k];
+
+				if (pg->pfn - w0 < got)
+					kflags_count(&g.mem_info.maps[pg->map].
+						state->flags_pass,
+						kf->words[pg->pfn - w0]);
+			}
+		}
+		if (kc->fd >= 0) {
+			got = kpage_run(kc, w0, w1);
+			for (k = i; k < j; k++) {
+				const pfn_page_t *pg = &p->pages[k];
+
+				if (pg->pfn - w0 < got)
+					kcount_count(&g.mem_info.maps[pg->map].
+						state->share_pass,
+						kc->words[pg->pfn - w0]);
+			}
+		}
+	}
+	kf->rounds += (kf->fd >= 0);
+	kc->rounds += (kc->fd >= 0);
+}
+
+/*
+ *  kflags_total()
+ *	kernel page flags of the process last round
+ */
+static void kflags_total(kflags_counts_t *total)
+{
+	uint32_t i;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_state_t *ms = g.mem_info.maps[i].state;
+
+		if (!ms)
+			continue;
+		total->pages += ms->flags.pages;
+		total->thp += ms->flags.thp;
+		total->active += ms->flags.active;
+		total->inactive += ms->flags.inactive;
+		total->unevictable += ms->flags.unevictable;
+		total->ksm += ms->flags.ksm;
+		total->zero += ms->flags.zero;
+		total->mmap += ms->flags.mmap;
+		total->anon += ms->flags.anon;
+		total->dirty += ms->flags.dirty;
+		total->writeback += ms->flags.writeback;
+	}
+}
+
+/*
+ *  kcount_total()
+ *	map counts of the process last round
+ */
+static void kcount_total(kcount_counts_t *total)
+{
+	uint32_t i;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_state_t *ms = g.mem_info.maps[i].state;
+
+		if (!ms)
+			continue;
+		total->pages += ms->share.pages;
+		total->uss += ms->share.uss;
+		total->shared += ms->share.shared;
+		total->pss += ms->share.pss;
+	}
+}
+
+/*
+ *  pfns_round()
+ *	collect the present pages of at most budget pages of
+ *	lo to lo + n, carrying on from where the last round
+ *	left off, sort them by PFN, check them in with idle
+ *	page tracking and read their kernel page flags and
+ *	map counts. The flags and counts of a map are counted
+ *	afresh from the first of its pages in the range and
+ *	become those of the map at the last.
+ */
+static void pfns_round(
+	pfns_t *p,
+	const index_t lo,
+	const index_t n,
+	const index_t budget)
+{
+	const int fd = proc_fd(PROC_PAGEMAP);
+	sample_t *s = &p->sample;
+	index_t start, end;
+	uint32_t m;
+	size_t i;
+
+	if ((g.idle.fd < 0) && (g.kflags.fd < 0) && (g.kcount.fd < 0))
+		return;
+	if ((fd < 0) || (sample_alloc(s) < 0))
+		return;
+
+	if ((p->next < lo) || (p->next >= lo + n))
+		p->next = lo;
+	start = p->next;
+	end = MINIMUM(lo + n, start + budget);
+	if ((size_t)(end - start) > p->size) {
+		pfn_page_t *pages = realloc(p->pages,
+			(size_t)(end - start) * sizeof(*pages));
+
+		if (!pages)
+			return;
+		p->pages = pages;
+		p->size = (size_t)(end - start);
+	}
+
+	for (m = 0; m < g.mem_info.nmaps; m++) {
+		map_t *map = &g.mem_info.maps[m];
+		const index_t first = MAXIMUM(map->first, lo);
+		map_state_t *ms;
+
+		if (map->reserved || (first >= end) ||
+		    (map->first + map_pages(map) <= start))
+			continue;
+		if (!(ms = map_state_alloc(map)))
+			return;
+		if ((g.idle.fd >= 0) && !ms->ages) {
+			ms->ages = calloc((size_t)map_pages(map),
+				sizeof(*ms->ages));
+			if (!ms->ages)
+				return;
+		}
+		if (first >= start) {
+			memset(&ms->flags_pass, 0, sizeof(ms->flags_pass));
+			memset(&ms->share_pass, 0, sizeof(ms->share_pass));
+		}
+	}
+
+	p->npages = 0;
+	if (sample_plan(s, start, end - start) < 0)
+		return;
+	sample_read(&g.uring, fd, s->buf, s->buf_words, s->states,
+		s->extents, 0, s->nextents, &s->nwords, &s->syscalls,
+		pfns_collect, p);
+	s->nextents = 0;
+	p->next = end;
+
+	qsort(p->pages, p->npages, sizeof(*p->pages), pfn_page_cmp);
+	for (p->distinct = 0, i = 0; i < p->npages; i++)
+		p->distinct += !i || (p->pages[i].pfn != p->pages[i - 1].pfn);
+
+	idle_round(&g.idle, p);
+	kpage_round(p);
+
+	for (m = 0; m < g.mem_info.nmaps; m++) {
+		map_t *map = &g.mem_info.maps[m];
+		const index_t last = MINIMUM(map->first + map_pages(map),
+			lo + n);
+		map_state_t *ms = map->state;
+
+		if (!ms || map->reserved || (last <= start) || (last > end))
+			continue;
+		ms->flags = ms->flags_pass;
+		ms->share = ms->share_pass;
+	}
+}
+
+/*
+ *  pfns_free()
+ *	free the pages of a round
+ */
+static void pfns_free(pfns_t *p)
+{
+	free(p->pages);
+	sample_free(&p->sample);
+	p->pages = NULL;
+	p->npages = 0;
+	p->size = 0;
+}
+
+/*
+ *  share_pids()
+ *	parse a comma separated list of processes to
+ *	share pages with, returns -1 if it is not valid
+ */
+static int share_pids(share_t *s, char *str)
+{
+	char *tok, *saveptr = NULL;
+
+	s->matrix.nprocs = 1;
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		const pid_t pid = proc_name_to_pid(tok);
+
+		if ((pid < 1) || (s->matrix.nprocs == SHARE_PROCS_MAX))
+			return -1;
+		s->matrix.pids[s->matrix.nprocs++] = pid;
+	}
+	return (s->matrix.nprocs > 1) ? 0 : -1;
+}
+
+/*
+ *  share_add()
+ *	add the PFNs of the present pages of an extent of
+ *	the pagemap words of a process
+ */
+static void share_add(const extent_t *e, const pagemap_t *words, void *arg)
+{
+	share_proc_t *sp = (share_proc_t *)arg;
+	uint32_t i;
+
+	if (sp->npfns + e->count > sp->size) {
+		const size_t size = MAXIMUM(sp->size * 2,
+			sp->npfns + e->count);
+		uint64_t *pfns = realloc(sp->pfns, size * sizeof(*pfns));
+
+		if (!pfns) {
+			sp->nomem = true;
+			return;
+		}
+		sp->pfns = pfns;
+		sp->size = size;
+	}
+	for (i = 0; i < e->count; i++) {
+		const pagemap_t w = words[i];
+
+		if ((w & PAGE_PRESENT) && (w & PAGE_PFN_MASK))
+			sp->pfns[sp->npfns++] = w & PAGE_PFN_MASK;
+	}
+}
+
+/*
+ *  pfn_sort()
+ *	radix sort n PFNs, SORT_BITS at a time and just
+ *	over the bits that are used, using tmp of n PFNs
+ */
+static void pfn_sort(uint64_t *pfns, uint64_t *tmp, const size_t n)
+{
+	uint64_t *from = pfns, *to = tmp, used = 0;
+	uint32_t shift;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		used |= pfns[i];
+	for (shift = 0; (shift < 64) && (used >> shift); shift += SORT_BITS) {
+		size_t pos[1 << SORT_BITS], sum = 0;
+		uint64_t *t;
+
+		memset(pos, 0, sizeof(pos));
+		for (i = 0; i < n; i++)
+			pos[(from[i] >> shift) & ((1 << SORT_BITS) - 1)]++;
+		for (i = 0; i < (1 << SORT_BITS); i++) {
+			const size_t count = pos[i];
+
+			pos[i] = sum;
+			sum += count;
+		}
+		for (i = 0; i < n; i++)
+			to[pos[(from[i] >> shift) & ((1 << SORT_BITS) - 1)]++] =
+				from[i];
+		t = from;
+		from = to;
+		to = t;
+	}
+	if (from != pfns)
+		memcpy(pfns, from, n * sizeof(*pfns));
+}
+
+/*
+ *  share_collect()
+ *	collect the distinct PFNs of the present pages of
+ *	process i in order, none if it cannot be read
+ */
+static int share_collect(share_t *s, const uint32_t i)
+{
+	share_proc_t *sp = &s->procs[i];
+	char path[PROCPATH_MAX];
+	const char *ptr, *end, *next;
+	size_t j, n;
+	int fd;
+
+	sp->npfns = 0;
+	sp->nomem = false;
+	(void)snprintf(path, sizeof(path), "/proc/%i/maps",
+		s->matrix.pids[i]);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	n = (fd_read(fd, &s->maps) < 0) ? 0 : s->maps.len;
+	(void)close(fd);
+	if (!n)
+		return 0;
+
+	(void)snprintf(path, sizeof(path), "/proc/%i/pagemap",
+		s->matrix.pids[i]);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	end = s->maps.data + n;
+	for (ptr = s->maps.data; (ptr < end) && !sp->nomem; ptr = next) {
+		maps_line_t line;
+		map_t map;
+
+		if (!maps_parse(ptr, end, &line, &next) ||
+		    (line.end <= line.begin))
+			continue;
+		/* Not one of our maps, so it has no page states */
+		memset(&map, 0, sizeof(map));
+		map.begin = line.begin;
+		map.end = line.end;
+		if (sample_map(&s->sample, fd, &map, map.begin / g.page_size,
+		    (map.end - map.begin) / g.page_size, share_add, sp) < 0)
+			sp->nomem = true;
+	}
+	(void)close(fd);
+	if (sp->nomem)
+		return -1;
+
+	if (sp->npfns > s->tmp_size) {
+		uint64_t *tmp = realloc(s->tmp, sp->npfns * sizeof(*tmp));
+
+		if (!tmp)
+			return -1;
+		s->tmp = tmp;
+		s->tmp_size = sp->npfns;
+	}
+	pfn_sort(sp->pfns, s->tmp, sp->npfns);
+	for (n = 0, j = 0; j < sp->npfns; j++)
+		if (!n || (sp->pfns[j] != sp->pfns[n - 1]))
+			sp->pfns[n++] = sp->pfns[j];
+	sp->npfns = n;
+
+	return 0;
+}
+
+/*
+ *  share_round()
+ *	count the PFNs each pair of processes share by
+ *	merging their sorted PFNs, a process shares all
+ *	its own distinct PFNs with itself
+ */
+static void share_round(share_t *s)
+{
+	uint32_t i, j;
+
+	if (s->matrix.nprocs < 2)
+		return;
+
+	s->matrix.pids[0] = g.pid;
+	for (i = 0; i < s->matrix.nprocs; i++)
+		if (share_collect(s, i) < 0)
+			return;
+
+	for (i = 0; i < s->matrix.nprocs; i++) {
+		const share_proc_t *a = &s->procs[i];
+
+		s->matrix.shared[i][i] = a->npfns;
+		for (j = i + 1; j < s->matrix.nprocs; j++) {
+			const share_proc_t *b = &s->procs[j];
+			size_t x = 0, y = 0;
+			uint64_t shared = 0;
+
+			while ((x < a->npfns) && (y < b->npfns)) {
+				if (a->pfns[x] < b->pfns[y]) {
+					x++;
+				} else if (a->pfns[x] > b->pfns[y]) {
+					y++;
+				} else {
+					shared++;
+					x++;
+					y++;
+				}
+			}
+			s->matrix.shared[i][j] = shared;
+			s->matrix.shared[j][i] = shared;
+		}
+	}
+	s->matrix.rounds++;
+}
+
+/*
+ *  share_free()
+ *	free the PFNs of the sharing matrix processes
+ */
+static void share_free(share_t *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < SHARE_PROCS_MAX; i++) {
+		free(s->procs[i].pfns);
+		s->procs[i].pfns = NULL;
+		s->procs[i].npfns = 0;
+		s->procs[i].size = 0;
+	}
+	free(s->tmp);
+	sample_free(&s->sample);
+	free(s->maps.data);
+	s->tmp = NULL;
+	s->maps.data = NULL;
+}
+
+/*
+ *  read_status()
+ *	read the process state and Vm sizes
+ *	from /proc/$PID/status into a snapshot
+ */
+static void read_status(snapshot_t *snap)
+{
+	char *buffer, *next;
+
+	*snap->state = '\0';
+	snap->nvm = 0;
+	if (proc_read(PROC_STATUS, &g.proc.buf) < 0)
+		return;
+
+	for (buffer = g.proc.buf.data; *buffer; buffer = next) {
+		vm_stat_t *vm = &snap->vm[snap->nvm];
+		char state[6];
+
+		next = strchr(buffer, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = buffer + strlen(buffer);
+
+		if (sscanf(buffer, "State: %5s %12s", state, snap->state) == 2)
+			continue;
+		if ((snap->nvm < VM_STATS_MAX) &&
+		    (sscanf(buffer, "Vm%8s %" SCNu64 "%7s",
+		     vm->name, &vm->size, vm->unit) == 3))
+			snap->nvm++;
+	}
+}
+
+/*
+ *  sample_memory()
+ *	read the memory shown in the memory view into a snapshot,
+ *	the rows are read as a batch from each row's address and
+ *	the bytes are flagged as past the end when the page they
+ *	fall in is not mapped
+ */
+static int sample_memory(snapshot_t *snap, const request_t *req)
+{
+	const int32_t xmax = req->xmax, ymax = req->ymax;
+	const size_t nbytes = (size_t)xmax * ymax;
+	index_t data_index = req->data_index;
+	uring_read_t reads[ymax];
+	uint8_t data[nbytes];
+	page_t page;
+	int32_t i;
+	int fd;
+
+	if ((fd = proc_fd(PROC_MEM)) < 0)
+		return ERR_NO_MEM_INFO;
+
+	if (nbytes > snap->bytes_size) {
+		int16_t *bytes = realloc(snap->bytes, nbytes * sizeof(*bytes));
+
+		if (!bytes)
+			return ERR_ALLOC_NOMEM;
+		snap->bytes = bytes;
+		snap->bytes_size = nbytes;
+	}
+	if ((size_t)ymax > snap->rows_size) {
+		mem_row_t *rows = realloc(snap->rows, ymax * sizeof(*rows));
+
+		if (!rows)
+			return ERR_ALLOC_NOMEM;
+		snap->rows = rows;
+		snap->rows_size = ymax;
+	}
+
+	(void)page_lookup(req->page_index, &page);
+	for (i = 0; i < ymax; i++) {
+		/* Same steps through the pages as filling in the bytes below */
+		snap->rows[i].addr = page.addr + data_index;
+		snap->rows[i].mapped = (page.map != NULL);
+		reads[i].fd = fd;
+		reads[i].buf = &data[(size_t)i * xmax];
+		/* Reading a reserved map would fault in its pages */
+		reads[i].len = (page.map && page.map->reserved) ?
+			0 : (size_t)xmax;
+		reads[i].offset = (off_t)snap->rows[i].addr;
+
+		data_index += xmax;
+		while (data_index >= g.page_size) {
+			data_index -= g.page_size;
+			(void)page_advance(&page, 1);
+		}
+	}
+	(void)read_batch(&g.uring, reads, (size_t)ymax);
+
+	data_index = req->data_index;
+	(void)page_lookup(req->page_index, &page);
+	for (i = 0; i < ymax; i++) {
+		int16_t *bytes = &snap->bytes[(size_t)i * xmax];
+		const uint8_t *buf = reads[i].buf;
+		const ssize_t nread = MAXIMUM(reads[i].ret, 0);
+		int32_t j;
+
+		for (j = 0; j < xmax; j++) {
+			if ((!page.map) ||
+			    (page.addr + data_index > g.mem_info.last_addr))
+				bytes[j] = MEM_BYTE_END;
+			else if (j >= nread)
+				bytes[j] = MEM_BYTE_FAILED;
+			else
+				bytes[j] = buf[j];
+
+			data_index++;
+			if (data_index >= g.page_size) {
+				data_index -= g.page_size;
+				(void)page_advance(&page, 1);
+			}
+		}
+	}
+
+	return OK;
+}
+
+/*
+ *  table_value()
+ *	value of a maps table column of a map in pages, or the
+ *	start of the map, -1 if not known. Page counts are those
+ *	of the last whole pass of the map, or estimates of them
+ *	with -e, in which case the error is the widest interval
+ *	half width, otherwise counts have none. Without
+ *	PAGEMAP_SCAN huge pages are the THP pages of -k, if it
+ *	is used, they are not estimated
+ */
+static int64_t table_value(const map_t *map, const int col)
+{
+	static const page_counts_t none;
+	const bool estimate = !!(g.opt_flags & OPT_FLAG_ESTIMATE);
+	const map_state_t *ms = map->state;
+	const page_counts_t *c = map->reserved ? &none :
+		((ms && ms->counted) ? &ms->counts : NULL);
+	est_value_t v[EST_FIELDS];
+	page_counts_t counts;
+	double error = 0.0;
+	uint32_t n;
+
+	if (estimate) {
+		error = est_map(map, v, &n);
+		if (error >= 0.0)
+			est_counts(v, &counts);
+		c = (error >= 0.0) ? &counts : NULL;
+	}
+
+	switch (col) {
+	case TABLE_BEGIN:
+		return (int64_t)map->begin;
+	case TABLE_SIZE:
+		return (int64_t)map_size(map);
+	case TABLE_PRESENT:
+		return c ? (int64_t)c->present : -1;
+	case TABLE_SWAPPED:
+		return c ? (int64_t)c->swapped : -1;
+	case TABLE_DIRTY:
+		return c ? (int64_t)c->dirty : -1;
+	case TABLE_FILE:
+		return c ? (int64_t)c->file : -1;
+	case TABLE_EXCLUSIVE:
+		return c ? (int64_t)c->exclusive : -1;
+	case TABLE_HUGE:
+		if (__atomic_load_n(&g.scan, __ATOMIC_RELAXED) == SCAN_OK)
+			return (c && !estimate) ? (int64_t)c->huge : -1;
+		if (g.kflags.fd >= 0)
+			return ms ? (int64_t)ms->flags.thp : 0;
+		return -1;
+	case TABLE_COLD:
+		if (g.idle.fd >= 0)
+			return ms ? (int64_t)ms->cold : 0;
+		return -1;
+	case TABLE_ERROR:
+		return c ? (int64_t)(error * 10000.0 + 0.5) : -1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ *  table_match()
+ *	does the name or attributes of a map contain filter?
+ */
+static bool table_match(const map_t *map, const char *filter)
+{
+	const char *names = g.mem_info.names.data;
+
+	return !*filter || strstr(map->attr, filter) ||
+		strstr(map_name(names, map), filter) ||
+		strstr(map_basename(names, map), filter);
+}
+
+/*
+ *  table_cmp()
+ *	compare maps table entries by the sort column
+ *	of g.table, maps that tie stay in address order
+ */
+static int table_cmp(const void *p1, const void *p2)
+{
+	const table_entry_t *e1 = (const table_entry_t *)p1;
+	const table_entry_t *e2 = (const table_entry_t *)p2;
+	const map_t *m1 = &g.mem_info.maps[e1->map];
+	const map_t *m2 = &g.mem_info.maps[e2->map];
+	int cmp;
+
+	/* Maps are in address order, so begin is left to the tie break */
+	if (g.table.sort == TABLE_BEGIN)
+		cmp = 0;
+	else if (g.table.sort == TABLE_NAME)
+		cmp = strcmp(map_basename(g.mem_info.names.data, m1),
+			map_basename(g.mem_info.names.data, m2));
+	else if (g.table.sort == TABLE_ATTR)
+		cmp = strcmp(m1->attr, m2->attr);
+	else
+		cmp = (e1->key > e2->key) - (e1->key < e2->key);
+	if (!cmp)
+		cmp = (e1->map > e2->map) - (e1->map < e2->map);
+
+	return g.table.reverse ? -cmp : cmp;
+}
+
+/*
+ *  table_sort()
+ *	filter and sort the maps for the maps table, the order
+ *	is kept until the maps, the sort column or the filter
+ *	change or it is TABLE_SORT_USECS old, so that many maps
+ *	are not sorted every frame and rows do not jump about
+ *	as the sweep counts them
+ */
+static int table_sort(table_t *t, const request_t *req)
+{
+	struct timespec now;
+	uint32_t i;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	if (t->order && (t->gen == g.mem_info.gen) &&
+	    (t->sort == req->table_sort) &&
+	    (t->reverse == req->table_reverse) &&
+	    !strcmp(t->filter, req->table_filter) &&
+	    ((((now.tv_sec - t->sorted.tv_sec) * 1000000.0) +
+	      ((now.tv_nsec - t->sorted.tv_nsec) / 1000.0)) <
+	      TABLE_SORT_USECS))
+		return OK;
+
+	if (!t->order || (g.mem_info.nmaps > t->size)) {
+		const uint32_t size = MAXIMUM(g.mem_info.nmaps, MAPS_MIN);
+		table_entry_t *order = realloc(t->order,
+			size * sizeof(*order));
+
+		if (!order)
+			return ERR_ALLOC_NOMEM;
+		t->order = order;
+		t->size = size;
+	}
+	t->gen = g.mem_info.gen;
+	t->sort = req->table_sort;
+	t->reverse = req->table_reverse;
+	(void)strcpy(t->filter, req->table_filter);
+	t->sorted = now;
+
+	t->norder = 0;
+	for (i = 0; i < g.mem_info.nmaps; i++) {
+		const map_t *map = &g.mem_info.maps[i];
+		table_entry_t *e;
+
+		if (!table_match(map, t->filter))
+			continue;
+		e = &t->order[t->norder++];
+		e->key = table_value(map, t->sort);
+		e->map = i;
+	}
+	qsort(t->order, t->norder, sizeof(*t->order), table_cmp);
+
+	return OK;
+}
+
+/*
+ *  table_top()
+ *	first of the sorted maps shown as the top row of the
+ *	maps table, the number of rows shown is put in *n
+ */
+static uint32_t table_top(const table_t *t, const request_t *req, uint32_t *n)
+{
+	const uint32_t top = MINIMUM((uint32_t)MAXIMUM(req->table_top, 0),
+		t->norder);
+
+	*n = MINIMUM((uint32_t)MAXIMUM(req->ymax, 0), t->norder - top);
+	return top;
+}
+
+/*
+ *  table_rows()
+ *	copy the rows of the maps table the UI shows into a
+ *	snapshot, their values are read afresh from the map
+ *	states every frame even when the order is kept
+ */
+static int table_rows(snapshot_t *snap, const request_t *req)
+{
+	const table_t *t = &g.table;
+	uint32_t top, n, i;
+	int rc, c;
+
+	if ((rc = table_sort(&g.table, req)) < 0)
+		return rc;
+
+	top = table_top(t, req, &n);
+	if (n > snap->table_size) {
+		table_row_t *table = realloc(snap->table,
+			n * sizeof(*table));
+
+		if (!table)
+			return ERR_ALLOC_NOMEM;
+		snap->table = table;
+		snap->table_size = n;
+	}
+	for (i = 0; i < n; i++) {
+		table_row_t *row = &snap->table[i];
+		const map_t *map = &g.mem_info.maps[t->order[top + i].map];
+
+		row->map = t->order[top + i].map;
+		for (c = 0; c < TABLE_COLS; c++)
+			row->value[c] = table_value(map, c);
+	}
+	snap->ntable = n;
+	snap->table_maps = t->norder;
+
+	return OK;
+}
+
+/*
+ *  snapshot_maps()
+ *	copy the maps and their names into a snapshot
+ *	when they have changed since the snapshot slot
+ *	was last filled
+ */
+static int snapshot_maps(snapshot_t *snap)
+{
+	const strtab_t *names = &g.mem_info.names;
+
+	if (snap->maps && (snap->gen == g.mem_info.gen))
+		goto copied;
+
+	while (g.mem_info.nmaps > snap->maps_size) {
+		if (maps_grow(&snap->maps, &snap->maps_size) < 0)
+			return ERR_ALLOC_NOMEM;
+	}
+	if (!snap->maps && (maps_grow(&snap->maps, &snap->maps_size) < 0))
+		return ERR_ALLOC_NOMEM;
+	memcpy(snap->maps, g.mem_info.maps,
+		g.mem_info.nmaps * sizeof(*snap->maps));
+
+	if (names->len > snap->names_size) {
+		char *data = realloc(snap->names, names->size);
+
+		if (!data)
+			return ERR_ALLOC_NOMEM;
+		snap->names = data;
+		snap->names_size = names->size;
+	}
+	if (names->len)
+		memcpy(snap->names, names->data, names->len);
+	snap->gen = g.mem_info.gen;
+
+copied:
+	snap->nmaps = g.mem_info.nmaps;
+	snap->npages = g.mem_info.npages;
+	snap->reserved = g.mem_info.reserved;
+	snap->last_addr = g.mem_info.last_addr;
+	snap->changes = g.mem_info.changes;
+
+	return OK;
+}
+
+/*
+ *  snapshot_hash()
+ *	hash what the UI draws from a snapshot, the
+ *	sampling statistics are left out so that an
+ *	unchanging process does not wake the UI
+ */
+static uint64_t snapshot_hash(const snapshot_t *snap)
+{
+	const request_t *req = &snap->req;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i, n = (size_t)req->xmax * req->ymax;
+	int s;
+
+	h = hash_mix(h, (uint64_t)req->page_index);
+	h = hash_mix(h, (uint64_t)req->data_index);
+	h = hash_mix(h, (uint64_t)req->cursor_index);
+	h = hash_mix(h, ((uint64_t)req->xmax << 32) | (uint32_t)req->ymax);
+	h = hash_mix(h, (uint64_t)req->zoom);
+	h = hash_mix(h, (req->view << 6) | (req->heat_view << 5) |
+		(req->wss_view << 4) | (req->tab_view << 2) |
+		(req->vm_view << 1) | req->perf_view);
+	h = hash_mix(h, snap->gen);
+
+	if (req->view == VIEW_PAGE) {
+		for (i = 0; i < n; i++) {
+			const cell_t *cell = &snap->frame.cells[i];
+
+			h = hash_mix(h, cell->addr);
+			h = hash_mix(h, cell->age);
+			for (s = 0; s < PAGE_STATE_MAX; s++)
+				h = hash_mix(h, cell->counts.state[s]);
+		}
+		h = hash_mix(h, snap->cursor_pagemap);
+		h = hash_mix(h, snap->cursor_kflags);
+		h = hash_mix(h, (uint64_t)(snap->cursor_huge * 10.0));
+	} else if (req->view == VIEW_MAPS) {
+		h = hash_mix(h, (uint64_t)req->table_top);
+		h = hash_mix(h, ((uint64_t)req->table_reverse << 8) |
+			req->table_sort);
+		h = hash_mix(h, strtab_hash(req->table_filter,
+			strlen(req->table_filter)));
+		h = hash_mix(h, snap->table_maps);
+		for (i = 0; i < snap->ntable; i++) {
+			const table_row_t *row = &snap->table[i];
+
+			h = hash_mix(h, row->map);
+			for (s = 0; s < TABLE_COLS; s++)
+				h = hash_mix(h, (uint64_t)row->value[s]);
+		}
+	} else {
+		for (i = 0; i < n; i++)
+			h = hash_mix(h, (uint16_t)snap->bytes[i]);
+		for (i = 0; i < (size_t)req->ymax; i++)
+			h = hash_mix(h, snap->rows[i].addr);
+	}
+	if (req->vm_view) {
+		h = hash_mix(h, strtab_hash(snap->state, strlen(snap->state)));
+		for (i = 0; i < snap->nvm; i++)
+			h = hash_mix(h, snap->vm[i].size);
+		h = hash_mix(h, snap->minor);
+		h = hash_mix(h, snap->major);
+		h = hash_mix(h, snap->score);
+		h = hash_mix(h, snap->dirty.resets);
+		h = hash_mix(h, snap->idle_rounds);
+		h = hash_mix(h, snap->damon.updates);
+		h = hash_mix(h, snap->damon.state);
+		h = hash_mix(h, g.kflags.rounds);
+		h = hash_mix(h, g.kcount.rounds);
+		h = hash_mix(h, snap->share.rounds);
+		h = hash_mix(h, (uint64_t)(snap->huge * 10.0));
+		h = hash_mix(h, snap->est_sampled);
+		for (s = 0; s < EST_FIELDS; s++)
+			h = hash_mix(h, (uint64_t)snap->est[s].hi);
+		for (s = 0; s < PAGE_STATE_MAX; s++)
+			h = hash_mix(h, snap->counts.state[s]);
+	}
+	if (req->wss_view) {
+		h = hash_mix(h, snap->dirty.resets);
+		for (i = 0; i < snap->nwss; i++)
+			h = hash_mix(h, snap->wss[i].pages);
+	}
+#if defined(PERF_ENABLED)
+	if (req->perf_view) {
+		for (s = 0; s < PERF_MAX; s++)
+			h = hash_mix(h, snap->perf[s]);
+	}
+#endif
+	return h;
+}
+
+/*
+ *  sampler_publish()
+ *	make the back snapshot the latest one,
+ *	and wake the UI if it needs redrawing
+ */
+static void sampler_publish(sampler_t *s, const bool notify)
+{
+	s->back = __atomic_exchange_n(&s->latest, s->back | SNAP_FRESH,
+		__ATOMIC_ACQ_REL) & SNAP_INDEX_MASK;
+	if (notify) {
+		const uint64_t one = 1;
+		const ssize_t ret = write(s->notifyfd, &one, sizeof(one));
+
+		(void)ret;
+	}
+}
+
+/*
+ *  sampler_take()
+ *	get the latest snapshot for the UI, NULL
+ *	if none has been published yet
+ */
+static const snapshot_t *sampler_take(sampler_t *s)
+{
+	if (__atomic_load_n(&s->latest, __ATOMIC_ACQUIRE) & SNAP_FRESH) {
+		s->front = __atomic_exchange_n(&s->latest, s->front,
+			__ATOMIC_ACQ_REL) & SNAP_INDEX_MASK;
+		s->taken = true;
+	}
+	return s->taken ? &s->snaps[s->front] : NULL;
+}
 
-	offset = sizeof(pagemap_t) *
-		(g.mem_info.pages[index].addr / g.page_size);
-	if (lseek(fd, offset, SEEK_SET) == (off_t)-1)
-		return;
-	if (read(fd, &pagemap_info, sizeof(pagemap_info)) != sizeof(pagemap_info))
-		return;
+/*
+ *  sampler_post()
+ *	post the view the UI wants sampled, waking
+ *	the sampler if it has changed
+ */
+static void sampler_post(sampler_t *s, const request_t *req)
+{
+	bool changed = false;
 
-	mvwprintw(g.mainwin, 9, x,
-		" Flag:      0x%16.16" PRIx64 "%18s", pagemap_info, "");
-	if (pagemap_info & PAGE_SWAPPED) {
-		mvwprintw(g.mainwin, 10, x,
-			"   Swap Type:           0x%2.2" PRIx64 "%20s",
-			pagemap_info & 0x1f, "");
-		mvwprintw(g.mainwin, 11, x,
-			"   Swap Offset:         0x%16.16" PRIx64 "%6s",
-			(pagemap_info & 0x00ffffffffffffffULL) >> 5, "");
+	(void)pthread_mutex_lock(&s->lock);
+	if (memcmp(&s->req, req, sizeof(*req))) {
+		s->req = *req;
+		changed = true;
+	}
+	(void)pthread_mutex_unlock(&s->lock);
+
+	if (changed) {
+		const uint64_t one = 1;
+		const ssize_t ret = write(s->wakefd, &one, sizeof(one));
+
+		(void)ret;
+	}
+}
+
+/*
+ *  sampler_step()
+ *	sample the process for a request into the
+ *	back snapshot and publish it, maps are only
+ *	re-read and dirty bits cleared on timed
+ *	samples, not on those woken by a request
+ */
+static int sampler_step(
+	sampler_t *s,
+	const request_t *req,
+	const bool tick)
+{
+	snapshot_t *snap = &s->snaps[s->back];
+	page_counts_t counts;
+	page_t page;
+	uint64_t hash;
+	size_t i;
+	int rc;
+
+	if (tick) {
+		if (!s->tick && (req->view != VIEW_MEM)) {
+			if ((rc = read_maps(false)) < 0)
+				return rc;
+		}
+		if (g.opt_flags & OPT_FLAG_READ_ALL_PAGES) {
+			(void)read_all_pages();
+			g.opt_flags &= ~OPT_FLAG_READ_ALL_PAGES;
+		}
+		if (!s->tick) {
+			/*
+			 *  The maps table covers the whole process, a
+			 *  budget of it a round, and its visible pages
+			 *  are those of the maps of its rows
+			 */
+			const bool all = (req->view == VIEW_MAPS);
+			const index_t lo = all ? 0 : req->page_index;
+			const index_t visible = all ?
+				(index_t)g.mem_info.npages :
+				(index_t)req->xmax * req->ymax * req->zoom;
+			const table_entry_t *rows = NULL;
+			uint32_t nrows = 0;
+
+			if (all) {
+				if ((rc = table_sort(&g.table, req)) < 0)
+					return rc;
+				rows = &g.table.order[table_top(&g.table,
+					req, &nrows)];
+			}
+			dirty_reset(&g.dirty, lo, visible, rows, nrows);
+			pfns_round(&g.pfns, lo, visible, TABLE_SWEEP_MAX);
+			share_round(&g.share);
+			damon_update(&g.damon);
+		}
+		s->tick++;
+		if (s->tick > req->ticks)
+			s->tick = 0;
+	}
+	if (req->read_all != s->read_all) {
+		(void)read_all_pages();
+		s->read_all = req->read_all;
+	}
+	if ((rc = snapshot_maps(snap)) < 0)
+		return rc;
+
+	if (req->view == VIEW_PAGE) {
+		const size_t ncells = (size_t)req->xmax * req->ymax;
+
+		if ((rc = sample_frame(&g.sample, req->page_index,
+		    (index_t)ncells * req->zoom)) < 0)
+			return rc;
+		if ((rc = frame_cells(&snap->frame, req->page_index,
+		    ncells, req->zoom, req->heat_view)) < 0)
+			return rc;
+		/* Point the cells at the snapshot's copy of the maps */
+		for (i = 0; i < ncells; i++) {
+			cell_t *cell = &snap->frame.cells[i];
+
+			if (cell->map)
+				cell->map = snap->maps +
+					(cell->map - g.mem_info.maps);
+		}
+		snap->nwords = g.sample.nwords;
+		snap->syscalls = g.sample.syscalls;
+		snap->usecs = g.sample.usecs;
+		snap->io = io_backend();
+		snap->scan = scan_backend();
+		snap->cursor_pagemap = 0;
+		snap->cursor_kflags_valid = false;
+		snap->cursor_huge = -1.0;
+		if (req->tab_view && page_lookup(req->cursor_index, &page)) {
+			const map_state_t *ms = page.map->state;
+
+			if (ms)
+				snap->cursor_huge = huge_coverage(ms->counted ?
+					&ms->counts : &ms->pass, &ms->flags);
+			snap->cursor_pagemap = read_pagemap(&page);
+			if ((snap->cursor_pagemap & PAGE_PRESENT) &&
+			    (snap->cursor_pagemap & PAGE_PFN_MASK))
+				snap->cursor_kflags_valid = !kpage_read(
+					&g.kflags,
+					snap->cursor_pagemap & PAGE_PFN_MASK,
+					&snap->cursor_kflags);
+		}
+	} else if (req->view == VIEW_MAPS) {
+		/* One sweep or round of estimates counts every row */
+		if ((g.opt_flags & OPT_FLAG_ESTIMATE) ?
+		    ((rc = est_round(&g.est, &g.sample)) < 0) :
+		    ((rc = sample_sweep(&g.sample, TABLE_SWEEP_MAX)) < 0))
+			return rc;
+		if ((rc = table_rows(snap, req)) < 0)
+			return rc;
+		snap->nwords = g.sample.nwords;
+		snap->syscalls = g.sample.syscalls;
+		snap->usecs = g.sample.usecs;
+		snap->io = io_backend();
+		snap->scan = scan_backend();
 	} else {
-		mvwprintw(g.mainwin, 10, x, "%48s", "");
-		mvwprintw(g.mainwin, 11, x,
-			"   Page Frame Number:   0x%16.16" PRIx64 "%6s",
-			pagemap_info & 0x00ffffffffffffffULL, "");
+		if ((rc = sample_memory(snap, req)) < 0)
+			return rc;
 	}
-	mvwprintw(g.mainwin, 12, x,
-		"   Soft-dirty PTE:      %3s%21s",
-		(pagemap_info & PAGE_PTE_SOFT_DIRTY) ? "Yes" : "No ", "");
-	mvwprintw(g.mainwin, 13, x,
-		"   Exclusively Mapped:  %3s%21s",
-		(pagemap_info & PAGE_EXCLUSIVE_MAPPED) ? "Yes" : "No ", "");
-	mvwprintw(g.mainwin, 14, x,
-		"   File or Shared Anon: %3s%21s",
-		(pagemap_info & PAGE_FILE_SHARED_ANON) ? "Yes" : "No ", "");
-	mvwprintw(g.mainwin, 15, x,
-		"   Present in Swap:     %3s%21s",
-		(pagemap_info & PAGE_SWAPPED) ? "Yes" : "No ", "");
-	mvwprintw(g.mainwin, 16, x,
-		"   Present in RAM:      %3s%21s",
-		(pagemap_info & PAGE_PRESENT) ? "Yes" : "No ", "");
+
+	if (req->vm_view) {
+		read_status(snap);
+		snap->faults_valid = !read_faults(&snap->minor, &snap->major);
+		snap->score_valid = !read_oom_score(&snap->score);
+		mem_counts(&snap->counts);
+		snap->dirty = g.dirty;
+		snap->idle_valid = !!(g.opt_flags & OPT_FLAG_IDLE);
+		snap->idle_rounds = g.idle.rounds;
+		snap->idle_pages = g.idle.pages;
+		snap->idle_cold = idle_cold();
+		snap->damon = g.damon;
+		snap->kflags_valid = !!(g.opt_flags & OPT_FLAG_KFLAGS);
+		snap->pfns = g.pfns.distinct;
+		kflags_total(&snap->kflags_counts);
+		(void)mem_passes(&counts);
+		snap->huge = huge_coverage(&counts, &snap->kflags_counts);
+		snap->kcount_valid = !!(g.opt_flags & OPT_FLAG_KCOUNT);
+		kcount_total(&snap->kcount_counts);
+		snap->share = g.share.matrix;
+		/* Estimates are only made by the maps view */
+		snap->est_valid = (req->view == VIEW_MAPS) &&
+			(g.opt_flags & OPT_FLAG_ESTIMATE);
+		if (snap->est_valid)
+			snap->est_unsampled = est_total(snap->est,
+				&snap->est_sampled);
+	}
+	if (req->wss_view) {
+		snap->dirty = g.dirty;
+		snap->nwss = g.wss.nwindows;
+		memcpy(snap->wss, g.wss.windows,
+			sizeof(*snap->wss) * snap->nwss);
+	}
+#if defined(PERF_ENABLED)
+	if (req->perf_view) {
+		/* Don't hammer perf to death */
+		if (++s->perf_ticker > PERF_TICKS) {
+			perf_stop(&g.perf);
+			perf_start(&g.perf, g.pid);
+			s->perf_ticker = 0;
+		}
+		for (i = 0; i < PERF_MAX; i++)
+			snap->perf[i] = perf_counter(&g.perf, i);
+	}
+#endif
+	snap->req = *req;
+	snap->rc = OK;
+	hash = snapshot_hash(snap);
+	sampler_publish(s, hash != s->hash);
+	s->hash = hash;
+
+	return OK;
 }
 
 /*
- *  banner()
- *	clear a banner across the window
+ *  epoll_add()
+ *	wait for input on fd with epoll
  */
-static inline void banner(const int y)
+static int epoll_add(const int epfd, const int fd)
 {
-	mvwprintw(g.mainwin, y, 0, "%*s", COLS, "");
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ *  timer_open()
+ *	open a timerfd that first expires after delay
+ *	microseconds and then every period microseconds
+ */
+static int timer_open(const useconds_t delay, const useconds_t period)
+{
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/* A zero delay or period would disarm the timer */
+	its.it_value.tv_sec = delay / 1000000;
+	its.it_value.tv_nsec = MAXIMUM(delay % 1000000, 1) * 1000;
+	its.it_interval.tv_sec = period / 1000000;
+	its.it_interval.tv_nsec = MAXIMUM(period % 1000000, 1) * 1000;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		(void)close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ *  sampler_init()
+ *	mark the sampler's file descriptors as closed
+ */
+static void sampler_init(sampler_t *s)
+{
+	s->epfd = -1;
+	s->timerfd = -1;
+	s->wakefd = -1;
+	s->notifyfd = -1;
+}
+
+/*
+ *  sampler_loop()
+ *	sample on every expiry of the sampling timer, or
+ *	straight away when the UI posts a new request,
+ *	until told to quit or sampling fails
+ */
+static int sampler_loop(sampler_t *s)
+{
+	for (;;) {
+		struct epoll_event events[EVENTS_MAX];
+		request_t req;
+		bool quit, tick = false;
+		int i, n, rc;
+
+		n = epoll_wait(s->epfd, events, EVENTS_MAX, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERR_NO_EVENTS;
+		}
+		for (i = 0; i < n; i++) {
+			const int fd = events[i].data.fd;
+			uint64_t count;
+
+			if ((read(fd, &count, sizeof(count)) == sizeof(count)) &&
+			    (fd == s->timerfd))
+				tick = true;
+		}
+
+		(void)pthread_mutex_lock(&s->lock);
+		quit = s->quit;
+		req = s->req;
+		(void)pthread_mutex_unlock(&s->lock);
+		if (quit)
+			return OK;
+
+		if ((rc = sampler_step(s, &req, tick)) < 0)
+			return rc;
+	}
+}
+
+/*
+ *  sampler_thread()
+ *	sampler thread, lets the UI know
+ *	if and why sampling stopped
+ */
+static void *sampler_thread(void *arg)
+{
+	sampler_t *s = (sampler_t *)arg;
+	int rc;
+
+	if (sigsetjmp(s->env, 1)) {
+		rc = ERR_FAULT;
+	} else {
+#if defined(PERF_ENABLED)
+		perf_start(&g.perf, g.pid);
+#endif
+		rc = sampler_loop(s);
+	}
+	if (rc < 0) {
+		s->snaps[s->back].rc = rc;
+		sampler_publish(s, true);
+	}
+
+	return NULL;
+}
+
+/*
+ *  sampler_start()
+ *	start the sampler thread on an initial request,
+ *	the first sample is taken straight away
+ */
+static int sampler_start(
+	sampler_t *s,
+	const request_t *req,
+	const useconds_t udelay)
+{
+	s->req = *req;
+	s->udelay = udelay;
+	s->back = 0;
+	s->latest = 1;
+	s->front = 2;
+
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	s->timerfd = timer_open(0, udelay);
+	s->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	s->notifyfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((s->epfd < 0) || (s->timerfd < 0) ||
+	    (s->wakefd < 0) || (s->notifyfd < 0) ||
+	    (epoll_add(s->epfd, s->timerfd) < 0) ||
+	    (epoll_add(s->epfd, s->wakefd) < 0))
+		return ERR_NO_EVENTS;
+
+	(void)pthread_mutex_init(&s->lock, NULL);
+	s->running = true;
+	if (pthread_create(&s->thread, NULL, sampler_thread, s)) {
+		s->running = false;
+		return ERR_NO_THREAD;
+	}
+	return OK;
+}
+
+/*
+ *  sampler_stop()
+ *	tell the sampler thread to quit and wait for it
+ */
+static void sampler_stop(sampler_t *s)
+{
+	const uint64_t one = 1;
+	ssize_t ret;
+
+	if (!s->running)
+		return;
+
+	(void)pthread_mutex_lock(&s->lock);
+	s->quit = true;
+	(void)pthread_mutex_unlock(&s->lock);
+	ret = write(s->wakefd, &one, sizeof(one));
+	(void)ret;
+	(void)pthread_join(s->thread, NULL);
+	s->running = false;
+}
+
+/*
+ *  ui_init()
+ *	mark the UI's file descriptors as closed
+ */
+static void ui_init(ui_t *ui)
+{
+	ui->epfd = -1;
+	ui->sigfd = -1;
+	ui->blinkfd = -1;
+}
+
+/*
+ *  ui_open()
+ *	set up the UI's events, the resize and termination
+ *	signals are blocked and read from a signalfd instead,
+ *	this has to be done before any threads are created
+ *	so that they inherit the blocked signals
+ */
+static int ui_open(ui_t *ui)
+{
+	sigset_t set;
+
+	(void)sigemptyset(&set);
+	(void)sigaddset(&set, SIGWINCH);
+	(void)sigaddset(&set, SIGTERM);
+	(void)sigaddset(&set, SIGINT);
+	(void)sigaddset(&set, SIGHUP);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+		return ERR_NO_EVENTS;
+
+	ui->epfd = epoll_create1(EPOLL_CLOEXEC);
+	ui->sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	ui->blinkfd = timer_open(BLINK_USECS, BLINK_USECS);
+	if ((ui->epfd < 0) || (ui->sigfd < 0) || (ui->blinkfd < 0) ||
+	    (epoll_add(ui->epfd, STDIN_FILENO) < 0) ||
+	    (epoll_add(ui->epfd, ui->sigfd) < 0) ||
+	    (epoll_add(ui->epfd, ui->blinkfd) < 0))
+		return ERR_NO_EVENTS;
+
+	return OK;
+}
+
+/*
+ *  ui_wait()
+ *	wait for a key press, a signal, the blink
+ *	timer or a snapshot that needs drawing
+ */
+static int ui_wait(ui_t *ui, int32_t *blink)
+{
+	struct epoll_event events[EVENTS_MAX];
+	int i, n;
+
+	n = epoll_wait(ui->epfd, events, EVENTS_MAX, -1);
+	if (n < 0)
+		return (errno == EINTR) ? OK : ERR_NO_EVENTS;
+
+	for (i = 0; i < n; i++) {
+		const int fd = events[i].data.fd;
+		struct signalfd_siginfo info;
+		uint64_t count;
+
+		if (fd == ui->sigfd) {
+			while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+				if (info.ssi_signo == SIGWINCH)
+					g.resized = true;
+				else
+					g.terminate = true;
+			}
+		} else if (fd == ui->blinkfd) {
+			if (read(fd, &count, sizeof(count)) == sizeof(count))
+				*blink += BLINK_MASK;
+		} else if (fd != STDIN_FILENO) {
+			/* Snapshot notification, stdin is read by getch() */
+			if (read(fd, &count, sizeof(count)) < 0)
+				continue;
+		}
+	}
+	return OK;
+}
+
+/*
+ *  ui_close()
+ *	close the UI's events
+ */
+static void ui_close(ui_t *ui)
+{
+	fd_close(&ui->epfd);
+	fd_close(&ui->sigfd);
+	fd_close(&ui->blinkfd);
+}
+
+/*
+ *  sampler_free()
+ *	free the snapshots of a stopped sampler
+ */
+static void sampler_free(sampler_t *s)
+{
+	size_t i;
+
+	for (i = 0; i < SNAP_SLOTS; i++) {
+		snapshot_t *snap = &s->snaps[i];
+
+		free(snap->maps);
+		free(snap->names);
+		free(snap->bytes);
+		free(snap->rows);
+		free(snap->table);
+		frame_free(&snap->frame);
+	}
+	memset(s->snaps, 0, sizeof(s->snaps));
+
+	fd_close(&s->epfd);
+	fd_close(&s->timerfd);
+	fd_close(&s->wakefd);
+	fd_close(&s->notifyfd);
+}
+
+/*
+ *  buf_printf()
+ *	append formatted text to a buffer, growing it as needed
+ */
+static int buf_printf(buf_t *buf, const char *fmt, ...)
+{
+	for (;;) {
+		const size_t avail = buf->size - buf->len;
+		size_t size;
+		va_list ap;
+		char *data;
+		int n;
+
+		va_start(ap, fmt);
+		n = vsnprintf(buf->data ? buf->data + buf->len : NULL,
+			avail, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return -1;
+		if ((size_t)n < avail) {
+			buf->len += n;
+			return 0;
+		}
+
+		size = buf->size ? buf->size : BUF_SIZE_MIN;
+		while (size - buf->len <= (size_t)n)
+			size *= 2;
+		data = realloc(buf->data, size);
+		if (!data)
+			return -1;
+		buf->data = data;
+		buf->size = size;
+	}
+}
+
+/*
+ *  buf_json_str()
+ *	append a string to a buffer as a JSON string
+ */
+static int buf_json_str(buf_t *buf, const char *str)
+{
+	if (buf_printf(buf, "\"") < 0)
+		return -1;
+	while (*str) {
+		size_t n;
+
+		/* Copy runs of characters that need no escaping in one go */
+		for (n = 0; str[n] && (str[n] != '"') && (str[n] != '\\') &&
+		     ((unsigned char)str[n] >= 0x20); n++)
+			;
+		if (n) {
+			if (buf_printf(buf, "%.*s", (int)n, str) < 0)
+				return -1;
+			str += n;
+			continue;
+		}
+		if ((*str == '"') || (*str == '\\')) {
+			if (buf_printf(buf, "\\%c", *str) < 0)
+				return -1;
+		} else {
+			if (buf_printf(buf, "\\u%04x", (unsigned char)*str) < 0)
+				return -1;
+		}
+		str++;
+	}
+	return buf_printf(buf, "\"");
+}
+
+/*
+ *  buf_csv_str()
+ *	append a string to a buffer as a quoted CSV field
+ */
+static int buf_csv_str(buf_t *buf, const char *str)
+{
+	if (buf_printf(buf, "\"") < 0)
+		return -1;
+	while (*str) {
+		const char *quote = strchr(str, '"');
+		const size_t n = quote ? (size_t)(quote - str) + 1 : strlen(str);
+
+		/* Quotes are doubled up */
+		if (buf_printf(buf, "%.*s%s", (int)n, str, quote ? "\"" : "") < 0)
+			return -1;
+		str += n;
+	}
+	return buf_printf(buf, "\"");
+}
+
+/*
+ *  batch_init()
+ *	mark the batch mode file descriptors as closed
+ */
+static void batch_init(batch_t *b)
+{
+	b->epfd = -1;
+	b->sigfd = -1;
+	b->timerfd = -1;
+}
+
+/*
+ *  batch_counts()
+ *	append the page counts fields of a record, cold is
+ *	left out when idle pages are not tracked and accessed
+ *	when DAMON is not monitoring the process
+ */
+static int batch_counts(
+	batch_t *b,
+	const index_t mapped,
+	const page_counts_t *counts,
+	const index_t unsampled,
+	const uint64_t written,
+	const int64_t cold,
+	const int64_t accessed)
+{
+	if (b->format == BATCH_CSV) {
+		if (buf_printf(&b->out, ",%" PRIi64 ",%" PRIu64
+		    ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		    ",%" PRIu64 ",%" PRIi64 ",%" PRIu64, mapped,
+		    counts->present, counts->swapped, counts->dirty,
+		    counts->file, counts->exclusive, counts->huge,
+		    unsampled, written) < 0)
+			return -1;
+		if (((cold < 0) ? buf_printf(&b->out, ",") :
+		     buf_printf(&b->out, ",%" PRIi64, cold)) < 0)
+			return -1;
+		return (accessed < 0) ? buf_printf(&b->out, ",") :
+			buf_printf(&b->out, ",%" PRIi64, accessed);
+	}
+
+	if (buf_printf(&b->out, ",\"mapped\":%" PRIi64
+	    ",\"present\":%" PRIu64 ",\"swapped\":%" PRIu64
+	    ",\"dirty\":%" PRIu64 ",\"file\":%" PRIu64
+	    ",\"exclusive\":%" PRIu64 ",\"huge\":%" PRIu64
+	    ",\"unsampled\":%" PRIi64 ",\"written\":%" PRIu64,
+	    mapped, counts->present, counts->swapped, counts->dirty,
+	    counts->file, counts->exclusive, counts->huge, unsampled,
+	    written) < 0)
+		return -1;
+	if ((cold >= 0) &&
+	    (buf_printf(&b->out, ",\"cold\":%" PRIi64, cold) < 0))
+		return -1;
+	return (accessed < 0) ? 0 :
+		buf_printf(&b->out, ",\"accessed\":%" PRIi64, accessed);
+}
+
+/*
+ *  batch_est()
+ *	append the estimate fields of a record, the pages
+ *	sampled and the bounds of the 95% confidence intervals
+ *	of the estimated page counts, left out when page counts
+ *	are not estimated and empty when none are sampled yet
+ */
+static int batch_est(batch_t *b, const est_value_t *v, const uint64_t sampled)
+{
+	if (!(g.opt_flags & OPT_FLAG_ESTIMATE))
+		return 0;
+
+	if (b->format == BATCH_CSV) {
+		if (!v)
+			return buf_printf(&b->out, ",0,,,,,,,,,");
+		return buf_printf(&b->out, ",%" PRIu64
+		    ",%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f", sampled,
+		    floor(v[EST_PRESENT].lo), ceil(v[EST_PRESENT].hi),
+		    floor(v[EST_SWAPPED].lo), ceil(v[EST_SWAPPED].hi),
+		    floor(v[EST_DIRTY].lo), ceil(v[EST_DIRTY].hi),
+		    floor(v[EST_SHARED].pages + 0.5),
+		    floor(v[EST_SHARED].lo), ceil(v[EST_SHARED].hi));
+	}
+
+	if (!v)
+		return buf_printf(&b->out, ",\"est_sampled\":0");
+	return buf_printf(&b->out, ",\"est_sampled\":%" PRIu64
+	    ",\"est_present_lo\":%.0f,\"est_present_hi\":%.0f"
+	    ",\"est_swapped_lo\":%.0f,\"est_swapped_hi\":%.0f"
+	    ",\"est_dirty_lo\":%.0f,\"est_dirty_hi\":%.0f"
+	    ",\"est_shared\":%.0f"
+	    ",\"est_shared_lo\":%.0f,\"est_shared_hi\":%.0f", sampled,
+	    floor(v[EST_PRESENT].lo), ceil(v[EST_PRESENT].hi),
+	    floor(v[EST_SWAPPED].lo), ceil(v[EST_SWAPPED].hi),
+	    floor(v[EST_DIRTY].lo), ceil(v[EST_DIRTY].hi),
+	    floor(v[EST_SHARED].pages + 0.5),
+	    floor(v[EST_SHARED].lo), ceil(v[EST_SHARED].hi));
+}
+
+/*
+ *  batch_flags()
+ *	append the kernel page flags fields of a record,
+ *	left out when kernel page flags are not read
+ */
+static int batch_flags(batch_t *b, const kflags_counts_t *c)
+{
+	if (b->format == BATCH_CSV) {
+		if (!c)
+			return buf_printf(&b->out, ",,,,,,,,,,,");
+		return buf_printf(&b->out, ",%" PRIu64 ",%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+			",%" PRIu64, c->pages, c->thp, c->active,
+			c->inactive, c->unevictable, c->ksm, c->zero,
+			c->mmap, c->anon, c->dirty, c->writeback);
+	}
+	if (!c)
+		return 0;
+	return buf_printf(&b->out, ",\"flags_pages\":%" PRIu64
+		",\"thp\":%" PRIu64 ",\"lru_active\":%" PRIu64
+		",\"lru_inactive\":%" PRIu64 ",\"unevictable\":%" PRIu64
+		",\"ksm\":%" PRIu64 ",\"zero_page\":%" PRIu64
+		",\"mmap\":%" PRIu64 ",\"anon\":%" PRIu64
+		",\"page_dirty\":%" PRIu64 ",\"writeback\":%" PRIu64,
+		c->pages, c->thp, c->active, c->inactive, c->unevictable,
+		c->ksm, c->zero, c->mmap, c->anon, c->dirty, c->writeback);
+}
+
+/*
+ *  batch_share()
+ *	append the map count fields of a record,
+ *	left out when map counts are not read
+ */
+static int batch_share(batch_t *b, const kcount_counts_t *c)
+{
+	const double pss = c ? (double)c->pss / (1ULL << PSS_SHIFT) : 0.0;
+
+	if (b->format == BATCH_CSV) {
+		if (!c)
+			return buf_printf(&b->out, ",,,");
+		return buf_printf(&b->out, ",%" PRIu64 ",%.1f,%" PRIu64,
+			c->uss, pss, c->shared);
+	}
+	if (!c)
+		return 0;
+	return buf_printf(&b->out, ",\"uss\":%" PRIu64 ",\"pss\":%.1f"
+		",\"shared\":%" PRIu64, c->uss, pss, c->shared);
+}
+
+/*
+ *  batch_sharing()
+ *	append the sharing matrix record, JSON only as the
+ *	matrix does not fit the columns of the CSV records
+ */
+static int batch_sharing(batch_t *b, const struct timespec *now)
+{
+	const share_matrix_t *m = &g.share.matrix;
+	uint32_t i, j;
+
+	if ((b->format != BATCH_JSON) || (m->nprocs < 2) || !m->rounds)
+		return 0;
+	if (buf_printf(&b->out, "{\"time\":%ld.%06ld,\"pid\":%d,"
+	    "\"type\":\"sharing\",\"pids\":[", (long)now->tv_sec,
+	    now->tv_nsec / 1000, g.pid) < 0)
+		return -1;
+	for (i = 0; i < m->nprocs; i++)
+		if (buf_printf(&b->out, "%s%d", i ? "," : "", m->pids[i]) < 0)
+			return -1;
+	if (buf_printf(&b->out, "],\"shared\":[") < 0)
+		return -1;
+	for (i = 0; i < m->nprocs; i++) {
+		for (j = 0; j < m->nprocs; j++)
+			if (buf_printf(&b->out, "%s%" PRIu64,
+			    j ? "," : (i ? ",[" : "["), m->shared[i][j]) < 0)
+				return -1;
+		if (buf_printf(&b->out, "]") < 0)
+			return -1;
+	}
+	return buf_printf(&b->out, "]}\n");
+}
+
+/*
+ *  batch_header()
+ *	append the CSV header, the Vm columns are
+ *	those of the first read of the process status
+ */
+static int batch_header(batch_t *b)
+{
+	uint32_t i;
+
+	if (buf_printf(&b->out, "time,pid,type,page_size,maps,begin,end,"
+	    "attr,dev,inode,name,mapped,present,swapped,dirty,file,"
+	    "exclusive,huge,unsampled,written,cold,accessed,flags_pages,thp,"
+	    "lru_active,lru_inactive,unevictable,ksm,zero_page,mmap,anon,"
+	    "page_dirty,writeback,uss,pss,shared,minor_faults,major_faults,"
+	    "dirty_tracking,tracking_faults,io,scan,"
+	    "sweep_words,sweep_reads,sweep_usecs") < 0)
+		return -1;
+	if ((g.opt_flags & OPT_FLAG_ESTIMATE) &&
+	    (buf_printf(&b->out, ",est_sampled,est_present_lo,"
+	     "est_present_hi,est_swapped_lo,est_swapped_hi,est_dirty_lo,"
+	     "est_dirty_hi,est_shared,est_shared_lo,est_shared_hi") < 0))
+		return -1;
+	for (i = 0; i < g.wss.nwindows; i++)
+		if (buf_printf(&b->out, ",wss_%" PRIu32 "s",
+		    g.wss.windows[i].secs) < 0)
+			return -1;
+
+	b->nvm = b->snap.nvm;
+	for (i = 0; i < b->nvm; i++) {
+		b->vm[i] = b->snap.vm[i];
+		if (buf_printf(&b->out, ",Vm%.*s",
+		    (int)strcspn(b->vm[i].name, ":"), b->vm[i].name) < 0)
+			return -1;
+	}
+	return buf_printf(&b->out, "\n");
+}
+
+/*
+ *  batch_process()
+ *	append the record of the whole process, the pages of
+ *	maps that have not been counted yet are unsampled.
+ *	With -e the page counts are the estimates of them.
+ */
+static int batch_process(batch_t *b, const struct timespec *now)
+{
+	const snapshot_t *snap = &b->snap;
+	page_counts_t counts;
+	kflags_counts_t flags;
+	kcount_counts_t share;
+	est_value_t v[EST_FIELDS];
+	uint64_t sampled = 0;
+	index_t unsampled;
+	uint32_t i, j;
+
+	if (g.opt_flags & OPT_FLAG_ESTIMATE) {
+		unsampled = est_total(v, &sampled);
+		est_counts(v, &counts);
+	} else {
+		unsampled = mem_passes(&counts);
+	}
+	kflags_total(&flags);
+	kcount_total(&share);
+
+	if (b->format == BATCH_CSV) {
+		if (buf_printf(&b->out, "%ld.%06ld,%d,process,%" PRIu32
+		    ",%" PRIu32 ",,,,,,", (long)now->tv_sec,
+		    now->tv_nsec / 1000, g.pid, g.page_size,
+		    g.mem_info.nmaps) < 0)
+			return -1;
+		if (batch_counts(b, (index_t)g.mem_info.mapped,
+		    &counts, unsampled, g.wss.written,
+		    (g.idle.fd < 0) ? -1 : (int64_t)idle_cold(),
+		    g.damon.updates ? (int64_t)g.damon.accessed : -1) < 0)
+			return -1;
+		if (batch_flags(b, (g.kflags.fd < 0) ? NULL : &flags) < 0)
+			return -1;
+		if (batch_share(b, (g.kcount.fd < 0) ? NULL : &share) < 0)
+			return -1;
+		if ((snap->faults_valid ?
+		     buf_printf(&b->out, ",%" PRIu64 ",%" PRIu64,
+			snap->minor, snap->major) :
+		     buf_printf(&b->out, ",,")) < 0)
+			return -1;
+		if (buf_printf(&b->out, ",%s,%" PRIu64,
+		    dirty_name(g.dirty.mode), g.dirty.written) < 0)
+			return -1;
+		if (buf_printf(&b->out, ",%s,%s,%zu,%" PRIu32 ",%.1f",
+		    io_backend(), scan_backend(), g.sample.nwords, g.sample.syscalls,
+		    g.sample.usecs) < 0)
+			return -1;
+		if (batch_est(b, v, sampled) < 0)
+			return -1;
+		for (i = 0; i < g.wss.nwindows; i++)
+			if (buf_printf(&b->out, ",%" PRIu64,
+			    g.wss.windows[i].pages) < 0)
+				return -1;
+		for (i = 0; i < b->nvm; i++) {
+			for (j = 0; j < snap->nvm; j++)
+				if (!strcmp(snap->vm[j].name, b->vm[i].name))
+					break;
+			if ((j < snap->nvm ?
+			     buf_printf(&b->out, ",%" PRIu64, snap->vm[j].size) :
+			     buf_printf(&b->out, ",")) < 0)
+				return -1;
+		}
+		return buf_printf(&b->out, "\n");
+	}
+
+	if (buf_printf(&b->out, "{\"time\":%ld.%06ld,\"pid\":%d,"
+	    "\"type\":\"process\",\"page_size\":%" PRIu32
+	    ",\"maps\":%" PRIu32, (long)now->tv_sec, now->tv_nsec / 1000,
+	    g.pid, g.page_size, g.mem_info.nmaps) < 0)
+		return -1;
+	if (batch_counts(b, (index_t)g.mem_info.mapped,
+	    &counts, unsampled, g.wss.written,
+	    (g.idle.fd < 0) ? -1 : (int64_t)idle_cold(),
+	    g.damon.updates ? (int64_t)g.damon.accessed : -1) < 0)
+		return -1;
+	if (batch_flags(b, (g.kflags.fd < 0) ? NULL : &flags) < 0)
+		return -1;
+	if (batch_share(b, (g.kcount.fd < 0) ? NULL : &share) < 0)
+		return -1;
+	if (snap->faults_valid &&
+	    (buf_printf(&b->out, ",\"minor_faults\":%" PRIu64
+	     ",\"major_faults\":%" PRIu64, snap->minor, snap->major) < 0))
+		return -1;
+	if (buf_printf(&b->out, ",\"dirty_tracking\":\"%s\""
+	    ",\"tracking_faults\":%" PRIu64,
+	    dirty_name(g.dirty.mode), g.dirty.written) < 0)
+		return -1;
+	if (buf_printf(&b->out, ",\"io\":\"%s\",\"scan\":\"%s\""
+	    ",\"sweep_words\":%zu,\"sweep_reads\":%" PRIu32
+	    ",\"sweep_usecs\":%.1f",
+	    io_backend(), scan_backend(), g.sample.nwords, g.sample.syscalls,
+	    g.sample.usecs) < 0)
+		return -1;
+	if (batch_est(b, v, sampled) < 0)
+		return -1;
+	for (i = 0; i < g.wss.nwindows; i++)
+		if (buf_printf(&b->out, ",\"wss_%" PRIu32 "s\":%" PRIu64,
+		    g.wss.windows[i].secs, g.wss.windows[i].pages) < 0)
+			return -1;
+	for (i = 0; i < snap->nvm; i++) {
+		if (buf_printf(&b->out, ",\"Vm%.*s\":%" PRIu64,
+		    (int)strcspn(snap->vm[i].name, ":"), snap->vm[i].name,
+		    snap->vm[i].size) < 0)
+			return -1;
+	}
+	return buf_printf(&b->out, "}\n");
 }
 
 /*
- *  show_pages()
- *	show page mapping
+ *  batch_map()
+ *	append the record of a map, with -e
+ *	its page counts are the estimates of them
  */
-static int show_pages(
-	const index_t cursor_index,
-	const index_t page_index,
-	const position_t *p,
-	const int32_t zoom)
+static int batch_map(
+	batch_t *b,
+	const struct timespec *now,
+	const map_t *map)
 {
-	int32_t i;
-	index_t index;
-	const uint32_t shift = ((uint32_t)(8 * sizeof(pagemap_t) - 4 -
-		__builtin_clzll((g.page_size))));
-	int fd;
-	map_t *map;
-	const int32_t xmax = p->xmax, ymax = p->ymax;
-	pagemap_t pagemap_info_buf[xmax];
-
-	if ((fd = open(g.path_pagemap, O_RDONLY)) < 0)
-		return ERR_NO_MAP_INFO;
-
-	index = page_index;
-	for (i = 1; i <= ymax; i++) {
-		int32_t j;
-		addr_t addr, offset;
-		const size_t sz = sizeof(pagemap_info_buf);
-
-		if (index >= (index_t)g.mem_info.npages) {
-			wattrset(g.mainwin, COLOR_PAIR(BLACK_BLACK));
-			mvwprintw(g.mainwin, i, 0, "---------------- ");
-		} else {
-			addr = g.mem_info.pages[index].addr;
-			wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
-			mvwprintw(g.mainwin, i, 0, "%16.16" PRIx64 " ", addr);
-		}
+	const index_t mapped = map_size(map);
+	bool counted = map->state && map->state->counted;
+	const char *name = map_name(g.mem_info.names.data, map);
+	const page_counts_t *counts = counted ? &map->state->counts : NULL;
+	page_counts_t none, est;
+	kflags_counts_t none_flags;
+	kcount_counts_t none_share;
+	est_value_t v[EST_FIELDS];
+	uint32_t i, sampled = 0;
+	int ret;
+
+	memset(&none, 0, sizeof(none));
+	memset(&none_flags, 0, sizeof(none_flags));
+	memset(&none_share, 0, sizeof(none_share));
+	if (g.opt_flags & OPT_FLAG_ESTIMATE) {
+		counted = est_map(map, v, &sampled) >= 0.0;
+		if (counted)
+			est_counts(v, &est);
+		counts = counted ? &est : NULL;
+	}
 
-		/*
-		 *  Slurp up an entire row
-		 */
-		addr = g.mem_info.pages[index].addr;
-		map = g.mem_info.pages[index].map;
-		offset = (addr >> shift) & ~7;
+	if (b->format == BATCH_CSV) {
+		ret = buf_printf(&b->out, "%ld.%06ld,%d,map,,,0x%" PRIx64
+			",0x%" PRIx64 ",%s,%s,%" PRIu64 ",",
+			(long)now->tv_sec, now->tv_nsec / 1000, g.pid,
+			map->begin, map->end, map->attr, map->dev,
+			map->inode);
+		if ((ret < 0) || (buf_csv_str(&b->out, name) < 0))
+			return -1;
+	} else {
+		ret = buf_printf(&b->out, "{\"time\":%ld.%06ld,\"pid\":%d,"
+			"\"type\":\"map\",\"begin\":\"0x%" PRIx64 "\","
+			"\"end\":\"0x%" PRIx64 "\",\"attr\":\"%s\","
+			"\"dev\":\"%s\",\"inode\":%" PRIu64 ",\"name\":",
+			(long)now->tv_sec, now->tv_nsec / 1000, g.pid,
+			map->begin, map->end, map->attr, map->dev,
+			map->inode);
+		if ((ret < 0) || (buf_json_str(&b->out, name) < 0))
+			return -1;
+	}
+	if (batch_counts(b, mapped, counts ? counts : &none,
+	    (counted || map->reserved) ? 0 : mapped,
+	    map->state ? map->state->written : 0,
+	    (g.idle.fd < 0) ? -1 :
+	    (int64_t)(map->state ? map->state->cold : 0),
+	    g.damon.updates ?
+	    (int64_t)damon_pages(&g.damon, map->begin, map->end, NULL) : -1) < 0)
+		return -1;
+	if (batch_flags(b, (g.kflags.fd < 0) ? NULL :
+	    (map->state ? &map->state->flags : &none_flags)) < 0)
+		return -1;
+	if (batch_share(b, (g.kcount.fd < 0) ? NULL :
+	    (map->state ? &map->state->share : &none_share)) < 0)
+		return -1;
 
-		memset(pagemap_info_buf, 0, sz);
-		if (lseek(fd, offset, SEEK_SET) != (off_t)-1) {
-			ssize_t ret = read(fd, pagemap_info_buf, sz);
-			(void)ret;
-		}
+	if (b->format == BATCH_JSON)
+		return (batch_est(b, counted ? v : NULL, sampled) < 0) ?
+			-1 : buf_printf(&b->out, "}\n");
 
-		for (j = 0; j < xmax; j++) {
-			char state = '.';
-			int attr = COLOR_PAIR(BLACK_WHITE);
+	/* No faults, tracking, sweep stats, WSS or Vm sizes for maps */
+	if (buf_printf(&b->out, ",,,,,,,,,") < 0)
+		return -1;
+	if (batch_est(b, counted ? v : NULL, sampled) < 0)
+		return -1;
+	for (i = 0; i < g.wss.nwindows + b->nvm; i++)
+		if (buf_printf(&b->out, ",") < 0)
+			return -1;
+	return buf_printf(&b->out, "\n");
+}
 
-			if (index >= (index_t)g.mem_info.npages) {
-				attr = COLOR_PAIR(BLACK_BLACK);
-				state = '~';
-			} else {
-				map_t *new_map;
-				register pagemap_t pagemap_info;
+/*
+ *  batch_step()
+ *	sweep the process and write its records, all the
+ *	records of a step are written to stdout at once.
+ *	Dirty pages are reset after sweeping, so the dirty
+ *	counts cover the pages dirtied since the last reset.
+ */
+static int batch_step(batch_t *b, const int32_t ticks)
+{
+	struct timespec now;
+	size_t off;
+	uint32_t i;
+	int rc;
+
+	if ((rc = read_maps(false)) < 0)
+		return rc;
+	if (g.opt_flags & OPT_FLAG_READ_ALL_PAGES) {
+		(void)read_all_pages();
+		g.opt_flags &= ~OPT_FLAG_READ_ALL_PAGES;
+	}
 
-				new_map = g.mem_info.pages[index].map;
-				/*
-				 *  On a different mapping? If so, slurp up
-				 *  the new mappings from here to end
-				 */
-				if (new_map != map) {
-					map = new_map;
-					addr = g.mem_info.pages[index].addr;
-					offset = (addr >> shift) & ~7;
-					if (lseek(fd, offset, SEEK_SET) == (off_t)-1)
-						break;
-					if (read(fd, &pagemap_info_buf[j],
-					    (xmax - j) * sizeof(pagemap_t)) < 0)
-						break;
-				}
+	/* The first sweep counts the whole process, -e estimates it */
+	if ((g.opt_flags & OPT_FLAG_ESTIMATE) ?
+	    ((rc = est_round(&g.est, &g.sample)) < 0) :
+	    ((rc = sample_sweep(&g.sample, b->started ?
+	      BATCH_SWEEP_MAX : (index_t)g.mem_info.npages)) < 0))
+		return rc;
+	if (!b->tick) {
+		dirty_reset(&g.dirty, 0, (index_t)g.mem_info.npages,
+			NULL, 0);
+		pfns_round(&g.pfns, 0, (index_t)g.mem_info.npages,
+			BATCH_SWEEP_MAX);
+		share_round(&g.share);
+		damon_update(&g.damon);
+	}
+	b->tick++;
+	if (b->tick > ticks)
+		b->tick = 0;
 
-				__builtin_prefetch(&g.mem_info.pages[index + zoom].addr, 1, 1);
+	read_status(&b->snap);
+	b->snap.faults_valid = !read_faults(&b->snap.minor, &b->snap.major);
+	(void)clock_gettime(CLOCK_REALTIME, &now);
 
-				pagemap_info = pagemap_info_buf[j];
-				attr = COLOR_PAIR(BLACK_WHITE);
-				if (pagemap_info & PAGE_PRESENT) {
-					attr = COLOR_PAIR(WHITE_YELLOW);
-					state = 'P';
-				}
-				if (pagemap_info & PAGE_SWAPPED) {
-					attr = COLOR_PAIR(WHITE_GREEN);
-					state = 'S';
-				}
-				if (pagemap_info & PAGE_FILE_SHARED_ANON) {
-					attr = COLOR_PAIR(WHITE_RED);
-					state = 'M';
-				}
-				if (pagemap_info & PAGE_PTE_SOFT_DIRTY) {
-					attr = COLOR_PAIR(WHITE_CYAN);
-					state = 'D';
-				}
-				index += zoom;
+	b->out.len = 0;
+	if (!b->started && (b->format == BATCH_CSV) &&
+	    (batch_header(b) < 0))
+		return ERR_ALLOC_NOMEM;
+	if (batch_process(b, &now) < 0)
+		return ERR_ALLOC_NOMEM;
+	if (batch_sharing(b, &now) < 0)
+		return ERR_ALLOC_NOMEM;
+	if (g.opt_flags & OPT_FLAG_BATCH_MAPS) {
+		for (i = 0; i < g.mem_info.nmaps; i++)
+			if (batch_map(b, &now, &g.mem_info.maps[i]) < 0)
+				return ERR_ALLOC_NOMEM;
+	}
+	b->started = true;
+
+	for (off = 0; off < b->out.len; ) {
+		const ssize_t ret = write(STDOUT_FILENO, b->out.data + off,
+			b->out.len - off);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Reader went away, nothing more to do */
+			if (errno == EPIPE) {
+				g.terminate = true;
+				return OK;
 			}
-			wattrset(g.mainwin, attr);
-			mvwprintw(g.mainwin, i, ADDR_OFFSET + j, "%c", state);
+			return ERR_NO_OUTPUT;
 		}
+		off += ret;
 	}
-	wattrset(g.mainwin, A_NORMAL);
-
-	map = g.mem_info.pages[cursor_index].map;
-	if (map && g.tab_view)
-		show_page_bits(fd, map, cursor_index);
-	if (g.vm_view)
-		show_vm();
-#if defined(PERF_ENABLED)
-	if (g.perf_view)
-		show_perf();
-#endif
-
-	(void)close(fd);
-	return 0;
+	return OK;
 }
 
 /*
- *  show_memory()
- *	show memory contents
+ *  batch_run()
+ *	write records every udelay microseconds
+ *	until the process exits or we are told
+ *	to terminate
  */
-static int show_memory(
-	const index_t page_index,
-	index_t data_index,
-	const position_t *p)
+static int batch_run(
+	batch_t *b,
+	const useconds_t udelay,
+	const int32_t ticks)
 {
-	addr_t addr;
-	index_t index = page_index;
-	int32_t i;
-	const int32_t xmax = p->xmax, ymax = p->ymax;
-	int fd;
-
-	if ((fd = open(g.path_mem, O_RDONLY)) < 0)
-		return ERR_NO_MEM_INFO;
-
-	for (i = 1; i <= ymax; i++) {
-		int32_t j;
-		uint8_t bytes[xmax];
-		ssize_t nread = 0;
+	struct sigaction action;
+	sigset_t set;
 
-		addr = g.mem_info.pages[index].addr + data_index;
-		if (lseek(fd, (off_t)addr, SEEK_SET) == (off_t)-1) {
-			nread = -1;
-		} else {
-			nread = read(fd, bytes, (size_t)xmax);
-			if (nread < 0)
-				nread = -1;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &action, NULL) < 0)
+		return ERR_NO_EVENTS;
+
+	(void)sigemptyset(&set);
+	(void)sigaddset(&set, SIGTERM);
+	(void)sigaddset(&set, SIGINT);
+	(void)sigaddset(&set, SIGHUP);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+		return ERR_NO_EVENTS;
+
+	b->epfd = epoll_create1(EPOLL_CLOEXEC);
+	b->sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	b->timerfd = timer_open(0, udelay);
+	if ((b->epfd < 0) || (b->sigfd < 0) || (b->timerfd < 0) ||
+	    (epoll_add(b->epfd, b->sigfd) < 0) ||
+	    (epoll_add(b->epfd, b->timerfd) < 0))
+		return ERR_NO_EVENTS;
+
+	while (!g.terminate) {
+		struct epoll_event events[EVENTS_MAX];
+		bool step = false;
+		int i, n, rc;
+
+		n = epoll_wait(b->epfd, events, EVENTS_MAX, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERR_NO_EVENTS;
 		}
-
-		wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
-		if (index >= (index_t)g.mem_info.npages)
-			mvwprintw(g.mainwin, i, 0, "---------------- ");
-		else
-			mvwprintw(g.mainwin, i, 0, "%16.16" PRIx64 " ", addr);
-		mvwprintw(g.mainwin, i, COLS - 3, "   ");
-
-		for (j = 0; j < xmax; j++) {
-			uint8_t byte;
-			addr = g.mem_info.pages[index].addr + data_index;
-			if ((index >= (index_t)g.mem_info.npages) ||
-			    (addr > g.mem_info.last_addr)) {
-				/* End of memory */
-				wattrset(g.mainwin, COLOR_PAIR(BLACK_BLACK));
-				mvwprintw(g.mainwin, i, ADDR_OFFSET +
-					(HEX_WIDTH * j), "   ");
-				mvwprintw(g.mainwin, i, ADDR_OFFSET +
-					(HEX_WIDTH * xmax) + j, " ");
-				goto do_border;
-			}
-			if (j > nread) {
-				/* Failed to read data */
-				wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE));
-				mvwprintw(g.mainwin, i, ADDR_OFFSET +
-					(HEX_WIDTH * j), "?? ");
-				wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
-				mvwprintw(g.mainwin, i, ADDR_OFFSET +
-					(HEX_WIDTH * xmax) + j, "?");
-				goto do_border;
-			}
-
-			/* We have some legimate data to display */
- 			byte = bytes[j];
-			wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE));
-			mvwprintw(g.mainwin, i, ADDR_OFFSET +
-				(HEX_WIDTH * j), "%2.2" PRIx8 " ", byte);
-			wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
-			byte &= 0x7f;
-			mvwprintw(g.mainwin, i, ADDR_OFFSET +
-				(HEX_WIDTH * xmax) + j, "%c",
-				(byte < 32 || byte > 126) ? '.' : byte);
-do_border:
-			wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE));
-			mvwprintw(g.mainwin, i, 16 + (HEX_WIDTH * xmax), " ");
-			data_index++;
-			if (data_index >= g.page_size) {
-				data_index -= g.page_size;
-				index++;
+		for (i = 0; i < n; i++) {
+			const int fd = events[i].data.fd;
+			struct signalfd_siginfo info;
+			uint64_t count;
+
+			if (fd == b->sigfd) {
+				while (read(fd, &info, sizeof(info)) ==
+				       sizeof(info))
+					g.terminate = true;
+			} else if (read(fd, &count, sizeof(count)) ==
+				   sizeof(count)) {
+				/* Missed expiries are skipped, not caught up */
+				step = true;
 			}
 		}
+		if (step && !g.terminate &&
+		    ((rc = batch_step(b, ticks)) < 0))
+			return rc;
 	}
-	(void)close(fd);
-
-	return 0;
+	return OK;
 }
 
 /*
- *  read_all_pages()
- *	read in all pages into memory, this
- *	will force swapped out pages back into
- *	memory
+ *  batch_close()
+ *	close the batch mode events and free its records
  */
-static int read_all_pages(void)
+static void batch_close(batch_t *b)
 {
-	int fd;
-	index_t index;
-
-	if ((fd = open(g.path_mem, O_RDONLY)) < 0)
-		return ERR_NO_MEM_INFO;
-
-	for (index = 0; index < (index_t)g.mem_info.npages; index++) {
-		const off_t addr = g.mem_info.pages[index].addr;
-		uint8_t byte;
-
-		if (lseek(fd, addr, SEEK_SET) == (off_t)-1)
-			continue;
-		if (read(fd, &byte, sizeof(byte)) < 0)
-			continue;
-	}
-	(void)close(fd);
-
-	return 0;
+	fd_close(&b->epfd);
+	fd_close(&b->sigfd);
+	fd_close(&b->timerfd);
+	free(b->out.data);
+	memset(&b->out, 0, sizeof(b->out));
 }
 
 /*
  *  show_key()
  *	show key for mapping info
  */
-static inline void show_key(void)
+static inline void show_key(const table_view_t *tv)
 {
 	banner(LINES - 1);
 	if (g.view == VIEW_PAGE) {
@@ -963,6 +8088,10 @@ static inline void show_key(void)
 		wprintw(g.mainwin, "P");
 		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
 		wprintw(g.mainwin, " Present in RAM, ");
+		wattrset(g.mainwin, COLOR_PAIR(WHITE_MAGENTA));
+		wprintw(g.mainwin, "H");
+		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
+		wprintw(g.mainwin, " Huge, ");
 		wattrset(g.mainwin, COLOR_PAIR(WHITE_CYAN));
 		wprintw(g.mainwin, "D");
 		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
@@ -976,6 +8105,13 @@ static inline void show_key(void)
 		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
 		wprintw(g.mainwin, " not in RAM");
 		wattrset(g.mainwin, COLOR_PAIR(BLACK_WHITE) | A_BOLD);
+	} else if (g.view == VIEW_MAPS) {
+		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
+		mvwprintw(g.mainwin, LINES - 1, 0,
+			"Maps View, sorted by %s %s, Filter: %s%s",
+			table_heads[tv->sort],
+			tv->reverse ? "descending" : "ascending",
+			tv->filter, tv->editing ? "_" : "");
 	} else {
 		wattrset(g.mainwin, COLOR_PAIR(WHITE_BLUE) | A_BOLD);
 		mvwprintw(g.mainwin, LINES - 1, 0, "%-*s", COLS, "Memory View");
@@ -989,7 +8125,7 @@ static inline void show_key(void)
 static inline void show_help(void)
 {
 	const int x = (COLS - 45) / 2;
-	int y = (LINES - 15) / 2;
+	int y = (LINES - 18) / 2;
 
 	wattrset(g.mainwin, COLOR_PAIR(WHITE_RED) | A_BOLD);
 	mvwprintw(g.mainwin, y++,  x,
@@ -1004,6 +8140,12 @@ static inline void show_help(void)
 		" Tab        Toggle page information%8s", "");
 	mvwprintw(g.mainwin, y++,  x,
 		" Enter      Toggle map/memory views%8s", "");
+	mvwprintw(g.mainwin, y++,  x,
+		" M or m     Toggle maps table%14s", "");
+	mvwprintw(g.mainwin, y++,  x,
+		" O or o     Reverse maps table order%7s", "");
+	mvwprintw(g.mainwin, y++,  x,
+		" /          Filter maps by name or attrs%3s", "");
 	mvwprintw(g.mainwin, y++,  x,
 		" + or z     Zoom in memory map%13s", "");
 	mvwprintw(g.mainwin, y++,  x,
@@ -1014,6 +8156,10 @@ static inline void show_help(void)
 		" A or a     Toggle Auto Zoom on/off        ");
 	mvwprintw(g.mainwin, y++,  x,
 		" V or v     Toggle Virtual Memory Stats    ");
+	mvwprintw(g.mainwin, y++,  x,
+		" W or w     Toggle Working Set Size        ");
+	mvwprintw(g.mainwin, y++,  x,
+		" I or i     Toggle Access Heat             ");
 #if defined(PERF_ENABLED)
 	mvwprintw(g.mainwin, y++,  x,
 		" P or p     Toggle Perf Page Stats         ");
@@ -1038,11 +8184,58 @@ static inline void update_xymax(position_t *position, int v)
 {
 	static const int32_t xmax_scale[] = {
 		1,	/* VIEW_PAGE */
-		4	/* VIEW_MEM */
+		4,	/* VIEW_MEM */
+		1	/* VIEW_MAPS */
 	};
 
 	position[v].xmax = (COLS - ADDR_OFFSET) / xmax_scale[v];
 	position[v].ymax = LINES - 2;
+	/* Less the maps table column headings */
+	if (v == VIEW_MAPS)
+		position[v].ymax--;
+}
+
+/*
+ *  ui_request()
+ *	describe the view the UI is showing for the sampler
+ */
+static void ui_request(
+	request_t *req,
+	const position_t *position,
+	const table_view_t *tv,
+	const index_t page_index,
+	const index_t data_index,
+	const int32_t zoom,
+	const int32_t ticks,
+	const uint32_t read_all)
+{
+	const position_t *p = &position[g.view];
+	const position_t *pc = &position[VIEW_PAGE];
+	const index_t cursor_index = page_index +
+		zoom * (pc->xpos + (pc->ypos * pc->xmax));
+
+	memset(req, 0, sizeof(*req));
+	/* The memory view shows the page under the page view cursor */
+	req->page_index = (g.view == VIEW_MEM) ? cursor_index : page_index;
+	req->data_index = data_index;
+	req->cursor_index = cursor_index;
+	req->xmax = p->xmax;
+	req->ymax = p->ymax;
+	req->zoom = zoom;
+	req->ticks = ticks;
+	req->read_all = read_all;
+	req->table_top = tv->top;
+	req->table_sort = tv->sort;
+	req->table_reverse = tv->reverse;
+	(void)strcpy(req->table_filter, tv->filter);
+	req->view = g.view;
+	req->tab_view = g.tab_view;
+	req->vm_view = g.vm_view;
+	req->wss_view = g.wss_view;
+	req->heat_view = g.heat_view;
+#if defined(PERF_ENABLED)
+	req->perf_view = g.perf_view;
+#endif
 }
 
 /*
@@ -1060,34 +8253,149 @@ static inline void reset_cursor(
 	*page_index = 0;
 }
 
+/*
+ *  table_key()
+ *	handle a key of the maps table view, returns 0 if it
+ *	was handled or the key for the other views to handle.
+ *	While the filter is being typed in every key is taken.
+ */
+static int table_key(table_view_t *tv, const int ch, const int32_t ymax)
+{
+	size_t len = strlen(tv->filter);
+
+	if (tv->editing) {
+		switch (ch) {
+		case ERR:
+			return ch;
+		case 27:	/* ESC */
+			tv->filter[0] = '\0';
+			tv->editing = false;
+			break;
+		case '\n':
+			tv->editing = false;
+			break;
+		case KEY_BACKSPACE:
+		case 127:
+		case '\b':
+			if (len)
+				tv->filter[len - 1] = '\0';
+			break;
+		default:
+			if (isprint(ch) && (len < TABLE_FILTER_MAX - 1)) {
+				tv->filter[len] = (char)ch;
+				tv->filter[len + 1] = '\0';
+			}
+			break;
+		}
+		tv->top = 0;
+		tv->row = 0;
+		return 0;
+	}
+
+	switch (ch) {
+	case '/':
+		/* Type in a filter */
+		tv->editing = true;
+		break;
+	case 'o':
+	case 'O':
+		/* Reverse sort order */
+		tv->reverse = !tv->reverse;
+		break;
+	case KEY_LEFT:
+		tv->sort = (tv->sort + TABLE_COLS - 1) % TABLE_COLS;
+		break;
+	case KEY_RIGHT:
+		tv->sort = (tv->sort + 1) % TABLE_COLS;
+		break;
+	case KEY_UP:
+		tv->row--;
+		break;
+	case KEY_DOWN:
+		tv->row++;
+		break;
+	case KEY_PPAGE:
+		tv->row -= ymax / 2;
+		break;
+	case KEY_NPAGE:
+		tv->row += ymax / 2;
+		break;
+	case KEY_HOME:
+		tv->row = 0;
+		break;
+	case KEY_END:
+		tv->row = INT32_MAX;
+		break;
+	default:
+		return ch;
+	}
+	return 0;
+}
+
+/*
+ *  table_clamp()
+ *	keep the selected row of the maps table in
+ *	the table and scroll the table to show it
+ */
+static void table_clamp(table_view_t *tv, const int32_t nrows,
+	const int32_t ymax)
+{
+	tv->row = MAXIMUM(MINIMUM(tv->row, nrows - 1), 0);
+	if (tv->row < tv->top)
+		tv->top = tv->row;
+	if (tv->row >= tv->top + ymax)
+		tv->top = tv->row - ymax + 1;
+	tv->top = MAXIMUM(MINIMUM(tv->top, nrows - ymax), 0);
+}
+
 int main(int argc, char **argv)
 {
 	struct sigaction action;
 	map_t *map;
 	useconds_t udelay;
-	position_t position[2];
+	position_t position[3];
+	table_view_t tv;
 	index_t page_index, prev_page_index;
 	index_t data_index, prev_data_index;
-	int32_t tick, ticks, blink, zoom;
+	int32_t ticks, blink, zoom;
+	uint32_t i, read_all;
+	request_t req;
+	bool udelay_set;
 	int rc, ret;
+	unsigned long val;
+	char *end;
 
-	if (sigsetjmp(g.env, 0)) {
+	if (sigsetjmp(g.env, 1)) {
 		rc = ERR_FAULT;
 		goto terminate;
 	}
 
 	g.pid = -1;
+	proc_init();
+	sampler_init(&g.sampler);
+	ui_init(&g.ui);
+	batch_init(&g.batch);
+	pool_init(&g.pool);
+	wss_init(&g.wss);
+	idle_init(&g.idle);
+	kpage_init(&g.kflags);
+	kpage_init(&g.kcount);
+	damon_init(&g.damon);
+	est_init(&g.est);
+	uring_init(&g.uring);
 	rc = OK;
 	blink = 0;
 	zoom = MIN_ZOOM;
 	ticks = DEFAULT_TICKS;
-	tick = 0;
+	read_all = 0;
 	udelay = DEFAULT_UDELAY;
+	udelay_set = false;
 	page_index = 0;
 	data_index = 0;
 
 	for (;;) {
-		int c = getopt(argc, argv, "ad:hp:rt:vz:");
+		int c = getopt(argc, argv,
+			"aA:bc:d:D:e:hi:kmo:p:rR:sS:t:uvw:W:z:");
 
 		if (c == -1)
 			break;
@@ -1095,17 +8403,101 @@ int main(int argc, char **argv)
 		case 'a':
 			g.auto_zoom = true;
 			break;
+		case 'A':
+			if (damon_intervals(&g.damon, optarg) < 0) {
+				fprintf(stderr, "Invalid DAMON intervals, must "
+					"be sampling,aggregation microseconds "
+					"with aggregation at most %d\n",
+					DAMON_AGGR_US_MAX);
+				exit(EXIT_FAILURE);
+			}
+			g.opt_flags |= OPT_FLAG_DAMON;
+			g.heat_view = true;
+			break;
+		case 'b':
+			g.opt_flags |= OPT_FLAG_BATCH;
+			break;
+		case 'c':
+			errno = 0;
+			val = strtoul(optarg, &end, 10);
+			if (errno || (end == optarg) || *end ||
+			    (val < PYRAMID_BASE) || (val > SWEEP_CHUNK_MAX)) {
+				fprintf(stderr, "Invalid chunk size, must be "
+					"%d to %d pages\n", PYRAMID_BASE,
+					SWEEP_CHUNK_MAX);
+				exit(EXIT_FAILURE);
+			}
+			/* Chunks must not share pyramid base nodes */
+			g.pool.chunk_pages = (index_t)val &
+				~(index_t)(PYRAMID_BASE - 1);
+			break;
 		case 'd':
-			udelay = strtoul(optarg, NULL, 10);
-			if (errno) {
+			errno = 0;
+			udelay = strtoul(optarg, &end, 10);
+			if (errno || (end == optarg) || *end) {
 				fprintf(stderr, "Invalid delay value\n");
 				exit(EXIT_FAILURE);
 			}
+			udelay_set = true;
+			break;
+		case 'D':
+			if (!strcmp(optarg, "none")) {
+				g.dirty.mode = DIRTY_NONE;
+			} else if (!strcmp(optarg, "refs")) {
+				g.dirty.mode = DIRTY_REFS;
+			} else if (!strcmp(optarg, "wp")) {
+				g.dirty.mode = DIRTY_WP;
+			} else {
+				fprintf(stderr, "Invalid dirty tracking, "
+					"must be none, refs or wp\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'e':
+			if (est_options(&g.est, optarg) < 0) {
+				fprintf(stderr, "Invalid estimate, must be "
+					"error percent %g to %g with optional "
+					",reads per refresh at most %d\n",
+					EST_ERROR_MIN, EST_ERROR_MAX,
+					EST_READS_MAX);
+				exit(EXIT_FAILURE);
+			}
+			g.opt_flags |= OPT_FLAG_ESTIMATE;
 			break;
 		case 'h':
 			show_usage();
 			exit(EXIT_SUCCESS);
 			break;
+		case 'i':
+			errno = 0;
+			val = strtoul(optarg, &end, 10);
+			if (errno || (end == optarg) || *end ||
+			    (val < 1) || (val >= IDLE_AGE_MAX)) {
+				fprintf(stderr, "Invalid cold rounds, must be "
+					"1 to %d\n", IDLE_AGE_MAX - 1);
+				exit(EXIT_FAILURE);
+			}
+			g.idle.cold = (uint32_t)val;
+			g.opt_flags |= OPT_FLAG_IDLE;
+			g.heat_view = true;
+			break;
+		case 'k':
+			g.opt_flags |= OPT_FLAG_KFLAGS;
+			break;
+		case 'm':
+			g.opt_flags |= OPT_FLAG_BATCH_MAPS;
+			break;
+		case 'o':
+			if (!strcmp(optarg, "json")) {
+				g.batch.format = BATCH_JSON;
+			} else if (!strcmp(optarg, "csv")) {
+				g.batch.format = BATCH_CSV;
+			} else {
+				fprintf(stderr, "Invalid format, "
+					"must be json or csv\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'p':
 			g.pid = proc_name_to_pid(optarg);
 			if (g.pid < 1)
@@ -1115,6 +8507,23 @@ int main(int argc, char **argv)
 		case 'r':
 			g.opt_flags |= OPT_FLAG_READ_ALL_PAGES;
 			break;
+		case 'R':
+			if (!strcmp(optarg, "visible"))
+				g.dirty.visible = true;
+			else
+				g.dirty.maps = optarg;
+			break;
+		case 's':
+			g.opt_flags |= OPT_FLAG_KCOUNT;
+			break;
+		case 'S':
+			if (share_pids(&g.share, optarg) < 0) {
+				fprintf(stderr, "Invalid processes to share "
+					"with, must be 1 to %d comma separated "
+					"PIDs or names\n", SHARE_PROCS_MAX - 1);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 't':
 			ticks = strtol(optarg, NULL, 10);
 			if ((ticks < MIN_TICKS) || (ticks > MAX_TICKS)) {
@@ -1122,21 +8531,48 @@ int main(int argc, char **argv)
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 'u':
+			g.opt_flags |= OPT_FLAG_URING;
+			break;
 		case 'v':
 			g.vm_view = true;
 			break;
+		case 'w':
+			errno = 0;
+			val = strtoul(optarg, &end, 10);
+			if (errno || (end == optarg) || *end ||
+			    (val < 1) || (val > SWEEP_WORKERS_MAX)) {
+				fprintf(stderr, "Invalid number of workers, "
+					"must be 1 to %d\n", SWEEP_WORKERS_MAX);
+				exit(EXIT_FAILURE);
+			}
+			g.pool.nworkers = (uint32_t)val;
+			break;
+		case 'W':
+			if (wss_windows(&g.wss, optarg) < 0) {
+				fprintf(stderr, "Invalid working set size "
+					"windows, must be 1 to %d comma separated "
+					"seconds\n", WSS_WINDOWS_MAX);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'z':
-			zoom = strtoul(optarg, NULL, 10);
-			if (errno || (zoom < MIN_ZOOM) || (zoom > MAX_ZOOM)) {
+			errno = 0;
+			val = strtoul(optarg, &end, 10);
+			if (errno || (end == optarg) || *end ||
+			    (val < MIN_ZOOM) || (val > MAX_ZOOM)) {
 				fprintf(stderr, "Invalid zoom value\n");
 				exit(EXIT_FAILURE);
 			}
+			zoom = (int32_t)val;
 			break;
 		default:
 			show_usage();
 			exit(EXIT_FAILURE);
 		}
 	}
+	if ((g.opt_flags & OPT_FLAG_BATCH) && !udelay_set)
+		udelay = BATCH_UDELAY;
 	if (!(g.opt_flags & OPT_FLAG_PID)) {
 		fprintf(stderr, "Must provide process ID with -p option\n");
 		exit(EXIT_FAILURE);
@@ -1150,18 +8586,25 @@ int main(int argc, char **argv)
 		fprintf(stderr, "No such process %d\n", g.pid);
 		exit(EXIT_FAILURE);
 	}
+	classify_init();
+	/* Falls back to pread if io_uring is not available */
+	if (g.opt_flags & OPT_FLAG_URING)
+		(void)uring_open(&g.uring);
+	/* Without page_idle there is just no idle page tracking */
+	if (g.opt_flags & OPT_FLAG_IDLE)
+		(void)idle_open(&g.idle);
+	/* Nor without kpageflags any kernel page flags */
+	if (g.opt_flags & OPT_FLAG_KFLAGS)
+		(void)kpage_open(&g.kflags, "/proc/kpageflags");
+	if (g.opt_flags & OPT_FLAG_KCOUNT)
+		(void)kpage_open(&g.kcount, "/proc/kpagecount");
 	g.page_size = sysconf(_SC_PAGESIZE);
 	if (g.page_size == (uint32_t)-1) {
 		/* Guess */
 		g.page_size = 4096UL;
 	}
 	g.max_pages = ((addr_t)((size_t)~0)) / g.page_size;
-	memset(&action, 0, sizeof(action));
-	action.sa_handler = handle_winch;
-	if (sigaction(SIGWINCH, &action, NULL) < 0) {
-		fprintf(stderr, "Could not set up window resizing handler\n");
-		exit(EXIT_FAILURE);
-	}
+	huge_init();
 	memset(&action, 0, sizeof(action));
 	action.sa_handler = handle_terminate;
 	if (sigaction(SIGSEGV, &action, NULL) < 0) {
@@ -1172,21 +8615,18 @@ int main(int argc, char **argv)
 		fprintf(stderr, "Could not set up error handler\n");
 		exit(EXIT_FAILURE);
 	}
-
-	snprintf(g.path_refs, sizeof(g.path_refs),
-		"/proc/%i/clear_refs", g.pid);
-	snprintf(g.path_pagemap, sizeof(g.path_pagemap),
-		"/proc/%i/pagemap", g.pid);
-	snprintf(g.path_maps, sizeof(g.path_maps),
-		"/proc/%i/maps", g.pid);
-	snprintf(g.path_mem, sizeof(g.path_mem),
-		"/proc/%i/mem", g.pid);
-	snprintf(g.path_status, sizeof(g.path_status),
-		"/proc/%i/status", g.pid);
-	snprintf(g.path_stat, sizeof(g.path_stat),
-		"/proc/%i/stat", g.pid);
-	snprintf(g.path_oom, sizeof(g.path_stat),
-		"/proc/%i/oom_score", g.pid);
+	/* Without DAMON there is just no region access monitoring */
+	if (g.opt_flags & OPT_FLAG_DAMON)
+		(void)damon_start(&g.damon);
+	if (g.opt_flags & OPT_FLAG_BATCH) {
+		rc = batch_run(&g.batch, udelay, ticks);
+		goto terminate;
+	}
+	if (ui_open(&g.ui) < 0) {
+		fprintf(stderr, "Could not set up event handling\n");
+		damon_close(&g.damon);
+		exit(EXIT_FAILURE);
+	}
 
 	initscr();
 	start_color();
@@ -1208,52 +8648,56 @@ int main(int argc, char **argv)
 	init_pair(RED_BLUE, COLOR_RED, COLOR_BLUE);
 	init_pair(BLACK_BLACK, COLOR_BLACK, COLOR_BLACK);
 	init_pair(BLUE_WHITE, COLOR_BLUE, COLOR_WHITE);
+	init_pair(WHITE_MAGENTA, COLOR_WHITE, COLOR_MAGENTA);
 
 	memset(position, 0, sizeof(position));
-	update_xymax(position, 0);
-	update_xymax(position, 1);
+	update_xymax(position, VIEW_PAGE);
+	update_xymax(position, VIEW_MEM);
+	update_xymax(position, VIEW_MAPS);
+	memset(&tv, 0, sizeof(tv));
 
-#if defined(PERF_ENABLED)
-	perf_start(&g.perf, g.pid);
-#endif
+	/*
+	 *  The sampler thread does all the reading of the
+	 *  process, this loop only draws its latest snapshot
+	 *  and handles input so it never waits on the process
+	 */
+	ui_request(&req, position, &tv, page_index, data_index,
+		zoom, ticks, read_all);
+	if (((rc = sampler_start(&g.sampler, &req, udelay)) < 0) ||
+	    ((rc = epoll_add(g.ui.epfd, g.sampler.notifyfd) < 0 ?
+	      ERR_NO_EVENTS : OK) < 0))
+		goto terminate;
 
 	for (;;) {
 		int ch, blink_attrs;
 		char cursor_ch;
 		position_t *p = &position[g.view];
+		const snapshot_t *snap;
+		page_t page;
 		addr_t show_addr;
 		float percent;
 
-		if ((!tick) && (g.view == VIEW_PAGE)) {
-			if ((rc = read_maps(false)) < 0)
+		snap = sampler_take(&g.sampler);
+		if (!snap) {
+			/* Nothing sampled yet */
+			if ((rc = ui_wait(&g.ui, &blink)) < 0)
 				break;
+			if (g.terminate)
+				break;
+			continue;
+		}
+		if (snap->rc < 0) {
+			rc = snap->rc;
+			break;
 		}
 		if ((g.view == VIEW_PAGE) && g.auto_zoom) {
 			const int32_t window_pages = p->xmax * p->ymax;
 
-			zoom = (g.mem_info.npages + window_pages - 1) /
+			zoom = (snap->npages + window_pages - 1) /
 				window_pages;
 			zoom = MINIMUM(MAX_ZOOM, zoom);
 			zoom = MAXIMUM(MIN_ZOOM, zoom);
 		}
-		if (g.opt_flags & OPT_FLAG_READ_ALL_PAGES) {
-			read_all_pages();
-			g.opt_flags &= ~OPT_FLAG_READ_ALL_PAGES;
-		}
-		if (!tick) {
-			int fd;
-			tick = 0;
-
-			fd = open(g.path_refs, O_RDWR);
-			if (fd > -1) {
-				ret = write(fd, "4", 1);
-				(void)ret;
-				(void)close(fd);
-			}
-		}
-		tick++;
-		if (tick > ticks)
-			tick = 0;
 
 		/*
 		 *  SIGWINCH window resize triggered so
@@ -1301,35 +8745,47 @@ int main(int argc, char **argv)
 				" WINDOW TOO SMALL ");
 			wrefresh(g.mainwin);
 			refresh();
-			usleep(udelay);
+			if ((rc = ui_wait(&g.ui, &blink)) < 0)
+				break;
+			if (g.terminate)
+				break;
 			continue;
 		}
 
 		update_xymax(position, g.view);
 		wbkgd(g.mainwin, COLOR_PAIR(RED_BLUE));
-		show_key();
-
-		blink++;
-		if (g.view == VIEW_MEM) {
+		show_key(&tv);
+
+		if (g.view == VIEW_MAPS) {
+			const table_row_t *row = table_selected(snap, &tv);
+
+			map = row ? &snap->maps[row->map] : NULL;
+			show_addr = map ? map->begin : 0;
+			percent = (snap->table_maps > 0) ?
+				100.0 * (tv.row + 1) / snap->table_maps : 100;
+			if (snap->req.view == VIEW_MAPS)
+				show_table(snap, p, &tv);
+		} else if (g.view == VIEW_MEM) {
 			int32_t curxpos = (p->xpos * 3) + ADDR_OFFSET;
 			const position_t *pc = &position[VIEW_PAGE];
 			const index_t cursor_index = page_index +
 				zoom * (pc->xpos + (pc->ypos * pc->xmax));
-			percent = (g.mem_info.npages > 0) ?
-				100.0 * cursor_index / g.mem_info.npages : 100;
+			percent = (snap->npages > 0) ?
+				100.0 * cursor_index / snap->npages : 100;
 
 			/* Memory may have shrunk, so check this */
-			if (cursor_index >= (index_t)g.mem_info.npages) {
+			if (cursor_index >= (index_t)snap->npages) {
 				/* Force end of memory key action */
 				ch = KEY_END;
 				goto force_ch;
 			}
 
-			map = g.mem_info.pages[cursor_index].map;
-			show_addr = g.mem_info.pages[cursor_index].addr +
+			(void)snap_lookup(snap, cursor_index, &page);
+			map = page.map;
+			show_addr = page.addr +
 				data_index + (p->xpos + (p->ypos * p->xmax));
-			if (show_memory(cursor_index, data_index, p) < 0)
-				break;
+			if (snap->req.view == VIEW_MEM)
+				show_memory(snap, p);
 
 			blink_attrs = A_BOLD | ((blink & BLINK_MASK) ?
 				COLOR_PAIR(WHITE_BLUE) :
@@ -1352,19 +8808,21 @@ int main(int argc, char **argv)
 			int32_t curxpos = p->xpos + ADDR_OFFSET;
 			const index_t cursor_index = page_index +
 				zoom * (p->xpos + (p->ypos * p->xmax));
-			percent = (g.mem_info.npages > 0) ?
-				100.0 * cursor_index / g.mem_info.npages : 100;
+			percent = (snap->npages > 0) ?
+				100.0 * cursor_index / snap->npages : 100;
 
 			/* Memory may have shrunk, so check this */
-			if (cursor_index >= (index_t)g.mem_info.npages) {
+			if (cursor_index >= (index_t)snap->npages) {
 				/* Force end of memory key action */
 				ch = KEY_END;
 				goto force_ch;
 			}
 
-			map = g.mem_info.pages[cursor_index].map;
-			show_addr = g.mem_info.pages[cursor_index].addr;
-			show_pages(cursor_index, page_index, p, zoom);
+			(void)snap_lookup(snap, cursor_index, &page);
+			map = page.map;
+			show_addr = page.addr;
+			if (snap->req.view == VIEW_PAGE)
+				show_pages(snap, p);
 
 			blink_attrs = A_BOLD | ((blink & BLINK_MASK) ?
 				COLOR_PAIR(BLACK_WHITE) :
@@ -1396,8 +8854,7 @@ int main(int argc, char **argv)
 					"Auto" : "Zoom", zoom);
 			wprintw(g.mainwin, "%s %s %-20.20s",
 				map->attr, map->dev,
-				map->name[0] == '\0' ?
-					"[Anonymous]" : basename(map->name));
+				map_basename(snap->names, map));
 		}
 		mvwprintw(g.mainwin, 0, COLS - 8, " %6.1f%%", percent);
 
@@ -1409,7 +8866,9 @@ force_ch:
 		p->xpos_prev = p->xpos;
 		p->ypos_prev = p->ypos;
 
-		switch (ch) {
+		/* The maps table view handles its own keys first */
+		switch ((g.view == VIEW_MAPS) ?
+			table_key(&tv, ch, p->ymax) : ch) {
 		case 27:	/* ESC */
 		case 'q':
 		case 'Q':
@@ -1432,6 +8891,16 @@ force_ch:
 			/* Toggle VM stats view */
 			g.vm_view = !g.vm_view;
 			break;
+		case 'w':
+		case 'W':
+			/* Toggle working set size panel */
+			g.wss_view = !g.wss_view;
+			break;
+		case 'i':
+		case 'I':
+			/* Toggle idle and DAMON heat colours */
+			g.heat_view = !g.heat_view;
+			break;
 		case '?':
 		case 'h':
 			/* Toggle Help */
@@ -1439,7 +8908,7 @@ force_ch:
 			break;
 		case 'r':
 		case 'R':
-			read_all_pages();
+			read_all++;
 			break;
 		case 'a':
 		case 'A':
@@ -1447,8 +8916,26 @@ force_ch:
 			g.auto_zoom = !g.auto_zoom;
 			break;
 		case '\n':
-			/* Toggle MAP / MEMORY views */
-			g.view ^= 1;
+			if (g.view == VIEW_MAPS) {
+				/* Jump the page view to the selected map */
+				if (!map)
+					break;
+				page_index = map->first;
+				data_index = 0;
+				position[VIEW_PAGE].xpos = 0;
+				position[VIEW_PAGE].ypos = 0;
+				g.view = VIEW_PAGE;
+			} else {
+				/* Toggle MAP / MEMORY views */
+				g.view ^= 1;
+			}
+			p = &position[g.view];
+			blink = 0;
+			break;
+		case 'm':
+		case 'M':
+			/* Toggle maps table view */
+			g.view = (g.view == VIEW_MAPS) ? VIEW_PAGE : VIEW_MAPS;
 			p = &position[g.view];
 			blink = 0;
 			break;
@@ -1503,6 +8990,7 @@ force_ch:
 			g.vm_view = false;
 			g.tab_view = false;
 			g.help_view = false;
+			g.wss_view = false;
 			break;
 		case KEY_DOWN:
 			blink = 0;
@@ -1545,7 +9033,7 @@ force_ch:
 			break;
 		case KEY_END:
 			if (g.view == VIEW_PAGE) {
-				page_index = g.mem_info.npages - 1;
+				page_index = snap->npages - 1;
 				p->xpos = 0;
 			} else {
 				data_index = g.page_size -
@@ -1557,7 +9045,7 @@ force_ch:
 		}
 
 		position[VIEW_PAGE].ypos_max =
-			(((g.mem_info.npages - page_index) / zoom) - p->xpos) /
+			(((snap->npages - page_index) / zoom) - p->xpos) /
 			position[0].xmax;
 		position[VIEW_MEM].ypos_max = position[VIEW_MEM].ymax;
 
@@ -1614,13 +9102,12 @@ force_ch:
 			const position_t *pc = &position[VIEW_PAGE];
 			const index_t cursor_index = page_index +
 				zoom * (pc->xpos + (pc->ypos * pc->xmax));
-			const addr_t addr =
-				(cursor_index >= (index_t)g.mem_info.npages) ?
-					g.mem_info.last_addr :
-					g.mem_info.pages[cursor_index].addr +
-					data_index + (p->xpos + (p->ypos * p->xmax));
+			const addr_t addr = !snap_lookup(snap, cursor_index, &page) ?
+				snap->last_addr :
+				page.addr + data_index +
+				(p->xpos + (p->ypos * p->xmax));
 
-			if (addr >= g.mem_info.last_addr) {
+			if (addr >= snap->last_addr) {
 				page_index = prev_page_index;
 				data_index = prev_data_index;
 				p->xpos = p->xpos_prev;
@@ -1628,14 +9115,14 @@ force_ch:
 			}
 		} else {
 			if ((index_t)page_index + ((index_t)zoom * (p->xpos +
-			    (p->ypos * p->xmax))) >= (index_t)g.mem_info.npages) {
+			    (p->ypos * p->xmax))) >= (index_t)snap->npages) {
 				const int64_t zoom_xmax = (int64_t)zoom * p->xmax;
 				const int64_t lines =
-					((zoom_xmax - 1) + g.mem_info.npages) /
+					((zoom_xmax - 1) + snap->npages) /
 					zoom_xmax;
 				const addr_t npages =
 					(zoom_xmax * lines);
-				const addr_t diff = (npages - g.mem_info.npages) /
+				const addr_t diff = (npages - snap->npages) /
 					zoom;
 				const int64_t last = p->xmax - diff;
 
@@ -1651,12 +9138,25 @@ force_ch:
 					p->xpos = last - 1;
 			}
 		}
+		if ((g.view == VIEW_MAPS) && (snap->req.view == VIEW_MAPS))
+			table_clamp(&tv, (int32_t)snap->table_maps, p->ymax);
 		if (g.terminate)
 			break;
 
 		if (kill(g.pid, 0) < 0)
 			break;
-		usleep(udelay);
+
+		ui_request(&req, position, &tv, page_index, data_index,
+			zoom, ticks, read_all);
+		sampler_post(&g.sampler, &req);
+
+		/* Handle any more pending keys before waiting */
+		if (ch == ERR) {
+			if ((rc = ui_wait(&g.ui, &blink)) < 0)
+				break;
+			if (g.terminate)
+				break;
+		}
 	}
 
 	werase(g.mainwin);
@@ -1670,10 +9170,33 @@ terminate:
 		endwin();
 	}
 
+	sampler_stop(&g.sampler);
+	pool_stop(&g.pool);
 #if defined(PERF_ENABLED)
 	perf_stop(&g.perf);
 #endif
-	free(g.mem_info.pages);
+	for (i = 0; i < g.mem_info.nmaps; i++)
+		map_state_free(&g.mem_info.maps[i]);
+	free(g.mem_info.maps);
+	free(g.mem_info.maps_new);
+	free(g.mem_info.buf.data);
+	free(g.mem_info.names.data);
+	free(g.mem_info.names.hash);
+	free(g.proc.buf.data);
+	proc_close();
+	sample_free(&g.sample);
+	free(g.table.order);
+	est_free(&g.est);
+	sampler_free(&g.sampler);
+	uring_close(&g.uring);
+	idle_close(&g.idle);
+	kpage_close(&g.kflags);
+	kpage_close(&g.kcount);
+	share_free(&g.share);
+	pfns_free(&g.pfns);
+	damon_close(&g.damon);
+	ui_close(&g.ui);
+	batch_close(&g.batch);
 
 	ret = EXIT_FAILURE;
 	switch (rc) {
@@ -1709,6 +9232,15 @@ terminate:
 	case ERR_FAULT:
 		fprintf(stderr, "Internal error, segmentation fault or bus error\n");
 		break;
+	case ERR_NO_THREAD:
+		fprintf(stderr, "Cannot create sampler thread\n");
+		break;
+	case ERR_NO_EVENTS:
+		fprintf(stderr, "Cannot wait for events\n");
+		break;
+	case ERR_NO_OUTPUT:
+		fprintf(stderr, "Cannot write batch records\n");
+		break;
 	default:
 		fprintf(stderr, "Unknown failure (%d)\n", rc);
 		break;
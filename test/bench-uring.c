@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define REGION_PAGES	(1UL << 18)	/* Pages mapped, 1 GB of 4K pages */
+#define TOUCH_STRIDE	(16)		/* Every n'th page is touched */
+#define BUF_WORDS	(65536)		/* Words read in a batch, as pagemon */
+#define SWEEP_WORDS	(4096)		/* Words in each read of a sweep */
+#define CELL_WORDS	(8)		/* Words in each read of a page view */
+#define CELL_STRIDE	(64)		/* Pages between page view reads */
+#define RUNS		(20)		/* Runs of each, best is shown */
+
+/*
+ *  A range of pagemap words to read
+ */
+typedef struct {
+	uint64_t first;			/* First word */
+	size_t count;			/* Words to read */
+} range_t;
+
+/*
+ *  Totals of a sweep
+ */
+typedef struct {
+	uint64_t reads;			/* Reads made */
+	uint64_t syscalls;		/* System calls made */
+	uint64_t bytes;			/* Bytes read */
+	double usecs;			/* Time taken */
+} totals_t;
+
+static uint64_t *buf;
+
+/*
+ *  timer_usecs()
+ *	monotonic time in microseconds
+ */
+static double timer_usecs(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec * 1000000.0) + ((double)ts.tv_nsec / 1000.0);
+}
+
+/*
+ *  read_pread()
+ *	make a batch of reads with pread, one syscall each
+ */
+static uint32_t read_pread(uring_t *ring, uring_read_t *reads, const size_t n)
+{
+	size_t i;
+
+	(void)ring;
+	for (i = 0; i < n; i++) {
+		uring_read_t *r = &reads[i];
+
+		r->ret = pread(r->fd, r->buf, r->len, r->offset);
+		if (r->ret < 0)
+			r->ret = -errno;
+	}
+	return (uint32_t)n;
+}
+
+/*
+ *  read_uring()
+ *	make a batch of reads with io_uring
+ */
+static uint32_t read_uring(uring_t *ring, uring_read_t *reads, const size_t n)
+{
+	const int ret = uring_read(ring, reads, n);
+
+	if (ret < 0) {
+		fprintf(stderr, "io_uring read failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return (uint32_t)ret;
+}
+
+/*
+ *  sweep()
+ *	read the ranges in batches the way pagemon's sample_read()
+ *	does, at most URING_ENTRIES reads of at most BUF_WORDS
+ *	words in all, each batch made by read_func
+ */
+static void sweep(
+	uint32_t (*read_func)(uring_t *, uring_read_t *, const size_t),
+	uring_t *ring,
+	const int fd,
+	const range_t *ranges,
+	const size_t nranges,
+	totals_t *t)
+{
+	uring_read_t reads[URING_ENTRIES];
+	size_t i = 0, k;
+	double start = timer_usecs();
+
+	memset(t, 0, sizeof(*t));
+	while (i < nranges) {
+		size_t nreads = 0, used = 0;
+
+		while ((i < nranges) && (nreads < URING_ENTRIES) &&
+		       (used + ranges[i].count <= BUF_WORDS)) {
+			uring_read_t *r = &reads[nreads++];
+
+			r->fd = fd;
+			r->buf = buf + used;
+			r->len = ranges[i].count * sizeof(*buf);
+			r->offset = (off_t)(ranges[i].first * sizeof(*buf));
+			used += ranges[i].count;
+			i++;
+		}
+		t->syscalls += read_func(ring, reads, nreads);
+		t->reads += nreads;
+		for (k = 0; k < nreads; k++)
+			if (reads[k].ret > 0)
+				t->bytes += (uint64_t)reads[k].ret;
+	}
+	t->usecs = timer_usecs() - start;
+}
+
+/*
+ *  bench()
+ *	sweep the ranges RUNS times with pread and with
+ *	io_uring and show the best time of each
+ */
+static void bench(const char *name, uring_t *ring, const int fd,
+	const range_t *ranges, const size_t nranges)
+{
+	totals_t best_p, best_u, t;
+	int run;
+
+	memset(&best_p, 0, sizeof(best_p));
+	memset(&best_u, 0, sizeof(best_u));
+	best_p.usecs = best_u.usecs = 1e30;
+	for (run = 0; run < RUNS; run++) {
+		sweep(read_pread, NULL, fd, ranges, nranges, &t);
+		if (t.usecs < best_p.usecs)
+			best_p = t;
+		if (ring->fd >= 0) {
+			sweep(read_uring, ring, fd, ranges, nranges, &t);
+			if (t.usecs < best_u.usecs)
+				best_u = t;
+		}
+	}
+	printf("%-10s pread:    %7" PRIu64 " reads %7" PRIu64 " syscalls "
+		"%10.1f us\n", name, best_p.reads, best_p.syscalls,
+		best_p.usecs);
+	if (ring->fd < 0)
+		return;
+	printf("%-10s io_uring: %7" PRIu64 " reads %7" PRIu64 " syscalls "
+		"%10.1f us\n", name, best_u.reads, best_u.syscalls,
+		best_u.usecs);
+	if (best_p.bytes != best_u.bytes) {
+		fprintf(stderr, "%s: pread read %" PRIu64 " bytes, io_uring "
+			"%" PRIu64 "\n", name, best_p.bytes, best_u.bytes);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(void)
+{
+	const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	uint64_t first;
+	range_t *ranges;
+	size_t i, nranges;
+	uring_t ring;
+	char *region;
+	int fd;
+
+	buf = malloc(BUF_WORDS * sizeof(*buf));
+	ranges = calloc(REGION_PAGES / CELL_STRIDE + 1, sizeof(*ranges));
+	if (!buf || !ranges) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	region = mmap(NULL, REGION_PAGES * page_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED) {
+		fprintf(stderr, "Cannot map region: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < REGION_PAGES; i += TOUCH_STRIDE)
+		region[i * page_size] = 1;
+
+	fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open /proc/self/pagemap: %s\n",
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	uring_init(&ring);
+	if (uring_open(&ring) < 0)
+		printf("io_uring not available, pread only\n");
+
+	first = (uint64_t)(uintptr_t)region / page_size;
+
+	/* A whole map sweep, large contiguous reads */
+	for (nranges = 0, i = 0; i < REGION_PAGES; i += SWEEP_WORDS, nranges++) {
+		ranges[nranges].first = first + i;
+		ranges[nranges].count = SWEEP_WORDS;
+	}
+	bench("sweep", &ring, fd, ranges, nranges);
+
+	/* A page view, many small reads spread over the map */
+	for (nranges = 0, i = 0; i < REGION_PAGES; i += CELL_STRIDE, nranges++) {
+		ranges[nranges].first = first + i;
+		ranges[nranges].count = CELL_WORDS;
+	}
+	bench("page view", &ring, fd, ranges, nranges);
+
+	uring_close(&ring);
+	(void)close(fd);
+	(void)munmap(region, REGION_PAGES * page_size);
+	free(ranges);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
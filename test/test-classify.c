@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "classify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define MAX_WORDS	(4099)		/* Longest buffer tested */
+#define BENCH_WORDS	(65536)		/* Words per bench call */
+#define BENCH_SECS	(0.5)		/* Minimum time of a bench run */
+
+static const char *isas[] = { "sse2", "avx2" };
+
+/*
+ *  Pagemap bits the classifiers look at, random words
+ *  are made mostly of these so every state is hit
+ */
+static const pagemap_t bits[] = {
+	PAGE_PRESENT,
+	PAGE_SWAPPED,
+	PAGE_FILE_SHARED_ANON,
+	PAGE_PTE_SOFT_DIRTY,
+	PAGE_EXCLUSIVE_MAPPED,
+	PAGE_HUGE_MAPPED,
+	PAGE_PTE_UFFD_WP,
+};
+
+static uint64_t seed = 0x2545f4914f6cdd1dULL;
+static volatile uint64_t sink;		/* Keeps bench results live */
+
+/*
+ *  rnd()
+ *	xorshift64 pseudo random number
+ */
+static uint64_t rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+/*
+ *  rnd_word()
+ *	random pagemap word, each bit the classifiers look
+ *	at is set half the time over random PFN bits
+ */
+static pagemap_t rnd_word(void)
+{
+	pagemap_t w = rnd() & PAGE_PFN_MASK;
+	const uint64_t r = rnd();
+	size_t i;
+
+	/* Now and then all bits set or none */
+	if ((r & 0xff) == 0)
+		return ~0ULL;
+	if ((r & 0xff) == 1)
+		return 0;
+	for (i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+		if (r & (1ULL << (8 + i)))
+			w |= bits[i];
+	return w;
+}
+
+/*
+ *  counts_equal()
+ *	are all fields of two sets of counts the same?
+ */
+static bool counts_equal(const page_counts_t *a, const page_counts_t *b)
+{
+	size_t i;
+
+	if ((a->pages != b->pages) || (a->present != b->present) ||
+	    (a->swapped != b->swapped) || (a->file != b->file) ||
+	    (a->dirty != b->dirty) || (a->exclusive != b->exclusive) ||
+	    (a->huge != b->huge))
+		return false;
+	for (i = 0; i < PAGE_STATE_MAX; i++)
+		if (a->state[i] != b->state[i])
+			return false;
+	return true;
+}
+
+/*
+ *  test_isa()
+ *	check the named classifier gives the same states and
+ *	counts as the scalar one for every length up to
+ *	MAX_WORDS, from aligned and unaligned starts
+ */
+static int test_isa(const char *name, const classify_func_t func,
+	const classify_func_t scalar)
+{
+	static pagemap_t words[MAX_WORDS + 1];
+	static uint8_t states[MAX_WORDS], ref_states[MAX_WORDS];
+	size_t n, i, off;
+	int failures = 0;
+
+	for (n = 0; n <= MAX_WORDS; n = (n < 67) ? n + 1 : n * 2 + 3) {
+		for (off = 0; off < 2; off++) {
+			page_counts_t counts, ref;
+
+			for (i = 0; i < n + off; i++)
+				words[i] = rnd_word();
+			memset(&counts, 0, sizeof(counts));
+			memset(&ref, 0, sizeof(ref));
+			memset(states, 0xff, sizeof(states));
+			memset(ref_states, 0xff, sizeof(ref_states));
+
+			scalar(words + off, n, ref_states, &ref);
+			func(words + off, n, states, &counts);
+			if (memcmp(states, ref_states, sizeof(states))) {
+				fprintf(stderr, "FAIL: %s: states differ, "
+					"n = %zu, offset %zu\n", name, n, off);
+				failures++;
+			}
+			if (!counts_equal(&counts, &ref)) {
+				fprintf(stderr, "FAIL: %s: counts differ, "
+					"n = %zu, offset %zu\n", name, n, off);
+				failures++;
+			}
+
+			/* Counts must add up without states too */
+			memset(&counts, 0, sizeof(counts));
+			func(words + off, n, NULL, &counts);
+			if (!counts_equal(&counts, &ref)) {
+				fprintf(stderr, "FAIL: %s: counts differ "
+					"with no states, n = %zu, offset %zu\n",
+					name, n, off);
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+/*
+ *  test_scalar()
+ *	check the scalar classifier gives each page the
+ *	state of its highest priority bit
+ */
+static int test_scalar(const classify_func_t scalar)
+{
+	static const struct {
+		pagemap_t word;		/* Pagemap word */
+		uint8_t state;		/* Its expected state */
+	} words[] = {
+		{ 0,						PAGE_STATE_NONE },
+		{ PAGE_PTE_UFFD_WP,				PAGE_STATE_NONE },
+		{ PAGE_PRESENT,					PAGE_STATE_PRESENT },
+		{ PAGE_PRESENT | PAGE_EXCLUSIVE_MAPPED,		PAGE_STATE_PRESENT },
+		{ PAGE_SWAPPED,					PAGE_STATE_SWAPPED },
+		{ PAGE_PRESENT | PAGE_FILE_SHARED_ANON,		PAGE_STATE_FILE },
+		{ PAGE_SWAPPED | PAGE_FILE_SHARED_ANON,		PAGE_STATE_FILE },
+		{ PAGE_PRESENT | PAGE_HUGE_MAPPED,		PAGE_STATE_HUGE },
+		{ PAGE_FILE_SHARED_ANON | PAGE_HUGE_MAPPED,	PAGE_STATE_HUGE },
+		{ PAGE_PRESENT | PAGE_PTE_SOFT_DIRTY,		PAGE_STATE_DIRTY },
+		{ ~0ULL,					PAGE_STATE_DIRTY },
+	};
+	size_t i;
+	int failures = 0;
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		page_counts_t counts;
+		uint8_t state;
+
+		memset(&counts, 0, sizeof(counts));
+		scalar(&words[i].word, 1, &state, &counts);
+		if ((state != words[i].state) || (counts.pages != 1) ||
+		    (counts.state[words[i].state] != 1)) {
+			fprintf(stderr, "FAIL: scalar: word 0x%16.16" PRIx64
+				" state %u, expected %u\n", words[i].word,
+				state, words[i].state);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+/*
+ *  timer_secs()
+ *	monotonic time in seconds
+ */
+static double timer_secs(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
+/*
+ *  bench_isa()
+ *	pagemap words a second classified by func
+ */
+static void bench_isa(const char *name, const classify_func_t func,
+	const pagemap_t *words, uint8_t *states)
+{
+	page_counts_t counts;
+	unsigned long runs;
+	double t;
+
+	memset(&counts, 0, sizeof(counts));
+	t = timer_secs();
+	for (runs = 0; (timer_secs() - t < BENCH_SECS) || !runs; runs++)
+		func(words, BENCH_WORDS, states, &counts);
+	t = timer_secs() - t;
+	sink = counts.pages;
+	printf("%-8s %14.0f entries/s\n", name,
+		(double)(runs * BENCH_WORDS) / t);
+}
+
+int main(int argc, char **argv)
+{
+	const classify_func_t scalar = classify_select("scalar");
+	size_t i;
+	int failures = 0;
+
+	if ((argc > 1) && !strcmp(argv[1], "-b")) {
+		static pagemap_t words[BENCH_WORDS];
+		static uint8_t states[BENCH_WORDS];
+
+		for (i = 0; i < BENCH_WORDS; i++)
+			words[i] = rnd_word();
+		bench_isa("scalar", scalar, words, states);
+		for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			const classify_func_t func = classify_select(isas[i]);
+
+			if (func)
+				bench_isa(isas[i], func, words, states);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	failures += test_scalar(scalar);
+	for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+		const classify_func_t func = classify_select(isas[i]);
+
+		if (!func) {
+			printf("test-classify: %s not supported, skipped\n",
+				isas[i]);
+			continue;
+		}
+		failures += test_isa(isas[i], func, scalar);
+	}
+	if (failures) {
+		fprintf(stderr, "test-classify: %d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("test-classify: all passed\n");
+	return EXIT_SUCCESS;
+}
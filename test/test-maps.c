@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "maps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define BENCH_SECS	(0.5)		/* Minimum time of a bench run */
+
+/*
+ *  A line and what maps_parse() should make of it
+ */
+typedef struct {
+	const char *line;		/* Line of a maps file */
+	bool ok;			/* Should it parse? */
+	uint64_t begin;			/* Start of mapping */
+	uint64_t end;			/* End of mapping */
+	const char *attr;		/* Map attributes */
+	uint64_t offset;		/* Offset into mapped file */
+	const char *dev;		/* Map device */
+	uint64_t inode;			/* Inode of mapped file */
+	const char *name;		/* Pathname */
+} expect_t;
+
+static const expect_t expects[] = {
+	{ "55d4c0a00000-55d4c0a02000 r--p 00000000 fd:01 1835021"
+	  "                    /usr/bin/pagemon", true,
+	  0x55d4c0a00000ULL, 0x55d4c0a02000ULL, "r--p", 0, "fd:01",
+	  1835021, "/usr/bin/pagemon" },
+	{ "55d4c0a00000-55d4c0a02000 r--p 00000000 fd:01 1835021"
+	  "                    /usr/bin/my prog", true,
+	  0x55d4c0a00000ULL, 0x55d4c0a02000ULL, "r--p", 0, "fd:01",
+	  1835021, "/usr/bin/my prog" },
+	{ "55d4c0a02000-55d4c0a07000 r-xp 00002000 fd:01 1835021"
+	  "                    /usr/bin/my prog (deleted)", true,
+	  0x55d4c0a02000ULL, 0x55d4c0a07000ULL, "r-xp", 0x2000, "fd:01",
+	  1835021, "/usr/bin/my prog (deleted)" },
+	{ "ffffffffff600000-ffffffffff601000 --xp 00000000 00:00 0"
+	  "                  [vsyscall]", true,
+	  0xffffffffff600000ULL, 0xffffffffff601000ULL, "--xp", 0, "00:00",
+	  0, "[vsyscall]" },
+	{ "7f2a20400000-7f2a20600000 rw-p 00000000 00:00 0"
+	  "                          [anon:java heap]", true,
+	  0x7f2a20400000ULL, 0x7f2a20600000ULL, "rw-p", 0, "00:00",
+	  0, "[anon:java heap]" },
+	{ "7f2a1c021000-7f2a20000000 ---p 00000000 00:00 0", true,
+	  0x7f2a1c021000ULL, 0x7f2a20000000ULL, "---p", 0, "00:00", 0, "" },
+	{ "7f2a1c000000-7f2a1c021000 rw-p 00000000 00:00 0 ", true,
+	  0x7f2a1c000000ULL, 0x7f2a1c021000ULL, "rw-p", 0, "00:00", 0, "" },
+	{ "7F2A20800000-7F2A20801000 r--s 7FFF0000 00:05 1025"
+	  "                       /dev/mem", true,
+	  0x7f2a20800000ULL, 0x7f2a20801000ULL, "r--s", 0x7fff0000, "00:05",
+	  1025, "/dev/mem" },
+	/* Devices too long for map_t are cut short */
+	{ "7f2a20600000-7f2a20628000 r--p 00000000 103:02 2621612"
+	  "                   /usr/lib/libc.so.6", true,
+	  0x7f2a20600000ULL, 0x7f2a20628000ULL, "r--p", 0, "103:0",
+	  2621612, "/usr/lib/libc.so.6" },
+	{ "", false, 0, 0, NULL, 0, NULL, 0, NULL },
+	{ "garbage", false, 0, 0, NULL, 0, NULL, 0, NULL },
+	{ "7f2a1c000000 7f2a1c021000 rw-p 00000000 00:00 0", false,
+	  0, 0, NULL, 0, NULL, 0, NULL },
+	{ "7f2a1c000000-7f2a1c021000 rw-p", false,
+	  0, 0, NULL, 0, NULL, 0, NULL },
+	{ "7f2a1c000000-7f2a1c021000 rw-p 00000000 00:00", false,
+	  0, 0, NULL, 0, NULL, 0, NULL },
+	{ "7f2a1c000000-7f2a1c021000 rw-p 00000000 00:00 x", false,
+	  0, 0, NULL, 0, NULL, 0, NULL },
+};
+
+static int failures;
+static volatile uint64_t sink;		/* Keeps bench results live */
+
+/*
+ *  fail()
+ *	report a failed check
+ */
+static void fail(const char *what, const char *line)
+{
+	fprintf(stderr, "FAIL: %s: \"%s\"\n", what, line);
+	failures++;
+}
+
+/*
+ *  guarded_copy()
+ *	copy len bytes of str so they end at a PROT_NONE page,
+ *	any read past the end of the copy faults
+ */
+static char *guarded_copy(const char *str, const size_t len, void **map,
+	size_t *map_len)
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t pages = (len + page - 1) / page + 1;
+	char *buf;
+
+	*map_len = pages * page;
+	*map = mmap(NULL, *map_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (*map == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	buf = (char *)*map + (pages - 1) * page;
+	(void)mprotect(buf, page, PROT_NONE);
+	buf -= len;
+	memcpy(buf, str, len);
+	return buf;
+}
+
+/*
+ *  test_expects()
+ *	check each line of expects parses as expected, and that
+ *	every cut short copy of it parses without reading past
+ *	its end, into the same fields up to where it was cut
+ */
+static void test_expects(void)
+{
+	size_t i, cut;
+
+	for (i = 0; i < sizeof(expects) / sizeof(expects[0]); i++) {
+		const expect_t *e = &expects[i];
+		const size_t len = strlen(e->line);
+		maps_line_t line;
+		const char *next;
+		void *map;
+		size_t map_len;
+		char *buf = guarded_copy(e->line, len, &map, &map_len);
+		const bool ok = maps_parse(buf, buf + len, &line, &next);
+
+		if (ok != e->ok) {
+			fail(e->ok ? "did not parse" : "parsed", e->line);
+		} else if (ok) {
+			if ((line.begin != e->begin) || (line.end != e->end))
+				fail("address range", e->line);
+			if (strcmp(line.attr, e->attr))
+				fail("attributes", e->line);
+			if (line.offset != e->offset)
+				fail("offset", e->line);
+			if (strcmp(line.dev, e->dev))
+				fail("device", e->line);
+			if (line.inode != e->inode)
+				fail("inode", e->line);
+			if ((line.name_len != strlen(e->name)) ||
+			    memcmp(line.name, e->name, line.name_len))
+				fail("pathname", e->line);
+		}
+		if (next != buf + len)
+			fail("next line", e->line);
+		(void)munmap(map, map_len);
+
+		/* A last line cut short must not be read past its end */
+		for (cut = 0; cut < len; cut++) {
+			maps_line_t part;
+
+			buf = guarded_copy(e->line, cut, &map, &map_len);
+			if (maps_parse(buf, buf + cut, &part, &next) && ok &&
+			    ((part.begin != line.begin) ||
+			     (part.name_len > line.name_len)))
+				fail("cut short line", e->line);
+			(void)munmap(map, map_len);
+		}
+	}
+}
+
+/*
+ *  old_parse()
+ *	the sscanf parse maps_parse() replaced, pathnames
+ *	end at the first space
+ */
+static bool old_parse(const char *buf, maps_line_t *line, char *name)
+{
+	char attr[16], dev[16];
+	int ret;
+
+	ret = sscanf(buf, "%" SCNx64 "-%" SCNx64 " %5s %*s %15s %*d %4095s",
+		&line->begin, &line->end, attr, dev, name);
+	if ((ret != 5) && (ret != 4))
+		return false;
+	if (ret == 4)
+		*name = '\0';
+	memcpy(line->attr, attr, sizeof(line->attr) - 1);
+	line->attr[sizeof(line->attr) - 1] = '\0';
+	memcpy(line->dev, dev, sizeof(line->dev) - 1);
+	line->dev[sizeof(line->dev) - 1] = '\0';
+	return true;
+}
+
+/*
+ *  read_file()
+ *	read a whole file, NULL if it cannot be read
+ */
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "r");
+	char *data = NULL;
+	size_t size = 0;
+
+	*len = 0;
+	if (!fp)
+		return NULL;
+	for (;;) {
+		char *tmp;
+		size_t n;
+
+		if (*len + 4096 + 1 > size) {
+			size = (size + 4096 + 1) * 2;
+			tmp = realloc(data, size);
+			if (!tmp) {
+				free(data);
+				(void)fclose(fp);
+				return NULL;
+			}
+			data = tmp;
+		}
+		n = fread(data + *len, 1, 4096, fp);
+		if (!n)
+			break;
+		*len += n;
+	}
+	data[*len] = '\0';
+	(void)fclose(fp);
+	return data;
+}
+
+/*
+ *  test_file()
+ *	parse every line of a captured maps file, each must parse
+ *	and agree with the old sscanf parse, whose pathname is
+ *	the first word of ours
+ */
+static void test_file(const char *path)
+{
+	size_t len, lines = 0;
+	char *data = read_file(path, &len);
+	const char *ptr, *end;
+
+	if (!data) {
+		fprintf(stderr, "FAIL: cannot read %s\n", path);
+		failures++;
+		return;
+	}
+	for (ptr = data, end = data + len; ptr < end; lines++) {
+		static char name[4096];
+		maps_line_t line, old;
+		const char *next, *eol = memchr(ptr, '\n', (size_t)(end - ptr));
+		char text[4096];
+		size_t n = eol ? (size_t)(eol - ptr) : (size_t)(end - ptr);
+		size_t word;
+
+		n = (n < sizeof(text) - 1) ? n : sizeof(text) - 1;
+		memcpy(text, ptr, n);
+		text[n] = '\0';
+		if (!maps_parse(ptr, end, &line, &next)) {
+			fail("did not parse", text);
+		} else if (!old_parse(text, &old, name)) {
+			fail("old parse", text);
+		} else {
+			word = strcspn(line.name, " \n");
+			if (word > line.name_len)
+				word = line.name_len;
+			if ((line.begin != old.begin) || (line.end != old.end) ||
+			    strcmp(line.attr, old.attr) ||
+			    strcmp(line.dev, old.dev) ||
+			    (word != strlen(name)) ||
+			    memcmp(line.name, name, word))
+				fail("differs from sscanf", text);
+		}
+		ptr = next;
+	}
+	printf("%-24s %6zu lines ok\n", path, lines);
+	free(data);
+}
+
+/*
+ *  timer_secs()
+ *	monotonic time in seconds
+ */
+static double timer_secs(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
+/*
+ *  bench()
+ *	lines a second parsed by maps_parse() and by fgets and
+ *	the old sscanf, of a maps file of nlines lines made from
+ *	the lines of the captured files
+ */
+static void bench(const char *const *paths, const int npaths,
+	const size_t nlines)
+{
+	char *lines = NULL, *data, name[4096];
+	size_t len = 0, lines_len = 0, size, i, n = 0;
+	double t, new_rate, old_rate;
+	uint64_t sum = 0;
+	unsigned long runs;
+	int p;
+
+	for (p = 0; p < npaths; p++) {
+		size_t flen;
+		char *f = read_file(paths[p], &flen);
+
+		if (!f)
+			continue;
+		lines = realloc(lines, lines_len + flen + 1);
+		if (!lines)
+			exit(EXIT_FAILURE);
+		memcpy(lines + lines_len, f, flen);
+		lines_len += flen;
+		if (flen && (f[flen - 1] != '\n'))
+			lines[lines_len++] = '\n';
+		free(f);
+	}
+	if (!lines_len)
+		return;
+
+	size = nlines * 160;
+	data = malloc(size + 1);
+	if (!data)
+		exit(EXIT_FAILURE);
+	for (i = 0; n < nlines; ) {
+		const char *eol = memchr(lines + i, '\n', lines_len - i);
+		const size_t l = (size_t)(eol - (lines + i)) + 1;
+
+		if (len + l > size) {
+			size *= 2;
+			data = realloc(data, size + 1);
+			if (!data)
+				exit(EXIT_FAILURE);
+		}
+		memcpy(data + len, lines + i, l);
+		len += l;
+		n++;
+		i += l;
+		if (i >= lines_len)
+			i = 0;
+	}
+	data[len] = '\0';
+
+	t = timer_secs();
+	for (runs = 0; (timer_secs() - t < BENCH_SECS) || !runs; runs++) {
+		const char *ptr = data, *next;
+		maps_line_t line;
+
+		while (ptr < data + len) {
+			if (maps_parse(ptr, data + len, &line, &next))
+				sum += line.begin + line.name_len;
+			ptr = next;
+		}
+	}
+	new_rate = (double)(runs * nlines) / (timer_secs() - t);
+
+	t = timer_secs();
+	for (runs = 0; (timer_secs() - t < BENCH_SECS) || !runs; runs++) {
+		FILE *fp = fmemopen(data, len, "r");
+		char buf[4096];
+		maps_line_t line;
+
+		if (!fp)
+			exit(EXIT_FAILURE);
+		while (fgets(buf, sizeof(buf), fp))
+			if (old_parse(buf, &line, name))
+				sum += line.begin;
+		(void)fclose(fp);
+	}
+	old_rate = (double)(runs * nlines) / (timer_secs() - t);
+
+	sink = sum;
+	printf("%8zu lines: maps_parse %12.0f lines/s, sscanf %12.0f "
+		"lines/s, %5.1fx\n", nlines, new_rate, old_rate,
+		new_rate / old_rate);
+	free(data);
+	free(lines);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 1000, 64000, 1000000 };
+	bool benchmark = false;
+	size_t i;
+	int arg = 1;
+
+	if ((argc > 1) && !strcmp(argv[1], "-b")) {
+		benchmark = true;
+		arg++;
+	}
+	if (benchmark) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			bench((const char *const *)argv + arg, argc - arg,
+				sizes[i]);
+		return EXIT_SUCCESS;
+	}
+
+	test_expects();
+	for (; arg < argc; arg++)
+		test_file(argv[arg]);
+	test_file("/proc/self/maps");
+	if (failures) {
+		fprintf(stderr, "test-maps: %d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("test-maps: all passed\n");
+	return EXIT_SUCCESS;
+}
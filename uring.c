@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include "uring.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(URING_ENABLED)
+
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#define URING_PROBE_OPS	(256)		/* Ops to probe for */
+
+/*
+ *  uring_setup()
+ *	io_uring_setup system call
+ */
+static inline int uring_setup(const uint32_t entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+/*
+ *  uring_enter()
+ *	io_uring_enter system call
+ */
+static inline int uring_enter(
+	const int fd,
+	const uint32_t to_submit,
+	const uint32_t min_complete,
+	const uint32_t flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit,
+		min_complete, flags, NULL, 0);
+}
+
+/*
+ *  uring_read_supported()
+ *	probe the kernel for IORING_OP_READ, which
+ *	reads at an offset without an iovec
+ */
+static int uring_read_supported(const int fd)
+{
+	const size_t sz = sizeof(struct io_uring_probe) +
+		URING_PROBE_OPS * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe;
+	char buf[sz];
+
+	memset(buf, 0, sz);
+	probe = (struct io_uring_probe *)buf;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+	    probe, URING_PROBE_OPS) < 0)
+		return 0;
+
+	return (probe->last_op >= IORING_OP_READ) &&
+		(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+}
+
+/*
+ *  uring_open()
+ *	set up an io_uring for batched reads, fails if
+ *	io_uring is not available or cannot do reads,
+ *	for example if it has been disabled by sysctl
+ *	or a seccomp filter
+ */
+int uring_open(uring_t *ring)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	uring_init(ring);
+	memset(&p, 0, sizeof(p));
+	ring->fd = uring_setup(URING_ENTRIES, &p);
+	if (ring->fd < 0)
+		goto fail;
+	if (!uring_read_supported(ring->fd))
+		goto fail;
+
+	ring->entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array +
+		p.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto fail;
+	}
+	if (ring->cq_ring_size) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto fail;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	sq = (uint8_t *)ring->sq_ring;
+	cq = ring->cq_ring ? (uint8_t *)ring->cq_ring : sq;
+	ring->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	ring->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	ring->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ring->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	ring->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	ring->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+	ring->cqes = cq + p.cq_off.cqes;
+
+	return 0;
+fail:
+	uring_close(ring);
+	return -1;
+}
+
+/*
+ *  uring_read()
+ *	make n reads, queueing as many as the ring has
+ *	room for, submitting them and waiting for all of
+ *	them with one io_uring_enter, until all are done.
+ *	Returns the number of system calls made, or -1 if
+ *	the reads could not be submitted.
+ */
+int uring_read(uring_t *ring, uring_read_t *reads, const size_t n)
+{
+	struct io_uring_sqe *sqes = (struct io_uring_sqe *)ring->sqes;
+	struct io_uring_cqe *cqes = (struct io_uring_cqe *)ring->cqes;
+	size_t queued = 0, done = 0;
+	uint32_t to_submit = 0;
+	int syscalls = 0;
+
+	if (ring->fd < 0)
+		return -1;
+
+	while (done < n) {
+		uint32_t tail = *ring->sq_tail, head;
+		int ret;
+
+		/* Never have more in flight than the completion ring holds */
+		while ((queued < n) && (queued - done < ring->entries)) {
+			const uint32_t i = tail & *ring->sq_mask;
+			struct io_uring_sqe *sqe = &sqes[i];
+			const uring_read_t *r = &reads[queued];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = r->fd;
+			sqe->addr = (uint64_t)(uintptr_t)r->buf;
+			sqe->len = (uint32_t)r->len;
+			sqe->off = (uint64_t)r->offset;
+			sqe->user_data = queued;
+			ring->sq_array[i] = i;
+			tail++;
+			queued++;
+			to_submit++;
+		}
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		ret = uring_enter(ring->fd, to_submit,
+			(uint32_t)(queued - done), IORING_ENTER_GETEVENTS);
+		syscalls++;
+		if (ret < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN) ||
+			    (errno == EBUSY))
+				continue;
+			return -1;
+		}
+		to_submit -= (uint32_t)ret;
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			const struct io_uring_cqe *cqe =
+				&cqes[head & *ring->cq_mask];
+
+			reads[cqe->user_data].ret = cqe->res;
+			done++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return syscalls;
+}
+
+/*
+ *  uring_close()
+ *	unmap the rings and close the io_uring
+ */
+void uring_close(uring_t *ring)
+{
+	if (ring->sqes)
+		(void)munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring)
+		(void)munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		(void)munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		(void)close(ring->fd);
+	uring_init(ring);
+}
+
+#else
+
+int uring_open(uring_t *ring)
+{
+	uring_init(ring);
+	return -1;
+}
+
+int uring_read(uring_t *ring, uring_read_t *reads, const size_t n)
+{
+	(void)ring;
+	(void)reads;
+	(void)n;
+
+	return -1;
+}
+
+void uring_close(uring_t *ring)
+{
+	uring_init(ring);
+}
+
+#endif
+
+/*
+ *  uring_init()
+ *	mark an io_uring as not set up
+ */
+void uring_init(uring_t *ring)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
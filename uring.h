@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Colin Ian King 2015-2017
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) &&	\
+    defined(__NR_io_uring_enter) && defined(__NR_io_uring_register) && \
+    defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_ENABLED
+#endif
+#endif
+
+#define URING_ENTRIES	(256)		/* Submission queue entries */
+
+/*
+ *  A read to be made in a batch of reads
+ */
+typedef struct {
+	int fd;				/* File to read */
+	void *buf;			/* Buffer to read into */
+	size_t len;			/* Bytes to read */
+	off_t offset;			/* Offset to read from */
+	ssize_t ret;			/* Bytes read, or -errno */
+} uring_read_t;
+
+/*
+ *  io_uring instance, the submission and completion
+ *  rings are mapped from the kernel
+ */
+typedef struct {
+	int fd;				/* io_uring fd, -1 if not set up */
+	uint32_t entries;		/* Submission queue entries */
+	void *sq_ring;			/* Submission ring mapping */
+	size_t sq_ring_size;		/* Size of sq_ring mapping */
+	void *cq_ring;			/* Completion ring mapping */
+	size_t cq_ring_size;		/* Size of cq_ring mapping */
+	void *sqes;			/* Submission queue entries */
+	size_t sqes_size;		/* Size of sqes mapping */
+	uint32_t *sq_head;		/* Submission ring head */
+	uint32_t *sq_tail;		/* Submission ring tail */
+	uint32_t *sq_mask;		/* Submission ring index mask */
+	uint32_t *sq_array;		/* Submission ring sqe indexes */
+	uint32_t *cq_head;		/* Completion ring head */
+	uint32_t *cq_tail;		/* Completion ring tail */
+	uint32_t *cq_mask;		/* Completion ring index mask */
+	void *cqes;			/* Completion queue entries */
+} uring_t;
+
+extern void uring_init(uring_t *ring);
+extern int uring_open(uring_t *ring);
+extern int uring_read(uring_t *ring, uring_read_t *reads, const size_t n);
+extern void uring_close(uring_t *ring);
+
+#endif